@@ -0,0 +1,347 @@
+/*
+ * Live aircraft state table
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "modes.h"
+#include "cpr.h"
+#include "aircraft.h"
+
+#define AC_USED 0x80000000 /* in addrs[]; 0 is an empty slot */
+
+#define AC_PAIRSECS 10 /* even/odd this close together decode globally */
+#define AC_SURFACEPAIRSECS 25 /* surface positions come slower */
+#define AC_LOCALSECS 30 /* own last position is good for a local decode */
+
+struct actable {
+	/* hot: everything a probe or a sweep looks at */
+	unsigned int *addrs;
+	time_t *seen;
+	/* cold, same index */
+	struct aircraft *acs;
+
+	unsigned int size; /* power of 2 */
+	unsigned int n;
+
+	int hasref; /* receiver position, for surface decodes */
+	double reflat, reflon;
+};
+
+static inline unsigned int
+ac_hash(unsigned int addr, unsigned int size)
+{
+	return (addr * 2654435761U) >> 8 & (size - 1);
+}
+
+static double
+tvsecs(const struct timeval *a, const struct timeval *b)
+{
+	return (a->tv_sec - b->tv_sec) + (a->tv_usec - b->tv_usec) / 1e6;
+}
+
+static int
+ac_alloc(struct actable *t, unsigned int size)
+{
+	t->size = size;
+	t->n = 0;
+	t->addrs = calloc(size, sizeof(unsigned int));
+	t->seen = calloc(size, sizeof(time_t));
+	t->acs = calloc(size, sizeof(struct aircraft));
+	if (!t->addrs || !t->seen || !t->acs) {
+		free(t->addrs);
+		free(t->seen);
+		free(t->acs);
+		return -1;
+	}
+	return 0;
+}
+
+struct actable *
+ac_new(int size)
+{
+	struct actable *t;
+	unsigned int n;
+
+	for (n = 64; n < size * 2; n <<= 1)
+		;
+	if (!(t = (struct actable *)malloc(sizeof(struct actable))))
+		return NULL;
+	memset(t, 0, sizeof(struct actable));
+	if (ac_alloc(t, n) == -1) {
+		free(t);
+		return NULL;
+	}
+	return t;
+}
+
+void
+ac_free(struct actable *t)
+{
+	if (!t) return;
+
+	free(t->addrs);
+	free(t->seen);
+	free(t->acs);
+	free(t);
+	return;
+}
+
+void
+ac_setref(struct actable *t, double lat, double lon)
+{
+	t->hasref = 1;
+	t->reflat = lat;
+	t->reflon = lon;
+	return;
+}
+
+static int
+ac_slot(struct actable *t, unsigned int addr)
+{
+	unsigned int h;
+
+	for (h = ac_hash(addr, t->size); t->addrs[h]; h = (h + 1) & (t->size - 1)) {
+		if (t->addrs[h] == (addr | AC_USED))
+			return h;
+	}
+	return -(int)h - 1; /* where it'd go */
+}
+
+static int
+ac_grow(struct actable *t)
+{
+	struct actable old = *t;
+	unsigned int i;
+
+	if (ac_alloc(t, old.size * 2) == -1) {
+		*t = old;
+		return -1;
+	}
+	for (i = 0; i < old.size; i++) {
+		int h;
+
+		if (!old.addrs[i])
+			continue;
+		h = -ac_slot(t, old.addrs[i] & ~AC_USED) - 1;
+		t->addrs[h] = old.addrs[i];
+		t->seen[h] = old.seen[i];
+		t->acs[h] = old.acs[i];
+		t->n++;
+	}
+	free(old.addrs);
+	free(old.seen);
+	free(old.acs);
+	return 0;
+}
+
+struct aircraft *
+ac_find(struct actable *t, unsigned int addr)
+{
+	int h = ac_slot(t, addr);
+	return (h >= 0) ? &t->acs[h] : NULL;
+}
+
+static struct aircraft *
+ac_create(struct actable *t, unsigned int addr, const struct timeval *tv)
+{
+	struct aircraft *ac;
+	int h;
+
+	if (((t->n + 1) * 2 > t->size) && (ac_grow(t) == -1))
+		return NULL;
+	h = -ac_slot(t, addr) - 1;
+	t->addrs[h] = addr | AC_USED;
+	t->seen[h] = tv->tv_sec;
+	t->n++;
+	ac = &t->acs[h];
+	memset(ac, 0, sizeof(struct aircraft));
+	ac->addr = addr;
+	ac->first = *tv;
+	return ac;
+}
+
+/* linear probing, so close the gap rather than leave a tombstone */
+static void
+ac_remove(struct actable *t, unsigned int i)
+{
+	unsigned int j = i, mask = t->size - 1;
+
+	for (;;) {
+		unsigned int k;
+
+		j = (j + 1) & mask;
+		if (!t->addrs[j])
+			break;
+		/* can j's entry move back to i without ending up before its home? */
+		k = ac_hash(t->addrs[j] & ~AC_USED, t->size);
+		if ((i <= j) ? ((i < k) && (k <= j)) : ((i < k) || (k <= j)))
+			continue;
+		t->addrs[i] = t->addrs[j];
+		t->seen[i] = t->seen[j];
+		t->acs[i] = t->acs[j];
+		i = j;
+	}
+	t->addrs[i] = 0;
+	t->n--;
+	return;
+}
+
+/* forget aircraft not heard for secs. returns how many went. */
+int
+ac_expire(struct actable *t, const struct timeval *now, int secs)
+{
+	time_t cutoff = now->tv_sec - secs;
+	unsigned int i = 0;
+	int n = 0;
+
+	while (i < t->size) {
+		if (t->addrs[i] && (t->seen[i] < cutoff)) {
+			ac_remove(t, i);
+			n++;
+			continue; /* something may have moved into i */
+		}
+		i++;
+	}
+	return n;
+}
+
+int
+ac_count(struct actable *t)
+{
+	return t->n;
+}
+
+void
+ac_foreach(struct actable *t, void (*cb)(void *arg, struct aircraft *ac), void *arg)
+{
+	unsigned int i;
+
+	for (i = 0; i < t->size; i++) {
+		if (t->addrs[i])
+			cb(arg, &t->acs[i]);
+	}
+	return;
+}
+
+static void
+ac_position(struct actable *t, struct aircraft *ac, const struct modes_msg *mm,
+    const struct timeval *tv)
+{
+	int odd = mm->cprodd, other = !mm->cprodd;
+	int surface = (mm->flags & MODES_SURFACE) ? 1 : 0;
+	double lat, lon;
+	int ret = -1;
+
+	ac->cprlat[odd] = mm->cprlat;
+	ac->cprlon[odd] = mm->cprlon;
+	ac->cprtime[odd] = *tv;
+	ac->cprsurface[odd] = surface;
+
+	/* a fresh even/odd pair stands on its own */
+	if (timerisset(&ac->cprtime[other]) && (ac->cprsurface[other] == surface) &&
+	    (tvsecs(tv, &ac->cprtime[other]) <= (surface ? AC_SURFACEPAIRSECS : AC_PAIRSECS))) {
+		if (!surface)
+			ret = cpr_global(ac->cprlat[0], ac->cprlon[0], ac->cprlat[1], ac->cprlon[1],
+			    odd, &lat, &lon);
+		else if (ac->flags & AC_HAS_POS)
+			ret = cpr_globalsurface(ac->cprlat[0], ac->cprlon[0], ac->cprlat[1],
+			    ac->cprlon[1], odd, ac->lat, ac->lon, &lat, &lon);
+		else if (t->hasref)
+			ret = cpr_globalsurface(ac->cprlat[0], ac->cprlon[0], ac->cprlat[1],
+			    ac->cprlon[1], odd, t->reflat, t->reflon, &lat, &lon);
+	}
+	/* otherwise one message is enough if we know roughly where it is */
+	if ((ret == -1) && (ac->flags & AC_HAS_POS) &&
+	    (tvsecs(tv, &ac->postime) <= AC_LOCALSECS))
+		ret = cpr_local(mm->cprlat, mm->cprlon, odd, surface, ac->lat, ac->lon, &lat, &lon);
+	/* the receiver's only a safe reference for things on the ground nearby */
+	if ((ret == -1) && surface && t->hasref)
+		ret = cpr_local(mm->cprlat, mm->cprlon, odd, surface, t->reflat, t->reflon,
+		    &lat, &lon);
+
+	if (ret == 0) {
+		ac->lat = lat;
+		ac->lon = lon;
+		ac->postime = *tv;
+		ac->flags |= AC_HAS_POS;
+	}
+	return;
+}
+
+/*
+ * fold a decoded message into the table. returns the aircraft it was
+ * about, or NULL if it wasn't one we can (or will) keep.
+ */
+struct aircraft *
+ac_update(struct actable *t, const struct modes_msg *mm, const struct timeval *tv)
+{
+	struct aircraft *ac;
+	int h;
+
+	if (!(mm->flags & MODES_HAS_AA))
+		return NULL;
+
+	if ((mm->df == 11) || (mm->df == 17) || (mm->df == 18)) {
+		if (!(mm->flags & MODES_CRC_OK))
+			return NULL;
+		if ((mm->df == 18) && (mm->ca != 0))
+			return NULL; /* CF says it's not an ICAO address */
+		if ((h = ac_slot(t, mm->aa)) >= 0)
+			ac = &t->acs[h];
+		else if (!(ac = ac_create(t, mm->aa, tv)))
+			return NULL;
+		else
+			h = ac_slot(t, mm->aa);
+	} else {
+		/* AP formats: the address is only as good as the parity, so no new ones */
+		if ((h = ac_slot(t, mm->aa)) < 0)
+			return NULL;
+		ac = &t->acs[h];
+	}
+	t->seen[h] = tv->tv_sec;
+	ac->last = *tv;
+	ac->messages++;
+
+	if (mm->flags & MODES_HAS_ALT) {
+		ac->altitude = mm->altitude;
+		ac->flags |= AC_HAS_ALT;
+		if (mm->flags & MODES_ALT_GNSS)
+			ac->flags |= AC_ALT_GNSS;
+		else
+			ac->flags &= ~AC_ALT_GNSS;
+	}
+	if (mm->flags & MODES_HAS_SQUAWK) {
+		ac->squawk = mm->squawk;
+		ac->flags |= AC_HAS_SQUAWK;
+	}
+	if (mm->flags & MODES_HAS_IDENT) {
+		memcpy(ac->ident, mm->ident, sizeof(ac->ident));
+		ac->category = mm->category;
+		ac->flags |= AC_HAS_IDENT;
+	}
+	if (mm->flags & (MODES_HAS_VEL | MODES_HAS_AIRSPEED)) {
+		ac->speed = mm->speed;
+		ac->flags &= ~(AC_HAS_VEL | AC_HAS_AIRSPEED);
+		ac->flags |= (mm->flags & MODES_HAS_VEL) ? AC_HAS_VEL : AC_HAS_AIRSPEED;
+	}
+	if (mm->flags & MODES_HAS_HEADING)
+		ac->track = mm->track;
+	if (mm->flags & MODES_HAS_VRATE) {
+		ac->vrate = mm->vrate;
+		ac->flags |= AC_HAS_VRATE;
+	}
+
+	/* air/ground, from whatever says so unambiguously */
+	if ((mm->flags & (MODES_HAS_POS | MODES_HAS_VS)) ||
+	    ((mm->flags & MODES_HAS_FS) && (mm->fs <= 3))) {
+		if (mm->flags & MODES_SURFACE)
+			ac->flags |= AC_SURFACE;
+		else
+			ac->flags &= ~AC_SURFACE;
+	}
+	if (mm->flags & MODES_HAS_POS)
+		ac_position(t, ac, mm, tv);
+	return ac;
+}
@@ -0,0 +1,67 @@
+
+#ifndef __MODES_AIRCRAFT_H__
+#define __MODES_AIRCRAFT_H__
+
+/*
+ * Live aircraft state, keyed by ICAO address.  The table is open addressed
+ * (linear probing) with the fields every lookup and expiry sweep touches,
+ * the address and last-heard time, kept in their own arrays; the rest of
+ * an aircraft's state is only pulled in once it's been found.
+ *
+ * New aircraft are only created from frames whose address is protected by
+ * the parity (DF11/17/18 that check out); address/parity overlay replies
+ * (DF0/4/5/16/20/21) only update aircraft already known.
+ */
+
+#include <sys/time.h>
+
+#include "modes.h"
+
+/* what's valid in struct aircraft */
+#define AC_HAS_ALT 0x0001
+#define AC_HAS_SQUAWK 0x0002
+#define AC_HAS_IDENT 0x0004
+#define AC_HAS_POS 0x0008
+#define AC_HAS_VEL 0x0010 /* speed is ground speed, track is track */
+#define AC_HAS_AIRSPEED 0x0020 /* speed is airspeed, track is heading */
+#define AC_HAS_VRATE 0x0040
+#define AC_ALT_GNSS 0x0100
+#define AC_SURFACE 0x0200
+
+struct aircraft {
+	unsigned int addr;
+	unsigned int flags;
+	struct timeval first; /* when it was first heard */
+	struct timeval last;
+	unsigned long messages;
+
+	int altitude; /* feet */
+	unsigned short squawk;
+	char ident[9];
+	unsigned char category;
+	int speed; /* knots */
+	int track; /* tenths of a degree */
+	int vrate; /* ft/min */
+	double lat, lon;
+	struct timeval postime; /* when lat/lon were last decoded */
+
+	/* most recent even [0] and odd [1] CPR positions */
+	unsigned int cprlat[2], cprlon[2];
+	struct timeval cprtime[2];
+	unsigned char cprsurface[2];
+};
+
+struct actable;
+
+extern struct actable *ac_new(int size);
+extern void ac_free(struct actable *t);
+extern void ac_setref(struct actable *t, double lat, double lon);
+extern struct aircraft *ac_find(struct actable *t, unsigned int addr);
+extern struct aircraft *ac_update(struct actable *t, const struct modes_msg *mm,
+    const struct timeval *tv);
+extern int ac_expire(struct actable *t, const struct timeval *now, int secs);
+extern int ac_count(struct actable *t);
+extern void ac_foreach(struct actable *t, void (*cb)(void *arg, struct aircraft *ac),
+    void *arg);
+
+#endif /* ndef __MODES_AIRCRAFT_H__ */
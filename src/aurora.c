@@ -6,8 +6,12 @@
 #include <sys/ioctl.h>
 #include <sys/time.h>
 #include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
 
 #include "util.h"
+#include "rbuf.h"
+#include "metrics.h"
 #include "aurora.h"
 #include "frame.h"
 
@@ -32,86 +36,84 @@ aurora_setbaud(int fd)
 #define ADXP_HEARTBEAT "$!MSRAHB"
 #define ADXP_MODERAW "$!MSRARAW,*00"
 
-static int
-aurora_init(const char *devname)
+#define AURORA_RESET 0
+#define AURORA_DTR 1
+#define AURORA_HEARTBEAT 2
+
+/* see device.h */
+int
+aurora_initstep(struct devinit *di, const char *line)
 {
-	int fd;
 	int flags;
 
-	logmsg("resetting device... \n");
-	if ((fd = open(devname, O_RDWR | O_NOCTTY | O_NDELAY)) == -1) {
-		logmsg("unable to open %s for writing: %s\n", devname, strerror(errno));
-		return -1;
-	}
-	if (fcntl(fd, F_SETFL, O_APPEND) == -1) {
-		logmsg("unable to restore blocking flag on %s\n", devname);
-		close(fd);
-		return -1;
-	}
-	if (aurora_setbaud(fd) != 0) {
-		logmsg("unable to set baud rate on %s\n", devname);
-		close(fd);
-		return -1;
-	}
-
-	/*
-	 * device is reset by raising DTR for at least 50ms. it will always
-	 * come up in NMEA mode.
-	 */
-	flags = TIOCM_DTR;
-	if (ioctl(fd, TIOCMBIS, &flags) != 0) {
-		logmsg("failed to set DTR: %s\n", strerror(errno));
-		close(fd);
-		return -1;
-	}
-	sleep(1);
-	flags = TIOCM_DTR;
-	if (ioctl(fd, TIOCMBIC, &flags) != 0) {
-		logmsg("failed to clear DTR: %s\n", strerror(errno));
-		close(fd);
-		return -1;
-	}
-
-	/* should send its first heartbeat within 15 sec */
-	for (;;) {
-		char buf[255];
-		if (readln(fd, buf, sizeof(buf)) < 0) {
-			logmsg("read error waiting for first heartbeat: %s\n", strerror(errno));
-			return -1;
+	switch (di->state) {
+	case AURORA_RESET:
+		logmsg("%s: resetting device\n", di->name);
+		if ((di->fd = open(di->name, O_RDWR | O_NOCTTY | O_NONBLOCK)) == -1) {
+			logmsg("%s: unable to open for writing: %s\n", di->name, strerror(errno));
+			return DEVINIT_FAIL;
 		}
-		if (strlen(buf) == 0) continue;
-
-		if (strncmp(buf, ADXP_HEARTBEAT, strlen(ADXP_HEARTBEAT)) == 0)
-			break;
-		if (buf[0] == '#') { /* device ID, version, etc */
-			logmsg("device info: %s\n", buf);
-			continue;
+		if (aurora_setbaud(di->fd) != 0) {
+			logmsg("%s: unable to set baud rate\n", di->name);
+			return DEVINIT_FAIL;
 		}
-
-		logmsg("unrecognized line after reset: '%s'\n", buf);
-	}
-
-	if (write(fd, ADXP_MODERAW, strlen(ADXP_MODERAW)) < strlen(ADXP_MODERAW)) {
-		logmsg("failed to write entire RAW mode string\n");
-		close(fd);
-		return -1;
+		/*
+		 * device is reset by raising DTR for at least 50ms. it will always
+		 * come up in NMEA mode.
+		 */
+		flags = TIOCM_DTR;
+		if (ioctl(di->fd, TIOCMBIS, &flags) != 0) {
+			logmsg("%s: failed to set DTR: %s\n", di->name, strerror(errno));
+			return DEVINIT_FAIL;
+		}
+		di->state = AURORA_DTR;
+		di->waitms = 1000;
+		return DEVINIT_MORE;
+
+	case AURORA_DTR:
+		if (line)
+			return DEVINIT_MORE; /* whatever it was saying before */
+		flags = TIOCM_DTR;
+		if (ioctl(di->fd, TIOCMBIC, &flags) != 0) {
+			logmsg("%s: failed to clear DTR: %s\n", di->name, strerror(errno));
+			return DEVINIT_FAIL;
+		}
+		/* should send its first heartbeat within 15 sec */
+		di->state = AURORA_HEARTBEAT;
+		di->waitms = 15000;
+		return DEVINIT_MORE;
+
+	case AURORA_HEARTBEAT:
+		if (!line) {
+			logmsg("%s: no heartbeat after reset\n", di->name);
+			return DEVINIT_FAIL;
+		}
+		if (line[0] == '#') { /* device ID, version, etc */
+			logmsg("%s: device info: %s\n", di->name, line);
+			return DEVINIT_MORE;
+		}
+		if (strncmp(line, ADXP_HEARTBEAT, strlen(ADXP_HEARTBEAT)) != 0) {
+			logmsg("%s: unrecognized line after reset: '%s'\n", di->name, line);
+			return DEVINIT_MORE;
+		}
+		if (write(di->fd, ADXP_MODERAW, strlen(ADXP_MODERAW)) < strlen(ADXP_MODERAW)) {
+			logmsg("%s: failed to write entire RAW mode string\n", di->name);
+			return DEVINIT_FAIL;
+		}
+		/* there will still be some ADXP messages in the queue, but aurora_parse
+		 * should suck them up.
+		 */
+		return DEVINIT_DONE;
 	}
-
-	/* there will still be some ADXP messages in the queue, but aurora_read
-	 * should suck them up.
-	 */
-
-	return fd;
+	return DEVINIT_FAIL;
 }
 
+/* as it is; see aurora_initstep() for putting it in RAW mode */
 int
-aurora_open(const char *devname, int init)
+aurora_open(const char *devname)
 {
 	int fd;
 
-	if (init)
-		return aurora_init(devname);
-
 	if ((fd = open(devname, O_RDONLY | O_NOCTTY | O_NDELAY)) == -1) {
 		logmsg("unable to open %s for reading: %s\n", devname, strerror(errno));
 		return -1;
@@ -134,158 +136,305 @@ aurora_open(const char *devname, int init)
 	return fd;
 }
 
-/* assumes dest is 28+1 bytes */
-static int
-sprintmodes(char *dest, const unsigned char *src)
+static void
+copymodes(struct frame *frame, const unsigned char *src)
 {
-	int i, j, len;
-	unsigned char df;
-
 	/* apparently the aurora pads standard 1090 with random bytes, so only
 	 * copy all of them if it's obviously 1090ES
 	 */
-	df = (src[0] >> 3) & 0x1f;
-	len = (df >= 16) ? 14 : 7;
-
-	for (i = 0, j = 0; i < len; i++)
-		j += sprintf(dest + j, "%02X", src[i]);
-	return 0;
+	frame->df = MODES_DF(src[0]);
+	frame->len = MODES_DFLEN(frame->df);
+	memcpy(frame->data, src, frame->len);
+	return;
 }
 
 #define DLE 0x10
 #define STX 0x02
 #define ETX 0x03
 
+/*
+ * A standard Mode-S frame, unstuffed, between DLE STX and DLE ETX:
+ *
+ *	0	reserved, 0
+ *	1	frame type (standard)
+ *	2	frame subtype (Mode-S)
+ *	3	time status; values don't make sense
+ *	4-5	unknown
+ *	6-13	time code, 64 bits big endian (ns?)
+ *	14-20	unknown
+ *	21-34	Mode-S data, short frames padded
+ *	35-36	unknown
+ */
 #define AURORAW_FRAMETYPE_STANDARD 0x02
 #define AURORAW_FRAMESUBTYPE_MODES 0x00
+#define AURORAW_MODESLEN 37
+#define AURORAW_TIMEOFF 6
+#define AURORAW_MODESOFF 21
+
+/* returns 1 if it was Mode-S, 0 if not */
 static int
 parseframe(const unsigned char *buf, int buflen, struct frame *frame)
 {
-	unsigned char subtype;
-	unsigned char timestatus;
-
 	int i;
 
-	i = 0;
-	if (buf[i] != 0x00)
-		logmsg("reserved byte 0 is unexpected value 0x%02x\n", buf[i]);
-	i++;
-	if (buf[i] != AURORAW_FRAMETYPE_STANDARD) {
-		logmsg("unknown frame type 0x%02x\n", buf[i]);
+	if (buf[0] != 0x00)
+		logmsg("reserved byte 0 is unexpected value 0x%02x\n", buf[0]);
+	if (buf[1] != AURORAW_FRAMETYPE_STANDARD) {
+		logmsg("unknown frame type 0x%02x\n", buf[1]);
 		return 0;
 	}
-	i++;
-
-	subtype = buf[i++];
-	if (subtype != AURORAW_FRAMESUBTYPE_MODES) {
-		logmsg("unsupported frame subtype 0x%02x\n", subtype);
+	if (buf[2] != AURORAW_FRAMESUBTYPE_MODES) {
+		logmsg("unsupported frame subtype 0x%02x\n", buf[2]);
 		return 0;
 	}
-	if (buflen != 36) {
+	if (buflen != AURORAW_MODESLEN) {
 		logmsg("invalid length for ModeS frame (%d)\n", buflen);
 		return 0;
 	}
 
-	/* values don't make sense */
-	timestatus = buf[i++];
-
-	/* unknown */
-	i += 2;
-
-	/* time code (64bits, in ns?) XXX */
-	i += 8;
-
-	/* unknown */
-	i += 7;
+	/*
+	 * the time code goes in ticks, for capture files to keep; its rate
+	 * isn't known for sure, so the driver doesn't claim DEV_CAP_TICKS and
+	 * modesd doesn't restamp or send it on as Beast MLAT.
+	 */
+	for (frame->ticks = 0, i = 0; i < 8; i++)
+		frame->ticks = (frame->ticks << 8) | buf[AURORAW_TIMEOFF + i];
+	copymodes(frame, buf + AURORAW_MODESOFF);
+	return 1;
+}
 
-	/* Mode-S data (padded with zeros?) */
-	sprintmodes(frame->data, buf + i);
-	i += 14;
+#define OUTOFFRAME 0
+#define INDLE 1
+#define INFRAME 2
+#define INDLEINFRAME 3
 
-	/* unknown */
-	i += 2;
+void
+aurora_parser_init(struct aurora_parser *ap)
+{
+	memset(ap, 0, sizeof(struct aurora_parser));
+	ap->state = OUTOFFRAME;
+	return;
+}
 
-	return 1;
+static void
+skip(struct aurora_parser *ap, int n)
+{
+	ap->pending += n;
+	ap->skipped += n;
+	return;
 }
 
 /*
- * Aurora RAW mode frames are enclosed in STX/ETX escaped with DLE, frame
- * length variable.
+ * Frame len bytes of src, read at now, carrying on from where the last call
+ * left off.  Complete Mode-S frames go in f, up to nf of them; returns how
+ * many, with the bytes used (all of them, unless f filled up first) in
+ * *usedp.  Partial frames stay in ap for next time, and bytes that turn out
+ * not to be part of a good frame are counted in ap->skipped and on the next
+ * frame's f->skipped.
  */
 int
-aurora_read(int fd, struct frame *frame, int timeout)
+aurora_parse(struct aurora_parser *ap, const unsigned char *src, int len,
+    const struct timeval *now, struct frame *f, int nf, int *usedp)
 {
-	unsigned char buf[255];
-	int n;
-	int state;
-	int ret;
-
-	gettimeofday(&frame->rxstart, NULL);
-
-#define OUTOFFRAME 0
-#define INDLE 1
-#define INFRAME 2
-#define INDLEINFRAME 3
-#define ENDOFFRAME 4
-	for (state = OUTOFFRAME, n = 0; n < sizeof(buf); n++) {
-		if (readn(fd, buf + n, 1) < 1)
-			return -1;
-		if (state == OUTOFFRAME) {
-			if (buf[n] != DLE) {
-				frame->skipped += n;
-				gettimeofday(&frame->rxend, NULL);
-				return 0;
+	const unsigned char *p = src, *end = src + len, *q;
+	int got = 0, k;
+
+	while ((p < end) && (got < nf)) {
+		switch (ap->state) {
+		case OUTOFFRAME:
+			/* everything up to the next DLE in one go */
+			if (!(q = memchr(p, DLE, end - p)))
+				q = end;
+			skip(ap, q - p);
+			if ((p = q) < end) {
+				ap->state = INDLE;
+				p++;
 			}
-			state = INDLE;
+			break;
 
-		} else if (state == INDLE) {
-			if (buf[n] != STX) {
-				frame->skipped += n;
-				gettimeofday(&frame->rxend, NULL);
-				return 0;
+		case INDLE:
+			if (*p == STX) {
+				ap->state = INFRAME;
+				ap->n = 0;
+				ap->raw = 2;
+				ap->rxstart = *now;
+				p++;
+			} else {
+				/* drop the DLE; this byte may be the next one */
+				skip(ap, 1);
+				ap->state = OUTOFFRAME;
 			}
-			state = INFRAME;
+			break;
 
-		} else if (state == INFRAME) {
-			if (buf[n] == DLE) {
-				state = INDLEINFRAME;
-				continue;
-			}
-			/* normal case. */
-
-		} else if (state == INDLEINFRAME) {
-			/* only assuming that DLE is strictly stuffed, docs
-			 * aren't clear
-			 */
-			if (buf[n] == DLE) {
-				state = INFRAME;
-				n--; /* remove a DLE */
-
-			} else if (buf[n] == ETX) {
-				state = ENDOFFRAME;
+		case INFRAME:
+			/* the run up to the next DLE in one go */
+			if (!(q = memchr(p, DLE, end - p)))
+				q = end;
+			k = q - p;
+			if (ap->n + k > sizeof(ap->buf)) {
+				logmsg("frame exceeded expected length\n");
+				skip(ap, ap->raw);
+				ap->state = OUTOFFRAME;
 				break;
+			}
+			memcpy(ap->buf + ap->n, p, k);
+			ap->n += k;
+			ap->raw += k;
+			if ((p = q) < end) {
+				ap->state = INDLEINFRAME;
+				ap->raw++;
+				p++;
+			}
+			break;
+
+		case INDLEINFRAME:
+			if (*p == DLE) {
+				/* only assuming that DLE is strictly stuffed, docs aren't clear */
+				if (ap->n == sizeof(ap->buf)) {
+					logmsg("frame exceeded expected length\n");
+					skip(ap, ap->raw);
+					ap->state = OUTOFFRAME;
+					break;
+				}
+				ap->buf[ap->n++] = DLE;
+				ap->raw++;
+				ap->state = INFRAME;
+				p++;
+			} else if (*p == ETX) {
+				p++;
+				ap->state = OUTOFFRAME;
+				memset(&f[got], '\0', sizeof(struct frame));
+				if (!parseframe(ap->buf, ap->n, &f[got]))
+					continue; /* no error, but no Mode-S frame either */
+				f[got].rxstart = ap->rxstart;
+				f[got].rxend = *now;
+				f[got].skipped = ap->pending;
+				ap->pending = 0;
+				got++;
+			} else if (*p == STX) {
+				/* the last one never ended; lose it, not this one too */
+				skip(ap, ap->raw - 1);
+				ap->n = 0;
+				ap->raw = 2;
+				ap->rxstart = *now;
+				ap->state = INFRAME;
+				p++;
 			} else {
-				logmsg("unknown DLE-escaped sequenece 0x%02x\n", buf[n]);
-				frame->skipped += n;
-				gettimeofday(&frame->rxend, NULL);
-				return 0;
+				logmsg("unknown DLE-escaped sequence 0x%02x\n", *p);
+				skip(ap, ap->raw + 1);
+				ap->state = OUTOFFRAME;
+				p++;
 			}
+			break;
 		}
 	}
-	gettimeofday(&frame->rxend, NULL);
-	if (state != ENDOFFRAME) {
-		logmsg("frame exceeded expected length (%d)", n);
-		frame->skipped += n;
-		return 0;
+	*usedp = p - src;
+	return got;
+}
+
+/*
+ * The device: a read() at a time, parsed as it comes.
+ */
+
+struct aurora {
+	struct dev dev;
+	struct aurora_parser ap;
+	int dead; /* hit EOF or an error, say so next time */
+	int off, len; /* what's in buf still to parse */
+	struct timeval rxtime; /* when it was read */
+	unsigned char buf[RBUF_SIZE];
+};
+
+struct dev *
+aurora_fdopen(const struct devdrv *drv, int fd, const struct rbuf *rb)
+{
+	struct aurora *au;
+
+	if (!(au = (struct aurora *)malloc(sizeof(struct aurora))))
+		return NULL;
+	memset(au, 0, sizeof(struct aurora));
+	aurora_parser_init(&au->ap);
+	au->dev.fd = fd;
+	/* the first frames may have come in with the heartbeat */
+	if (rb && rbuf_len(rb)) {
+		memcpy(au->buf, rbuf_data(rb), rbuf_len(rb));
+		au->len = rbuf_len(rb);
+		gettimeofday(&au->rxtime, NULL);
 	}
+	return &au->dev;
+}
 
-	/* pass along without <DLE><STX><DLE><ETX> */
-	ret = parseframe(buf + 2, n - 4, frame);
-	if (ret < 0)
+/* parse what's left over, then at most one read()'s worth, like rbufdev_read() */
+int
+aurora_read(struct dev *dev, struct frame *f, int n)
+{
+	struct aurora *au = (struct aurora *)dev;
+	unsigned long skipped = au->ap.skipped;
+	int got = 0, filled = 0, used, r;
+
+	if (au->dead)
 		return -1;
-	else if (ret == 0)
-		return 0; /* no error, but no Mode-S frame either */
-	return 1;
+	for (;;) {
+		got += aurora_parse(&au->ap, au->buf + au->off, au->len - au->off, &au->rxtime,
+		    f + got, n - got, &used);
+		au->off += used;
+		if ((got == n) || filled)
+			break;
+		filled = 1;
+		r = read(dev->fd, au->buf, sizeof(au->buf));
+		MET_ADD(dev->st->reads, 1);
+		if (r > 0) {
+			MET_ADD(dev->st->bytes, r);
+			gettimeofday(&au->rxtime, NULL);
+			au->off = 0;
+			au->len = r;
+			continue;
+		}
+		if ((r == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+			break;
+		if (r == 0)
+			logmsg("%s: EOF\n", dev->name);
+		else
+			logmsg("%s: read error: %s\n", dev->name, strerror(errno));
+		au->dead = 1;
+		break;
+	}
+	if (au->ap.skipped != skipped)
+		MET_ADD(dev->st->skipped, au->ap.skipped - skipped);
+	MET_ADD(dev->st->frames, got);
+	return (got || !au->dead) ? got : -1;
 }
 
+void
+aurora_close(struct dev *dev)
+{
+	close(dev->fd);
+	free(dev);
+	return;
+}
 
+/* the other way: f as a DLE-stuffed RAW mode frame. returns the length */
+int
+aurora_encode(unsigned char *dst, const struct frame *f)
+{
+	unsigned char raw[AURORAW_MODESLEN];
+	unsigned char *p = dst;
+	int i;
+
+	memset(raw, '\0', sizeof(raw));
+	raw[1] = AURORAW_FRAMETYPE_STANDARD;
+	raw[2] = AURORAW_FRAMESUBTYPE_MODES;
+	for (i = 0; i < 8; i++)
+		raw[AURORAW_TIMEOFF + i] = f->ticks >> (56 - 8 * i);
+	memcpy(raw + AURORAW_MODESOFF, f->data, f->len);
+	*p++ = DLE;
+	*p++ = STX;
+	for (i = 0; i < sizeof(raw); i++) {
+		if (raw[i] == DLE)
+			*p++ = DLE;
+		*p++ = raw[i];
+	}
+	*p++ = DLE;
+	*p++ = ETX;
+	return p - dst;
+}
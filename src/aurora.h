@@ -1,10 +1,45 @@
+
 #ifndef __AURORA_H__
 #define __AURORA_H__
 
+/*
+ * Aurora SSRx in RAW mode: frames are DLE STX ... DLE ETX, with DLEs in
+ * between doubled.  aurora_parse() frames a stream incrementally, keeping
+ * where it got to in a struct aurora_parser between calls, so it can be
+ * handed whatever each read() returned, of any size, and gives back every
+ * frame that completes in it.  aurora_fdopen() and friends are the device
+ * driver around that (see device.h).
+ */
+
+#include <sys/time.h>
+
 #include "frame.h"
+#include "device.h"
 
-extern int aurora_open(const char *devname, int init);
-extern int aurora_read(int fd, struct frame *frame, int timeout);
+#define AURORA_RAW_MAX 252 /* longest frame, unstuffed, that we'll take */
 
-#endif
+/* what aurora_encode() can write: DLE STX, every byte stuffed, DLE ETX */
+#define AURORA_FRAME_MAX (2 + 2 * 37 + 2)
 
+struct aurora_parser {
+	int state;
+	int n; /* unstuffed bytes of this frame so far */
+	int raw; /* bytes of it as sent, DLE STX included, in case it's skipped */
+	int pending; /* bytes skipped since the last frame, to go on the next */
+	unsigned long skipped; /* bytes skipped, ever */
+	struct timeval rxstart; /* when this frame's DLE STX was read */
+	unsigned char buf[AURORA_RAW_MAX];
+};
+
+extern void aurora_parser_init(struct aurora_parser *ap);
+extern int aurora_parse(struct aurora_parser *ap, const unsigned char *src, int len,
+    const struct timeval *now, struct frame *f, int nf, int *usedp);
+extern int aurora_encode(unsigned char *dst, const struct frame *f);
+
+extern int aurora_open(const char *devname);
+extern int aurora_initstep(struct devinit *di, const char *line);
+extern struct dev *aurora_fdopen(const struct devdrv *drv, int fd, const struct rbuf *rb);
+extern int aurora_read(struct dev *dev, struct frame *f, int n);
+extern void aurora_close(struct dev *dev);
+
+#endif
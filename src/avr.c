@@ -0,0 +1,75 @@
+/*
+ * AVR format lines, as logged by modesd -v:
+ *
+ *	1311207102.752332 *8D8991A199154A2D080441D0EDA3;
+ *	*5DA7A90E53D3BD;
+ *	@00001BA972C05DA7717DBBB591;
+ */
+
+#include <string.h>
+#include <ctype.h>
+
+#include "util.h"
+#include "hex.h"
+#include "frame.h"
+#include "avr.h"
+
+#define AVR_TC_LEN 12
+
+/*
+ * Parse one line (len bytes, trailing \r/\n allowed) into f: rxstart if
+ * there's a timestamp, ticks for the @ format, and the message.  Returns the
+ * message length in bytes, or -1 if it isn't a usable line.
+ */
+int
+avr_parse(const char *line, int len, struct frame *f)
+{
+	const char *p = line, *end = line + len;
+	int hexlen;
+
+	while ((end > p) && ((end[-1] == '\n') || (end[-1] == '\r')))
+		end--;
+
+	if ((p < end) && isdigit((unsigned char)*p)) {
+		long sec = 0, usec = 0, scale = 1000000;
+
+		while ((p < end) && isdigit((unsigned char)*p))
+			sec = (sec * 10) + (*p++ - '0');
+		if ((p < end) && (*p == '.')) {
+			for (p++; (p < end) && isdigit((unsigned char)*p); p++) {
+				if (scale > 1) {
+					scale /= 10;
+					usec += (*p - '0') * scale;
+				}
+			}
+		}
+		if ((p >= end) || !isspace((unsigned char)*p))
+			return -1;
+		while ((p < end) && isspace((unsigned char)*p))
+			p++;
+		f->rxstart.tv_sec = sec;
+		f->rxstart.tv_usec = usec;
+		f->rxend = f->rxstart;
+	}
+
+	if ((end - p) < 2 || (end[-1] != ';'))
+		return -1;
+	if (*p == '*') {
+		p++;
+	} else if (*p == '@') {
+		p++;
+		if (((end - p) < AVR_TC_LEN) || (hex_value(p, AVR_TC_LEN, &f->ticks) == -1))
+			return -1;
+		p += AVR_TC_LEN;
+	} else
+		return -1;
+
+	hexlen = end - 1 - p;
+	if ((hexlen != 2*MODES_SHORT_LEN) && (hexlen != 2*MODES_LONG_LEN))
+		return -1;
+	f->len = hexlen / 2;
+	if (hex_decode(f->data, p, f->len) == -1)
+		return -1;
+	f->df = MODES_DF(f->data[0]);
+	return f->len;
+}
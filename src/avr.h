@@ -0,0 +1,9 @@
+
+#ifndef __MODES_AVR_H__
+#define __MODES_AVR_H__
+
+#include "frame.h"
+
+extern int avr_parse(const char *line, int len, struct frame *f);
+
+#endif /* ndef __MODES_AVR_H__ */
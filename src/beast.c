@@ -0,0 +1,43 @@
+/*
+ * Beast binary output format
+ */
+
+#include "frame.h"
+#include "beast.h"
+
+/* encode f into dst (BEAST_MAX bytes). returns the length */
+int
+beast_encode(unsigned char *dst, const struct frame *f)
+{
+	unsigned char raw[6 + 1 + MODES_LONG_LEN];
+	int i, n = 0;
+
+	raw[0] = f->mlat >> 40;
+	raw[1] = f->mlat >> 32;
+	raw[2] = f->mlat >> 24;
+	raw[3] = f->mlat >> 16;
+	raw[4] = f->mlat >> 8;
+	raw[5] = f->mlat;
+	raw[6] = 0; /* signal level; nothing we read reports one */
+	for (i = 0; i < f->len; i++)
+		raw[7 + i] = f->data[i];
+
+	dst[n++] = BEAST_ESC;
+	dst[n++] = (f->len == MODES_LONG_LEN) ? '3' : '2';
+	for (i = 0; i < 7 + f->len; i++) {
+		if ((dst[n++] = raw[i]) == BEAST_ESC)
+			dst[n++] = BEAST_ESC;
+	}
+	return n;
+}
+
+/* a device's tick count at hz, as a 48 bit 12MHz count */
+unsigned long long
+beast_ticks(unsigned long long ticks, unsigned long hz)
+{
+	if (hz == 12000000)
+		return ticks & 0xffffffffffffULL;
+	/* in two parts, so ticks * 12e6 can't overflow */
+	return ((ticks / hz) * 12000000ULL + (ticks % hz) * 12000000ULL / hz) &
+	    0xffffffffffffULL;
+}
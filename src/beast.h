@@ -0,0 +1,18 @@
+#ifndef __MODES_BEAST_H__
+#define __MODES_BEAST_H__
+
+/*
+ * Beast binary framing: 0x1a, a type ('2' short, '3' long), a 6 byte
+ * 12MHz timestamp, a signal level byte and the message, with any 0x1a
+ * after the first doubled.
+ */
+
+#include "frame.h"
+
+#define BEAST_ESC 0x1a
+#define BEAST_MAX (2 + 2 * (6 + 1 + MODES_LONG_LEN)) /* every byte escaped */
+
+extern int beast_encode(unsigned char *dst, const struct frame *f);
+extern unsigned long long beast_ticks(unsigned long long ticks, unsigned long hz);
+
+#endif /* ndef __MODES_BEAST_H__ */
@@ -0,0 +1,578 @@
+/*
+ * Binary capture files, see capture.h for the layout
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "util.h"
+#include "frame.h"
+#include "capture.h"
+
+#define CAP_VERSION 1
+#define CAP_HDRLEN 16
+#define CAP_BLKHDRLEN 32
+#define CAP_IDXLEN 24
+#define CAP_TRAILERLEN 24
+#define CAP_RECLEN 30
+
+#define CAP_BLOCKRECS 4096
+#define CAP_BLOCKUSECS 30000000ULL /* so the index is never coarser than this */
+
+/* where each field is in a record, and so which column of a block */
+#define CAP_DT 0
+#define CAP_SEQNUM 4
+#define CAP_TICKS 8
+#define CAP_LEN 14
+#define CAP_CRC 15
+#define CAP_DATA 16
+
+/* field at off, width bytes wide, of record i in a block of n */
+#define CAP_FIELD(base, n, off, width, i) ((base) + (off) * (n) + (width) * (i))
+
+static const char capmagic[8] = "MODESCAP";
+static const char blkmagic[4] = "MSBK";
+static const char idxmagic[8] = "MSCAPIDX";
+
+struct capindex {
+	unsigned long long first; /* usecs */
+	unsigned long long last;
+	unsigned long long offset;
+};
+
+struct capture {
+	int fd;
+	int writing;
+	int flags;
+
+	/* current block */
+	unsigned char *raw; /* columns, laid out for CAP_BLOCKRECS when writing */
+	unsigned char *packed; /* columns, laid out for nrecs */
+	int nrecs;
+	int rec; /* next one to hand out, when reading */
+	unsigned long long first, last;
+	unsigned long long prevt, prevseq, prevticks; /* for the differences */
+	unsigned char *zbuf; /* block header and stored data */
+	unsigned long zsize;
+
+	struct capindex *idx;
+	int nblocks;
+	int idxsize;
+	int block; /* next to load, when reading */
+	unsigned long long from; /* cap_seek() time, when reading */
+	unsigned long long off; /* where the next block goes, when writing */
+};
+
+static void
+put16(unsigned char *p, unsigned int v)
+{
+	p[0] = v; p[1] = v >> 8;
+	return;
+}
+
+static void
+put32(unsigned char *p, unsigned int v)
+{
+	put16(p, v); put16(p + 2, v >> 16);
+	return;
+}
+
+static void
+put64(unsigned char *p, unsigned long long v)
+{
+	put32(p, v); put32(p + 4, v >> 32);
+	return;
+}
+
+static unsigned int
+get16(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static unsigned int
+get32(const unsigned char *p)
+{
+	return get16(p) | (get16(p + 2) << 16);
+}
+
+static unsigned long long
+get64(const unsigned char *p)
+{
+	return get32(p) | ((unsigned long long)get32(p + 4) << 32);
+}
+
+static unsigned long long
+tvusecs(const struct timeval *tv)
+{
+	return tv->tv_sec * 1000000ULL + tv->tv_usec;
+}
+
+static int
+writeall(int fd, const unsigned char *buf, int len)
+{
+	while (len > 0) {
+		int n = write(fd, buf, len);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int
+readat(int fd, unsigned char *buf, int len, unsigned long long off)
+{
+	int got = 0;
+
+	while (got < len) {
+		int n = pread(fd, buf + got, len - got, off + got);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (n == 0)
+			break;
+		got += n;
+	}
+	return got;
+}
+
+static int
+addindex(struct capture *cap, unsigned long long first, unsigned long long last,
+    unsigned long long offset)
+{
+	if (cap->nblocks == cap->idxsize) {
+		cap->idxsize = cap->idxsize ? (cap->idxsize * 2) : 256;
+		if (!(cap->idx = realloc(cap->idx, cap->idxsize * sizeof(struct capindex))))
+			return -1;
+	}
+	cap->idx[cap->nblocks].first = first;
+	cap->idx[cap->nblocks].last = last;
+	cap->idx[cap->nblocks].offset = offset;
+	cap->nblocks++;
+	return 0;
+}
+
+static struct capture *
+cap_alloc(void)
+{
+	struct capture *cap;
+
+	if (!(cap = (struct capture *)malloc(sizeof(struct capture))))
+		return NULL;
+	memset(cap, 0, sizeof(struct capture));
+	cap->fd = -1;
+	cap->zsize = CAP_BLKHDRLEN + CAP_BLOCKRECS * CAP_RECLEN;
+#ifdef HAVE_ZLIB
+	cap->zsize = CAP_BLKHDRLEN + compressBound(CAP_BLOCKRECS * CAP_RECLEN);
+#endif
+	if (!(cap->raw = malloc(CAP_BLOCKRECS * CAP_RECLEN)) ||
+	    !(cap->packed = malloc(CAP_BLOCKRECS * CAP_RECLEN)) ||
+	    !(cap->zbuf = malloc(cap->zsize))) {
+		free(cap->raw);
+		free(cap->packed);
+		free(cap);
+		return NULL;
+	}
+	return cap;
+}
+
+static void
+cap_free(struct capture *cap)
+{
+	if (cap->fd != -1)
+		close(cap->fd);
+	free(cap->raw);
+	free(cap->packed);
+	free(cap->zbuf);
+	free(cap->idx);
+	free(cap);
+	return;
+}
+
+/*
+ * Writing
+ */
+
+struct capture *
+cap_create(const char *fn, int flags)
+{
+	struct capture *cap;
+	unsigned char hdr[CAP_HDRLEN];
+
+#ifndef HAVE_ZLIB
+	if (flags & CAP_COMPRESS) {
+		logmsg("%s: compressed captures need zlib (build with ZLIB=1)\n", fn);
+		return NULL;
+	}
+#endif
+	if (!(cap = cap_alloc()))
+		return NULL;
+	cap->writing = 1;
+	cap->flags = flags;
+	if ((cap->fd = open(fn, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
+		logmsg("unable to create %s: %s\n", fn, strerror(errno));
+		cap_free(cap);
+		return NULL;
+	}
+
+	memset(hdr, 0, sizeof(hdr));
+	memcpy(hdr, capmagic, sizeof(capmagic));
+	put16(hdr + 8, CAP_VERSION);
+	put16(hdr + 10, CAP_RECLEN);
+	put16(hdr + 12, flags);
+	if (writeall(cap->fd, hdr, sizeof(hdr)) == -1) {
+		logmsg("%s: write: %s\n", fn, strerror(errno));
+		cap_free(cap);
+		return NULL;
+	}
+	cap->off = sizeof(hdr);
+	return cap;
+}
+
+/* write out the current block, if there is one */
+int
+cap_flush(struct capture *cap)
+{
+	static const int fieldoffs[] = { CAP_DT, CAP_SEQNUM, CAP_TICKS, CAP_LEN, CAP_CRC, CAP_DATA };
+	static const int fieldlens[] = { 4, 4, 6, 1, 1, MODES_LONG_LEN };
+	unsigned long rawlen = cap->nrecs * CAP_RECLEN;
+	unsigned long stored = rawlen;
+	int i;
+
+	if (!cap->writing || !cap->nrecs)
+		return 0;
+
+	/* close up the columns */
+	for (i = 0; i < sizeof(fieldoffs) / sizeof(fieldoffs[0]); i++) {
+		memcpy(CAP_FIELD(cap->packed, cap->nrecs, fieldoffs[i], fieldlens[i], 0),
+		    CAP_FIELD(cap->raw, CAP_BLOCKRECS, fieldoffs[i], fieldlens[i], 0),
+		    cap->nrecs * fieldlens[i]);
+	}
+#ifdef HAVE_ZLIB
+	if (cap->flags & CAP_COMPRESS) {
+		uLongf zlen = cap->zsize - CAP_BLKHDRLEN;
+		if ((compress2(cap->zbuf + CAP_BLKHDRLEN, &zlen, cap->packed, rawlen,
+		    Z_BEST_SPEED) == Z_OK) && (zlen < rawlen))
+			stored = zlen;
+	}
+#endif
+	if (stored == rawlen)
+		memcpy(cap->zbuf + CAP_BLKHDRLEN, cap->packed, rawlen);
+
+	memcpy(cap->zbuf, blkmagic, sizeof(blkmagic));
+	put32(cap->zbuf + 4, cap->nrecs);
+	put32(cap->zbuf + 8, rawlen);
+	put32(cap->zbuf + 12, stored);
+	put64(cap->zbuf + 16, cap->first);
+	put64(cap->zbuf + 24, cap->last);
+
+	/* one write per block, so a killed writer leaves whole blocks behind */
+	if (writeall(cap->fd, cap->zbuf, CAP_BLKHDRLEN + stored) == -1) {
+		logmsg("capture write: %s\n", strerror(errno));
+		return -1;
+	}
+	if (addindex(cap, cap->first, cap->last, cap->off) == -1)
+		return -1;
+	cap->off += CAP_BLKHDRLEN + stored;
+	cap->nrecs = 0;
+	return 0;
+}
+
+int
+cap_write(struct capture *cap, const struct frame *f)
+{
+	unsigned long long t = tvusecs(&f->rxstart);
+	unsigned char *raw = cap->raw;
+	int len = f->len, i;
+
+	if (!cap->writing)
+		return -1;
+	/* keep the block's first its earliest, and every difference in 32 bits */
+	if (cap->nrecs && ((cap->nrecs == CAP_BLOCKRECS) || (t < cap->first) ||
+	    (t - cap->first >= CAP_BLOCKUSECS))) {
+		if (cap_flush(cap) == -1)
+			return -1;
+	}
+	if (!cap->nrecs) {
+		cap->first = cap->last = cap->prevt = t;
+		cap->prevseq = cap->prevticks = 0;
+	}
+	if (t > cap->last)
+		cap->last = t;
+	if (len > MODES_LONG_LEN)
+		len = MODES_LONG_LEN;
+
+	/* within CAP_BLOCKUSECS of first, so the difference fits */
+	i = cap->nrecs++;
+	put32(CAP_FIELD(raw, CAP_BLOCKRECS, CAP_DT, 4, i), t - cap->prevt);
+	put32(CAP_FIELD(raw, CAP_BLOCKRECS, CAP_SEQNUM, 4, i), f->seqnum - cap->prevseq);
+	put16(CAP_FIELD(raw, CAP_BLOCKRECS, CAP_TICKS, 6, i), f->ticks - cap->prevticks);
+	put32(CAP_FIELD(raw, CAP_BLOCKRECS, CAP_TICKS, 6, i) + 2, (f->ticks - cap->prevticks) >> 16);
+	*CAP_FIELD(raw, CAP_BLOCKRECS, CAP_LEN, 1, i) = len;
+	*CAP_FIELD(raw, CAP_BLOCKRECS, CAP_CRC, 1, i) = f->crc;
+	memcpy(CAP_FIELD(raw, CAP_BLOCKRECS, CAP_DATA, MODES_LONG_LEN, i), f->data, len);
+	memset(CAP_FIELD(raw, CAP_BLOCKRECS, CAP_DATA, MODES_LONG_LEN, i) + len, 0,
+	    MODES_LONG_LEN - len);
+	cap->prevt = t;
+	cap->prevseq = f->seqnum;
+	cap->prevticks = f->ticks;
+	return 0;
+}
+
+static int
+cap_finish(struct capture *cap)
+{
+	unsigned char buf[CAP_IDXLEN];
+	unsigned long long idxoff;
+	int i;
+
+	if (cap_flush(cap) == -1)
+		return -1;
+	idxoff = cap->off;
+	for (i = 0; i < cap->nblocks; i++) {
+		put64(buf, cap->idx[i].first);
+		put64(buf + 8, cap->idx[i].last);
+		put64(buf + 16, cap->idx[i].offset);
+		if (writeall(cap->fd, buf, CAP_IDXLEN) == -1)
+			return -1;
+	}
+	memset(buf, 0, sizeof(buf));
+	memcpy(buf, idxmagic, sizeof(idxmagic));
+	put64(buf + 8, idxoff);
+	put32(buf + 16, cap->nblocks);
+	return writeall(cap->fd, buf, CAP_TRAILERLEN);
+}
+
+/*
+ * Reading
+ */
+
+static int
+cap_readindex(struct capture *cap, unsigned long long size)
+{
+	unsigned char buf[CAP_TRAILERLEN];
+	unsigned long long idxoff, off;
+	unsigned int n, i;
+
+	if ((size < CAP_HDRLEN + CAP_TRAILERLEN) ||
+	    (readat(cap->fd, buf, CAP_TRAILERLEN, size - CAP_TRAILERLEN) != CAP_TRAILERLEN) ||
+	    memcmp(buf, idxmagic, sizeof(idxmagic)))
+		return -1;
+	idxoff = get64(buf + 8);
+	n = get32(buf + 16);
+	if (idxoff + (unsigned long long)n * CAP_IDXLEN + CAP_TRAILERLEN != size)
+		return -1;
+
+	for (i = 0, off = idxoff; i < n; i++, off += CAP_IDXLEN) {
+		if ((readat(cap->fd, buf, CAP_IDXLEN, off) != CAP_IDXLEN) ||
+		    (addindex(cap, get64(buf), get64(buf + 8), get64(buf + 16)) == -1))
+			return -1;
+	}
+	return 0;
+}
+
+/* no index (writer never closed it); walk the block headers instead */
+static int
+cap_scanblocks(struct capture *cap, unsigned long long size)
+{
+	unsigned char hdr[CAP_BLKHDRLEN];
+	unsigned long long off = CAP_HDRLEN;
+
+	cap->nblocks = 0;
+	while (readat(cap->fd, hdr, CAP_BLKHDRLEN, off) == CAP_BLKHDRLEN) {
+		unsigned long long next = off + CAP_BLKHDRLEN + get32(hdr + 12);
+
+		if (memcmp(hdr, blkmagic, sizeof(blkmagic)) || (next > size))
+			break; /* torn last block */
+		if (addindex(cap, get64(hdr + 16), get64(hdr + 24), off) == -1)
+			return -1;
+		off = next;
+	}
+	return 0;
+}
+
+struct capture *
+cap_open(const char *fn)
+{
+	struct capture *cap;
+	unsigned char hdr[CAP_HDRLEN];
+	struct stat st;
+
+	if (!(cap = cap_alloc()))
+		return NULL;
+	if ((cap->fd = open(fn, O_RDONLY)) == -1) {
+		logmsg("unable to open %s: %s\n", fn, strerror(errno));
+		cap_free(cap);
+		return NULL;
+	}
+	if ((readat(cap->fd, hdr, CAP_HDRLEN, 0) != CAP_HDRLEN) ||
+	    memcmp(hdr, capmagic, sizeof(capmagic)) ||
+	    (get16(hdr + 8) != CAP_VERSION) || (get16(hdr + 10) != CAP_RECLEN)) {
+		logmsg("%s: not a capture file this version understands\n", fn);
+		cap_free(cap);
+		return NULL;
+	}
+	cap->flags = get16(hdr + 12);
+	if ((fstat(cap->fd, &st) == -1) ||
+	    ((cap_readindex(cap, st.st_size) == -1) &&
+	     (cap_scanblocks(cap, st.st_size) == -1))) {
+		logmsg("%s: unable to read index\n", fn);
+		cap_free(cap);
+		return NULL;
+	}
+	return cap;
+}
+
+int
+cap_iscapture(const char *fn)
+{
+	char magic[sizeof(capmagic)];
+	int fd, ret;
+
+	if ((fd = open(fn, O_RDONLY)) == -1)
+		return 0;
+	ret = (read(fd, magic, sizeof(magic)) == sizeof(magic)) &&
+	    !memcmp(magic, capmagic, sizeof(capmagic));
+	close(fd);
+	return ret;
+}
+
+/* position before the first frame at or after tv */
+int
+cap_seek(struct capture *cap, const struct timeval *tv)
+{
+	unsigned long long t = tvusecs(tv);
+	int lo = 0, hi = cap->nblocks;
+
+	if (cap->writing)
+		return -1;
+	/* first block that ends at or after t */
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (cap->idx[mid].last < t)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	cap->block = lo;
+	cap->nrecs = cap->rec = 0;
+	cap->from = t;
+	return 0;
+}
+
+static int
+cap_loadblock(struct capture *cap, int block)
+{
+	unsigned char *hdr = cap->zbuf;
+	unsigned long rawlen, stored;
+
+	if (readat(cap->fd, hdr, CAP_BLKHDRLEN, cap->idx[block].offset) != CAP_BLKHDRLEN)
+		return -1;
+	cap->nrecs = get32(hdr + 4);
+	rawlen = get32(hdr + 8);
+	stored = get32(hdr + 12);
+	cap->first = get64(hdr + 16);
+	cap->last = get64(hdr + 24);
+	if (memcmp(hdr, blkmagic, sizeof(blkmagic)) || (cap->nrecs > CAP_BLOCKRECS) ||
+	    (rawlen != cap->nrecs * CAP_RECLEN) || (stored > cap->zsize - CAP_BLKHDRLEN)) {
+		logmsg("capture block %d is corrupt\n", block);
+		return -1;
+	}
+	if (readat(cap->fd, cap->zbuf + CAP_BLKHDRLEN, stored,
+	    cap->idx[block].offset + CAP_BLKHDRLEN) != stored)
+		return -1;
+
+	if (stored == rawlen)
+		memcpy(cap->packed, cap->zbuf + CAP_BLKHDRLEN, rawlen);
+	else {
+#ifdef HAVE_ZLIB
+		uLongf len = CAP_BLOCKRECS * CAP_RECLEN;
+		if ((uncompress(cap->packed, &len, cap->zbuf + CAP_BLKHDRLEN, stored) != Z_OK) ||
+		    (len != rawlen)) {
+			logmsg("capture block %d won't inflate\n", block);
+			return -1;
+		}
+#else
+		logmsg("compressed capture, but built without zlib\n");
+		return -1;
+#endif
+	}
+	cap->rec = 0;
+	cap->prevt = cap->first;
+	cap->prevseq = cap->prevticks = 0;
+	return 0;
+}
+
+/* returns 1 and fills in f, 0 at the end, -1 on error */
+int
+cap_read(struct capture *cap, struct frame *f)
+{
+	if (cap->writing)
+		return -1;
+	for (;;) {
+		const unsigned char *p = cap->packed;
+		unsigned long long t, tick;
+		int n = cap->nrecs, i, len;
+
+		if (cap->rec == cap->nrecs) {
+			if (cap->block == cap->nblocks)
+				return 0;
+			if (cap_loadblock(cap, cap->block++) == -1)
+				return -1;
+			continue;
+		}
+		/* the differences have to be followed even through what we skip */
+		i = cap->rec++;
+		t = cap->prevt += (int)get32(CAP_FIELD(p, n, CAP_DT, 4, i));
+		cap->prevseq = (cap->prevseq + get32(CAP_FIELD(p, n, CAP_SEQNUM, 4, i))) & 0xffffffff;
+		tick = get16(CAP_FIELD(p, n, CAP_TICKS, 6, i)) |
+		    ((unsigned long long)get32(CAP_FIELD(p, n, CAP_TICKS, 6, i) + 2) << 16);
+		cap->prevticks = (cap->prevticks + tick) & 0xffffffffffffULL;
+		if (t < cap->from)
+			continue;
+
+		memset(f, 0, sizeof(struct frame));
+		f->rxstart.tv_sec = t / 1000000;
+		f->rxstart.tv_usec = t % 1000000;
+		f->rxend = f->rxstart;
+		f->seqnum = cap->prevseq;
+		f->ticks = cap->prevticks;
+		len = *CAP_FIELD(p, n, CAP_LEN, 1, i);
+		f->len = (len > MODES_LONG_LEN) ? MODES_LONG_LEN : len;
+		f->crc = *CAP_FIELD(p, n, CAP_CRC, 1, i);
+		memcpy(f->data, CAP_FIELD(p, n, CAP_DATA, MODES_LONG_LEN, i), f->len);
+		f->df = MODES_DF(f->data[0]);
+		return 1;
+	}
+}
+
+int
+cap_close(struct capture *cap)
+{
+	int ret = 0;
+
+	if (!cap)
+		return 0;
+	if (cap->writing && (cap_finish(cap) == -1)) {
+		logmsg("capture close: %s\n", strerror(errno));
+		ret = -1;
+	}
+	cap_free(cap);
+	return ret;
+}
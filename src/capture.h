@@ -0,0 +1,49 @@
+
+#ifndef __MODES_CAPTURE_H__
+#define __MODES_CAPTURE_H__
+
+/*
+ * Binary capture files.  Frames are stored as fixed-size records, grouped
+ * into blocks that each say what span of time they cover; a block can be
+ * deflated on its own.  A closed file ends with an index of the blocks, so
+ * a reader can binary search its way to a time without reading the data.
+ * Files that weren't closed (modesd was killed) are still readable: the
+ * block headers get walked instead.
+ *
+ * Layout, all integers little-endian:
+ *
+ *	header	"MODESCAP" version:16 reclen:16 flags:16 0:16
+ *	block	"MSBK" nrecs:32 rawlen:32 storedlen:32 first:64 last:64
+ *		records (deflated if storedlen != rawlen)
+ *	...
+ *	index	(first:64 last:64 offset:64) per block
+ *	trailer	"MSCAPIDX" offset:64 nblocks:32 0:32
+ *
+ * Times are microseconds since the epoch.  Records are fixed-size, but a
+ * block stores them a field at a time (all the dts, then all the seqnums,
+ * and so on), and dt, seqnum and ticks are differences from the record
+ * before.  The first record's dt is from the block's first time; its seqnum
+ * and ticks are whole.  Deflate does far better with it that way.
+ *
+ *	dt:32 (signed usecs) seqnum:32 ticks:48 len:8 crc:8
+ *	data:112 (unused bytes zero)
+ */
+
+#include "frame.h"
+
+#define CAP_COMPRESS 0x0001 /* deflate blocks; needs HAVE_ZLIB */
+
+struct capture;
+
+extern struct capture *cap_create(const char *fn, int flags);
+extern int cap_write(struct capture *cap, const struct frame *f);
+extern int cap_flush(struct capture *cap);
+
+extern struct capture *cap_open(const char *fn);
+extern int cap_seek(struct capture *cap, const struct timeval *tv);
+extern int cap_read(struct capture *cap, struct frame *f);
+extern int cap_iscapture(const char *fn);
+
+extern int cap_close(struct capture *cap);
+
+#endif /* ndef __MODES_CAPTURE_H__ */
@@ -0,0 +1,141 @@
+/*
+ * CPR position encoding and decoding (DO-260B 2.2.3.2.7 and appendix A)
+ */
+
+#include <math.h>
+
+#include "cpr.h"
+
+#define CPR_NZ 15
+
+/* number of longitude zones at lat */
+int
+cpr_nl(double lat)
+{
+	double a;
+
+	if (lat < 0)
+		lat = -lat;
+	if (lat == 0)
+		return 59;
+	if (lat == 87)
+		return 2;
+	if (lat > 87)
+		return 1;
+	a = 1 - (1 - cos(M_PI / (2 * CPR_NZ))) / pow(cos(M_PI / 180 * lat), 2);
+	return (int)floor(2 * M_PI / acos(a));
+}
+
+/* always-positive modulo */
+static double
+cpr_mod(double a, double b)
+{
+	double r = fmod(a, b);
+	return (r < 0) ? (r + b) : r;
+}
+
+/*
+ * both flavors of global decode; span is 360 airborne and 90 on the
+ * surface. gives the position in the first (or only) zone.
+ */
+static int
+cpr_globalzone(double span, unsigned int evenlat, unsigned int evenlon,
+    unsigned int oddlat, unsigned int oddlon, int odd, double *lat, double *lon)
+{
+	double dlat0 = span / 60, dlat1 = span / 59;
+	double j, rlat0, rlat1, rlat, m, dlon;
+	int nl, ni;
+
+	j = floor((59.0 * evenlat - 60.0 * oddlat) / CPR_MAX + 0.5);
+	rlat0 = dlat0 * (cpr_mod(j, 60) + evenlat / CPR_MAX);
+	rlat1 = dlat1 * (cpr_mod(j, 59) + oddlat / CPR_MAX);
+	if (span == 360) {
+		if (rlat0 >= 270)
+			rlat0 -= 360;
+		if (rlat1 >= 270)
+			rlat1 -= 360;
+		if ((rlat0 < -90) || (rlat0 > 90) || (rlat1 < -90) || (rlat1 > 90))
+			return -1;
+	}
+	/* the pair straddles a zone boundary; wait for another */
+	if ((nl = cpr_nl(rlat0)) != cpr_nl(rlat1))
+		return -1;
+
+	rlat = odd ? rlat1 : rlat0;
+	ni = nl - odd;
+	if (ni < 1)
+		ni = 1;
+	dlon = span / ni;
+	m = floor((evenlon * (nl - 1.0) - oddlon * (double)nl) / CPR_MAX + 0.5);
+	*lon = dlon * (cpr_mod(m, ni) + (odd ? oddlon : evenlon) / CPR_MAX);
+	*lat = rlat;
+	return 0;
+}
+
+int
+cpr_global(unsigned int evenlat, unsigned int evenlon,
+    unsigned int oddlat, unsigned int oddlon, int odd, double *lat, double *lon)
+{
+	if (cpr_globalzone(360, evenlat, evenlon, oddlat, oddlon, odd, lat, lon) == -1)
+		return -1;
+	*lon -= floor((*lon + 180) / 360) * 360;
+	return 0;
+}
+
+int
+cpr_globalsurface(unsigned int evenlat, unsigned int evenlon,
+    unsigned int oddlat, unsigned int oddlon, int odd, double reflat, double reflon,
+    double *lat, double *lon)
+{
+	if (cpr_globalzone(90, evenlat, evenlon, oddlat, oddlon, odd, lat, lon) == -1)
+		return -1;
+
+	/* northern or southern solution, whichever the reference is nearer */
+	if (reflat < *lat - 45)
+		*lat -= 90;
+	/* and the longitude is one of four, 90 degrees apart */
+	*lon += floor((reflon - *lon + 45) / 90) * 90;
+	*lon -= floor((*lon + 180) / 360) * 360;
+	return 0;
+}
+
+int
+cpr_local(unsigned int cprlat, unsigned int cprlon, int odd, int surface,
+    double reflat, double reflon, double *lat, double *lon)
+{
+	double span = surface ? 90 : 360;
+	double dlat = span / (60 - odd), dlon, j, m, rlat;
+	int ni;
+
+	j = floor(reflat / dlat) +
+	    floor(0.5 + cpr_mod(reflat, dlat) / dlat - cprlat / CPR_MAX);
+	rlat = dlat * (j + cprlat / CPR_MAX);
+	if ((rlat < -90) || (rlat > 90))
+		return -1;
+
+	ni = cpr_nl(rlat) - odd;
+	dlon = span / ((ni < 1) ? 1 : ni);
+	m = floor(reflon / dlon) +
+	    floor(0.5 + cpr_mod(reflon, dlon) / dlon - cprlon / CPR_MAX);
+	*lat = rlat;
+	*lon = dlon * (m + cprlon / CPR_MAX);
+	*lon -= floor((*lon + 180) / 360) * 360;
+	return 0;
+}
+
+/* the other way, for generating traffic: airborne, 17 bit */
+void
+cpr_encode(double lat, double lon, int odd, unsigned int *cprlat, unsigned int *cprlon)
+{
+	double dlat = 360.0 / (60 - odd), dlon, yz, xz, rlat;
+	int ni;
+
+	yz = floor(CPR_MAX * cpr_mod(lat, dlat) / dlat + 0.5);
+	rlat = dlat * (yz / CPR_MAX + floor(lat / dlat));
+	ni = cpr_nl(rlat) - odd;
+	dlon = 360.0 / ((ni < 1) ? 1 : ni);
+	xz = floor(CPR_MAX * cpr_mod(lon, dlon) / dlon + 0.5);
+	*cprlat = (unsigned int)yz & 0x1ffff;
+	*cprlon = (unsigned int)xz & 0x1ffff;
+	return;
+}
@@ -0,0 +1,31 @@
+
+#ifndef __MODES_CPR_H__
+#define __MODES_CPR_H__
+
+/*
+ * Compact Position Reporting, as used by extended squitter positions.
+ * Raw values are the 17 bit lat/lon fields; odd is the F bit.  Positions
+ * are degrees, north and east positive, longitude in [-180, 180).
+ */
+
+#define CPR_MAX 131072.0 /* 2^17 */
+
+extern int cpr_nl(double lat);
+
+/* from an even/odd pair; odd says which of them is the newer, and so whose position this is */
+extern int cpr_global(unsigned int evenlat, unsigned int evenlon,
+    unsigned int oddlat, unsigned int oddlon, int odd, double *lat, double *lon);
+
+/* surface pairs only pin down a quadrant; ref* picks which */
+extern int cpr_globalsurface(unsigned int evenlat, unsigned int evenlon,
+    unsigned int oddlat, unsigned int oddlon, int odd, double reflat, double reflon,
+    double *lat, double *lon);
+
+/* from one message and a reference within 180NM (45NM on the surface) */
+extern int cpr_local(unsigned int cprlat, unsigned int cprlon, int odd, int surface,
+    double reflat, double reflon, double *lat, double *lon);
+
+/* airborne only */
+extern void cpr_encode(double lat, double lon, int odd, unsigned int *cprlat, unsigned int *cprlon);
+
+#endif /* ndef __MODES_CPR_H__ */
@@ -0,0 +1,145 @@
+/*
+ * Mode-S parity (CRC-24, generator 0xFFF409) and error correction
+ */
+
+#include <string.h>
+
+#include "crc.h"
+#include "frame.h"
+
+#define MODES_POLY 0xfff409
+
+static unsigned int crc_table[256];
+
+/*
+ * syndrome -> bit(s) to flip. syndromes are linear, so the table is just
+ * the syndrome of every one and two bit error pattern. the DF field is
+ * left out so a "fix" can never turn one kind of message into another.
+ */
+struct fixent {
+	unsigned int syndrome; /* 0 means empty */
+	signed char bit[2]; /* bit[1] is -1 for single bit errors */
+};
+#define FIX56_SIZE 4096 /* > 2 * (51 + 51*50/2) */
+#define FIX112_SIZE 16384 /* > 2 * (107 + 107*106/2) */
+static struct fixent fix56[FIX56_SIZE];
+static struct fixent fix112[FIX112_SIZE];
+#define FIX_FIRSTBIT 5 /* don't touch the DF */
+
+void
+crc_init(void)
+{
+	unsigned int i, j, c;
+
+	for (i = 0; i < 256; i++) {
+		c = i << 16;
+		for (j = 0; j < 8; j++)
+			c = (c & 0x800000) ? ((c << 1) ^ MODES_POLY) : (c << 1);
+		crc_table[i] = c & 0xffffff;
+	}
+
+	for (i = 0; i < 2; i++) {
+		struct fixent *tab = i ? fix112 : fix56;
+		int size = i ? FIX112_SIZE : FIX56_SIZE;
+		int len = i ? MODES_LONG_LEN : MODES_SHORT_LEN;
+		unsigned int bitsyn[MODES_LONG_LEN * 8];
+		unsigned char msg[MODES_LONG_LEN];
+		int a, b;
+
+		memset(tab, 0, size * sizeof(struct fixent));
+		for (a = 0; a < len * 8; a++) {
+			memset(msg, 0, sizeof(msg));
+			msg[a / 8] = 0x80 >> (a % 8);
+			bitsyn[a] = modes_syndrome(msg, len);
+		}
+		for (a = FIX_FIRSTBIT; a < len * 8; a++) {
+			for (b = a; b < len * 8; b++) {
+				unsigned int syn = (a == b) ? bitsyn[a] : (bitsyn[a] ^ bitsyn[b]);
+				unsigned int h = (syn ^ (syn >> 11)) & (size - 1);
+
+				while (tab[h].syndrome && (tab[h].syndrome != syn))
+					h = (h + 1) & (size - 1);
+				if (tab[h].syndrome)
+					continue; /* ambiguous; keep the fewer-bit fix */
+				tab[h].syndrome = syn;
+				tab[h].bit[0] = a;
+				tab[h].bit[1] = (a == b) ? -1 : b;
+			}
+		}
+	}
+	return;
+}
+
+/* plain CRC over len bytes */
+unsigned int
+modes_crc(const unsigned char *msg, int len)
+{
+	unsigned int c = 0;
+	int i;
+
+	for (i = 0; i < len; i++)
+		c = ((c << 8) ^ crc_table[((c >> 16) ^ msg[i]) & 0xff]) & 0xffffff;
+	return c;
+}
+
+/*
+ * CRC of the data bits XOR the trailing 24 parity bits: 0 for a good
+ * DF17/18, the interrogator id for a good DF11, the address for the
+ * address/parity formats.
+ */
+unsigned int
+modes_syndrome(const unsigned char *msg, int len)
+{
+	return modes_crc(msg, len - 3) ^
+	    ((msg[len - 3] << 16) | (msg[len - 2] << 8) | msg[len - 1]);
+}
+
+/* flip the bits that explain syndrome. returns bits fixed or -1 */
+int
+modes_fixbits(unsigned char *msg, int len, unsigned int syndrome, int maxbits)
+{
+	struct fixent *tab = (len == MODES_LONG_LEN) ? fix112 : fix56;
+	int size = (len == MODES_LONG_LEN) ? FIX112_SIZE : FIX56_SIZE;
+	unsigned int h = (syndrome ^ (syndrome >> 11)) & (size - 1);
+	int n;
+
+	if ((syndrome == 0) || (maxbits <= 0))
+		return -1;
+	while (tab[h].syndrome && (tab[h].syndrome != syndrome))
+		h = (h + 1) & (size - 1);
+	if (!tab[h].syndrome)
+		return -1;
+	n = (tab[h].bit[1] == -1) ? 1 : 2;
+	if (n > maxbits)
+		return -1;
+	msg[tab[h].bit[0] / 8] ^= 0x80 >> (tab[h].bit[0] % 8);
+	if (n == 2)
+		msg[tab[h].bit[1] / 8] ^= 0x80 >> (tab[h].bit[1] % 8);
+	return n;
+}
+
+/*
+ * Check (and if maxfix, repair) the frames that carry plain parity: DF17/18
+ * with PI=0 and DF11 with II/SI in the low 7 bits.  Two bit fixes are only
+ * tried on 112 bit frames; on 56 bits they'd be too often wrong.  Sets and
+ * returns f->crc.
+ */
+int
+modes_checkframe(struct frame *f, int maxfix)
+{
+	unsigned int syn;
+
+	if ((f->df != 11) && (f->df != 17) && (f->df != 18))
+		return (f->crc = CRC_UNCHECKED);
+	if (f->len != MODES_DFLEN(f->df))
+		return (f->crc = CRC_BAD);
+
+	syn = modes_syndrome(f->data, f->len);
+	if ((f->df == 11) ? ((syn & ~0x7f) == 0) : (syn == 0))
+		return (f->crc = CRC_OK);
+	if (f->df == 11)
+		maxfix = (maxfix > 1) ? 1 : maxfix; /* assumes IID 0 */
+	if (modes_fixbits(f->data, f->len, syn, maxfix) > 0)
+		return (f->crc = CRC_FIXED);
+	return (f->crc = CRC_BAD);
+}
@@ -0,0 +1,19 @@
+
+#ifndef __MODES_CRC_H__
+#define __MODES_CRC_H__
+
+#include "frame.h"
+
+/* what modes_checkframe() did with a frame */
+#define CRC_UNCHECKED 0 /* address/parity overlay, can't tell on its own */
+#define CRC_OK 1
+#define CRC_FIXED 2 /* had 1 or 2 bit errors, corrected in place */
+#define CRC_BAD 3
+
+extern void crc_init(void);
+extern unsigned int modes_crc(const unsigned char *msg, int len);
+extern unsigned int modes_syndrome(const unsigned char *msg, int len);
+extern int modes_fixbits(unsigned char *msg, int len, unsigned int syndrome, int maxbits);
+extern int modes_checkframe(struct frame *f, int maxfix);
+
+#endif /* ndef __MODES_CRC_H__ */
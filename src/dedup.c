@@ -0,0 +1,151 @@
+/*
+ * Multi-receiver duplicate suppression
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "frame.h"
+#include "dedup.h"
+
+struct dd_ent {
+	unsigned long long pos; /* which add this was, to spot overwritten slots */
+	unsigned long long prev; /* pos of the next older entry on the chain */
+	unsigned long long t; /* usecs */
+	unsigned int mask; /* receivers that heard it */
+	struct frame f;
+};
+
+struct dedup {
+	struct dd_ent *ents;
+	unsigned long long *heads; /* newest pos on each chain */
+	unsigned int mask; /* ring size - 1 */
+	unsigned int hmask; /* chains - 1 */
+	unsigned long long window; /* usecs */
+	unsigned long long hold; /* usecs, 0 to not hold */
+
+	unsigned long long head; /* next pos; starts at 1 so 0 is never valid */
+	unsigned long long out; /* oldest still held */
+};
+
+struct dedup *
+dd_new(int size, int windowms, int holdms)
+{
+	struct dedup *dd;
+	int n;
+
+	for (n = 1; n < size; n <<= 1)
+		;
+	if (!(dd = (struct dedup *)malloc(sizeof(struct dedup))))
+		return NULL;
+	memset(dd, 0, sizeof(struct dedup));
+	dd->mask = n - 1;
+	dd->hmask = 2 * n - 1;
+	dd->window = windowms * 1000ULL;
+	dd->hold = holdms * 1000ULL;
+	dd->head = dd->out = 1;
+	dd->ents = calloc(n, sizeof(struct dd_ent));
+	dd->heads = calloc(2 * n, sizeof(unsigned long long));
+	if (!dd->ents || !dd->heads) {
+		dd_free(dd);
+		return NULL;
+	}
+	return dd;
+}
+
+void
+dd_free(struct dedup *dd)
+{
+	if (!dd) return;
+
+	free(dd->ents);
+	free(dd->heads);
+	free(dd);
+	return;
+}
+
+/* the last three bytes are parity, about as well mixed as anything */
+static inline unsigned int
+dd_hash(const struct frame *f)
+{
+	const unsigned char *p = f->data + f->len - 3;
+	unsigned int h = (p[0] << 16) | (p[1] << 8) | p[2];
+
+	return (h ^ (f->data[0] << 24) ^ (f->data[1] << 8)) * 2654435761U;
+}
+
+static inline struct dd_ent *
+dd_ent(struct dedup *dd, unsigned long long pos)
+{
+	struct dd_ent *e;
+
+	if ((pos == 0) || (dd->head - pos > dd->mask + 1))
+		return NULL;
+	e = &dd->ents[pos & dd->mask];
+	return (e->pos == pos) ? e : NULL;
+}
+
+/*
+ * returns 1 if f is a first copy, 0 if it's a duplicate (and has been
+ * folded into the first).  when holding, call dd_next() first: a full
+ * ring of held frames has to be let out before another goes in.
+ */
+int
+dd_add(struct dedup *dd, const struct frame *f, int rx, unsigned long long now)
+{
+	unsigned int bit = 1U << ((rx < DD_MAXRX) ? rx : (DD_MAXRX - 1));
+	unsigned int h = (dd_hash(f) >> 8) & dd->hmask;
+	struct dd_ent *e;
+	unsigned long long pos;
+
+	for (pos = dd->heads[h]; (e = dd_ent(dd, pos)); pos = e->prev) {
+		if (now - e->t > dd->window)
+			break; /* all older from here on */
+		if ((e->f.len != f->len) || memcmp(e->f.data, f->data, f->len))
+			continue;
+		if (e->mask & bit)
+			continue; /* this receiver's already had that one; an older copy? */
+		e->mask |= bit;
+		return 0;
+	}
+
+	e = &dd->ents[dd->head & dd->mask];
+	e->pos = dd->head;
+	e->prev = dd->heads[h];
+	e->t = now;
+	e->mask = bit;
+	e->f = *f;
+	dd->heads[h] = dd->head++;
+	if (!dd->hold)
+		dd->out = dd->head;
+	return 1;
+}
+
+/* the next held frame that's due, and who heard it. returns 0 if none are. */
+int
+dd_next(struct dedup *dd, unsigned long long now, struct frame *f, unsigned int *mask)
+{
+	struct dd_ent *e;
+
+	if (dd->out == dd->head)
+		return 0;
+	e = &dd->ents[dd->out & dd->mask];
+	if ((now - e->t < dd->hold) && (dd->head - dd->out <= dd->mask))
+		return 0;
+	*f = e->f;
+	*mask = e->mask;
+	dd->out++;
+	return 1;
+}
+
+/* msecs until dd_next() has something, -1 if it's holding nothing */
+int
+dd_wait(struct dedup *dd, unsigned long long now)
+{
+	unsigned long long due;
+
+	if (dd->out == dd->head)
+		return -1;
+	due = dd->ents[dd->out & dd->mask].t + dd->hold;
+	return (due > now) ? (int)((due - now + 999) / 1000) : 0;
+}
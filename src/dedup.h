@@ -0,0 +1,33 @@
+
+#ifndef __MODES_DEDUP_H__
+#define __MODES_DEDUP_H__
+
+/*
+ * Duplicate suppression across receivers.  Every first copy of a payload
+ * goes into a fixed ring, in arrival order, threaded onto hash chains;
+ * a later copy from a different receiver within the window only gets its
+ * receiver's bit set in the first copy's mask.  The same payload twice
+ * from one receiver is two transmissions, so unless some other receiver's
+ * copy of it is still unclaimed, it's a first copy again.
+ *
+ * Nothing's ever removed: entries age out of the window, or are
+ * overwritten when the ring comes round.  No allocation after dd_new().
+ *
+ * With a hold time, first copies are kept back that long so they can go
+ * out with everyone who heard them; dd_next() hands them back when due.
+ */
+
+#include "frame.h"
+
+#define DD_MAXRX 32 /* bits in a mask; receivers past this share the last */
+
+struct dedup;
+
+extern struct dedup *dd_new(int size, int windowms, int holdms);
+extern void dd_free(struct dedup *dd);
+extern int dd_add(struct dedup *dd, const struct frame *f, int rx, unsigned long long now);
+extern int dd_next(struct dedup *dd, unsigned long long now, struct frame *f,
+    unsigned int *mask);
+extern int dd_wait(struct dedup *dd, unsigned long long now);
+
+#endif /* ndef __MODES_DEDUP_H__ */
@@ -0,0 +1,157 @@
+/*
+ * Device clock to host clock correction
+ */
+
+#include <string.h>
+#include <sys/time.h>
+
+#include "frame.h"
+#include "devclock.h"
+
+#define DC_TICKMASK 0xffffffffffffULL /* devices count in 48 bits */
+#define DC_RESETSECS 1.0 /* this far off the fit, something's been reset or stepped */
+
+void
+dc_init(struct devclock *dc, unsigned long hz)
+{
+	memset(dc, 0, sizeof(struct devclock));
+	dc->hz = hz;
+	return;
+}
+
+static void
+dc_reset(struct devclock *dc, const struct frame *f)
+{
+	dc->valid = 1;
+	dc->base = dc->ext = dc->last = f->ticks;
+	dc->hbase = f->rxstart;
+	dc->nmin = dc->curmin = 0;
+	dc->cursec = -1;
+	dc->a = dc->b = 0;
+	return;
+}
+
+/* least squares through the minima */
+static void
+dc_fit(struct devclock *dc)
+{
+	double sx = 0, sy = 0, sxx = 0, sxy = 0, d, under = 0;
+	int i, n = dc->nmin;
+
+	if (n < DC_MINFIT) {
+		/* not enough for a slope yet */
+		dc->b = 0;
+		dc->a = dc->miny[0];
+		for (i = 1; i < n; i++) {
+			if (dc->miny[i] < dc->a)
+				dc->a = dc->miny[i];
+		}
+		return;
+	}
+	for (i = 0; i < n; i++) {
+		sx += dc->minx[i];
+		sy += dc->miny[i];
+		sxx += dc->minx[i] * dc->minx[i];
+		sxy += dc->minx[i] * dc->miny[i];
+	}
+	if ((d = n * sxx - sx * sx) == 0)
+		return;
+	dc->b = (n * sxy - sx * sy) / d;
+	dc->a = (sy - dc->b * sx) / n;
+	/* the line should run under every minimum, not through them */
+	for (i = 0; i < n; i++) {
+		double r = dc->miny[i] - (dc->a + dc->b * dc->minx[i]);
+		if (r < under)
+			under = r;
+	}
+	dc->a += under;
+	return;
+}
+
+/*
+ * replace f->rxstart with the time its ticks say it arrived. returns 1 if
+ * it did, 0 if the frame has no ticks.
+ */
+int
+dc_stamp(struct devclock *dc, struct frame *f)
+{
+	unsigned long long step;
+	double x, y, fit, secs;
+	long sec;
+
+	if (!dc->hz || !f->ticks)
+		return 0;
+	if (!dc->valid)
+		dc_reset(dc, f);
+
+	/* unwrap; more than a second back is the device starting over */
+	step = (f->ticks - dc->last) & DC_TICKMASK;
+	if (step > (DC_TICKMASK >> 1)) {
+		step = DC_TICKMASK + 1 - step;
+		if ((step > dc->hz) || (step > dc->ext - dc->base)) {
+			dc->resets++;
+			dc_reset(dc, f);
+		} else
+			dc->ext -= step;
+	} else
+		dc->ext += step;
+	dc->last = f->ticks;
+
+	x = (double)(dc->ext - dc->base) / dc->hz;
+	y = (f->rxstart.tv_sec - dc->hbase.tv_sec) +
+	    (f->rxstart.tv_usec - dc->hbase.tv_usec) / 1e6 - x;
+	if (dc->nmin && ((y - (dc->a + dc->b * x) > DC_RESETSECS) ||
+	    (y - (dc->a + dc->b * x) < -DC_RESETSECS))) {
+		dc->resets++;
+		dc_reset(dc, f);
+		x = y = 0;
+	}
+
+	/* keep the earliest arrival in each device second */
+	sec = (long)x;
+	if (sec != dc->cursec) {
+		dc->cursec = sec;
+		if (dc->nmin < DC_WINDOW)
+			dc->curmin = dc->nmin++;
+		else
+			dc->curmin = (dc->curmin + 1) % DC_WINDOW;
+		dc->minx[dc->curmin] = x;
+		dc->miny[dc->curmin] = y;
+		dc_fit(dc);
+	} else if (y < dc->miny[dc->curmin]) {
+		dc->minx[dc->curmin] = x;
+		dc->miny[dc->curmin] = y;
+		dc_fit(dc);
+	}
+
+	fit = dc->a + dc->b * x;
+	dc->frames++;
+	dc->latesum += y - fit;
+
+	secs = x + fit;
+	f->rxstart = dc->hbase;
+	f->rxstart.tv_sec += (long)secs;
+	f->rxstart.tv_usec += (long)((secs - (long)secs) * 1e6 + ((secs < 0) ? -0.5 : 0.5));
+	while (f->rxstart.tv_usec >= 1000000) {
+		f->rxstart.tv_sec++;
+		f->rxstart.tv_usec -= 1000000;
+	}
+	while (f->rxstart.tv_usec < 0) {
+		f->rxstart.tv_sec--;
+		f->rxstart.tv_usec += 1000000;
+	}
+	return 1;
+}
+
+/* drift in ppm (device slow is positive), mean lateness of raw host times in secs */
+void
+dc_getstats(struct devclock *dc, double *ppm, double *late, unsigned long *resets)
+{
+	*ppm = dc->b * 1e6;
+	*late = dc->frames ? (dc->latesum / dc->frames) : 0;
+	*resets = dc->resets;
+	dc->frames = 0;
+	dc->latesum = 0;
+	dc->resets = 0;
+	return;
+}
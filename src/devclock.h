@@ -0,0 +1,40 @@
+#ifndef __MODES_DEVCLOCK_H__
+#define __MODES_DEVCLOCK_H__
+
+/*
+ * Disciplining a device's tick counter to the host clock.  Host receive
+ * times are only ever late (by however long the frame sat in the device,
+ * USB and our buffers), so each second of device time keeps only its
+ * earliest arrival, and a least squares line through the last
+ * DC_WINDOW of those gives offset and drift.  Frames are then stamped
+ * from their ticks, with none of the queueing jitter.
+ */
+
+#include "frame.h"
+
+#define DC_WINDOW 64 /* seconds of minima in the fit */
+#define DC_MINFIT 4 /* before this many, it's nominal rate and the best offset so far */
+
+struct devclock {
+	unsigned long hz;
+	int valid; /* have a base */
+	unsigned long long base, last; /* ticks: unwrapped base, raw last */
+	unsigned long long ext; /* unwrapped ticks of last */
+	struct timeval hbase; /* host time at base */
+
+	/* y is host time minus nominal device time, seconds, by x, device seconds */
+	double minx[DC_WINDOW], miny[DC_WINDOW];
+	int nmin, curmin; /* samples, and which is the one being filled */
+	long cursec;
+	double a, b; /* the fit, y = a + b*x */
+
+	/* since dc_getstats() */
+	unsigned long frames, resets;
+	double latesum; /* how far after the fit frames arrived, summed */
+};
+
+extern void dc_init(struct devclock *dc, unsigned long hz);
+extern int dc_stamp(struct devclock *dc, struct frame *f);
+extern void dc_getstats(struct devclock *dc, double *ppm, double *late, unsigned long *resets);
+
+#endif /* ndef __MODES_DEVCLOCK_H__ */
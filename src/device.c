@@ -0,0 +1,410 @@
+/*
+ * Device driver table and the rbuf framing adapter; see device.h.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+
+#include "util.h"
+#include "metrics.h"
+#include "device.h"
+
+#include "microadsb.h"
+#include "aurora.h"
+#include "replay.h"
+
+static const struct devdrv drivers[] = {
+	{ "microadsb", DEV_CAP_TICKS | DEV_CAP_SEQNUM | DEV_CAP_INIT, MADSB_TICKHZ, MADSB_SEQBITS,
+	    NULL, rbufdev_read, rbufdev_close, ma_open, ma_initstep, rbufdev_fdopen, ma_read },
+	{ "aurora", DEV_CAP_INIT, 0, 0,
+	    NULL, aurora_read, aurora_close, aurora_open, aurora_initstep, aurora_fdopen, NULL },
+	{ "replay", DEV_CAP_REPLAY, 0, 0,
+	    replay_open, replay_read, replay_close, NULL, NULL, NULL, NULL },
+};
+#define NDRIVERS (sizeof(drivers) / sizeof(drivers[0]))
+
+const struct devdrv *
+dev_find(const char *name)
+{
+	int i;
+
+	for (i = 0; i < NDRIVERS; i++) {
+		if (strcmp(name, drivers[i].name) == 0)
+			return &drivers[i];
+	}
+	return NULL;
+}
+
+static struct dev *
+setup(struct dev *dev, const struct devdrv *drv, const char *devname, struct devstats *st)
+{
+	dev->drv = drv;
+	dev->name = devname;
+	dev->st = st;
+	if (fcntl(dev->fd, F_SETFL, O_NONBLOCK) == -1) {
+		logmsg("unable to set non-blocking flag on %s\n", devname);
+		drv->close(dev);
+		return NULL;
+	}
+	return dev;
+}
+
+/* a serial device's fd, in the right mode, as a device */
+static struct dev *
+wrapfd(const struct devdrv *drv, int fd, const struct rbuf *rb, const char *devname,
+    struct devstats *st)
+{
+	struct dev *dev;
+
+	if (!(dev = drv->fdopen(drv, fd, rb))) {
+		close(fd);
+		return NULL;
+	}
+	return setup(dev, drv, devname, st);
+}
+
+static const struct rbuf *initleft(struct devinit *di);
+
+/*
+ * devname and st have to stay around as long as the device does.  With
+ * init, this waits for the device to be brought up; see dev_initstart()
+ * for not waiting.
+ */
+struct dev *
+dev_open(const struct devdrv *drv, const char *devname, int init, struct devstats *st)
+{
+	struct devinit di;
+	struct dev *dev;
+	const struct rbuf *rb = NULL;
+	int fd;
+
+	if (!drv->openfd) {
+		if (!(dev = drv->open(drv, devname, init)))
+			return NULL;
+		return setup(dev, drv, devname, st);
+	}
+	if (init && drv->initstep) {
+		memset(&di, 0, sizeof(di));
+		di.name = devname;
+		di.step = drv->initstep;
+		fd = dev_initrun(&di);
+		rb = initleft(&di);
+	} else
+		fd = drv->openfd(devname);
+	if (fd == -1)
+		return NULL;
+	return wrapfd(drv, fd, rb, devname, st);
+}
+
+/* returns frames put in f, 0 if there's nothing more for now, -1 if the device is done */
+int
+dev_read(struct dev *dev, struct frame *f, int n)
+{
+	return dev->drv->read(dev, f, n);
+}
+
+void
+dev_close(struct dev *dev)
+{
+	if (dev)
+		dev->drv->close(dev);
+	return;
+}
+
+/*
+ * Bringing devices up
+ */
+
+/* point rb at the driver's fd, if it's changed */
+static void
+initsync(struct devinit *di)
+{
+	if (di->rbfd == di->fd)
+		return;
+	rbuf_init(&di->rb, di->fd);
+	di->rb.evdriven = 1;
+	di->rbfd = di->fd;
+	return;
+}
+
+/* read what there is and hand initstep() each whole line of it */
+static int
+initlines(struct devinit *di)
+{
+	char line[DEVINIT_LINE_MAX];
+	unsigned char *p, *nl;
+	int r, n;
+
+	initsync(di);
+	if (rbuf_len(&di->rb) == RBUF_SIZE)
+		rbuf_consume(&di->rb, RBUF_SIZE); /* a buffer full of no lines */
+	if ((r = rbuf_read(&di->rb)) == RBUF_AGAIN)
+		return DEVINIT_MORE;
+	if (r <= 0) {
+		if (r == 0)
+			logmsg("%s: EOF while bringing it up\n", di->name);
+		else
+			logmsg("%s: read error while bringing it up: %s\n", di->name, strerror(errno));
+		return DEVINIT_FAIL;
+	}
+	while ((nl = memchr((p = rbuf_data(&di->rb)), '\n', rbuf_len(&di->rb)))) {
+		for (n = 0; (p < nl) && (n < (sizeof(line) - 1)); p++) {
+			if (*p != '\r')
+				line[n++] = *p;
+		}
+		line[n] = '\0';
+		rbuf_consume(&di->rb, nl + 1 - rbuf_data(&di->rb));
+		if (n == 0)
+			continue;
+		/* stop at a new fd; what's left was from the old one */
+		if (((r = di->step(di, line)) != DEVINIT_MORE) || (di->fd != di->rbfd))
+			return r;
+	}
+	return DEVINIT_MORE;
+}
+
+/* once it's up: whatever was read past the last line the driver wanted */
+static const struct rbuf *
+initleft(struct devinit *di)
+{
+	return ((di->fd != -1) && (di->rbfd == di->fd)) ? &di->rb : NULL;
+}
+
+static int
+initfinish(struct devinit *di, int r)
+{
+	if (r == DEVINIT_DONE)
+		return di->fd;
+	if (di->fd != -1)
+		close(di->fd);
+	di->fd = -1;
+	return -1;
+}
+
+/*
+ * Bring a device up, waiting for it: di->name, di->step and di->mode set,
+ * the rest zero.  Returns the fd, or -1 if it failed.
+ */
+int
+dev_initrun(struct devinit *di)
+{
+	struct pollfd pfd;
+	int r, n;
+
+	di->fd = di->rbfd = -1;
+	di->state = di->tries = di->waitms = 0;
+	r = di->step(di, NULL);
+	while (r == DEVINIT_MORE) {
+		pfd.fd = di->fd; /* poll() ignores -1, and just waits */
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if ((n = poll(&pfd, 1, di->waitms)) == 0)
+			r = di->step(di, NULL);
+		else if (n > 0)
+			r = initlines(di);
+		else if (errno != EINTR) {
+			logmsg("%s: poll: %s\n", di->name, strerror(errno));
+			r = DEVINIT_FAIL;
+		}
+	}
+	return initfinish(di, r);
+}
+
+static void initread(void *arg, int fd, int events);
+
+static void
+initdone(struct devinit *di, int r)
+{
+	void (*done)(void *arg, struct dev *dev) = di->done;
+	void *arg = di->arg;
+	struct dev *dev = NULL;
+	int fd;
+
+	if (di->rbfd != -1)
+		ev_delfd(di->ev, di->rbfd);
+	ev_deltimer(di->timer);
+	if ((fd = initfinish(di, r)) != -1)
+		dev = wrapfd(di->drv, fd, initleft(di), di->name, di->st);
+	free(di);
+	done(arg, dev);
+	return;
+}
+
+/* after each step: follow the driver's fd, and wait as long as it said */
+static void
+initnext(struct devinit *di, int r)
+{
+	if (r != DEVINIT_MORE) {
+		initdone(di, r);
+		return;
+	}
+	if (di->rbfd != di->fd) {
+		if (di->rbfd != -1)
+			ev_delfd(di->ev, di->rbfd);
+		initsync(di);
+		if ((di->fd != -1) && (ev_addfd(di->ev, di->fd, EV_READ, initread, di) == -1)) {
+			di->rbfd = -1;
+			initdone(di, DEVINIT_FAIL);
+			return;
+		}
+	}
+	if (ev_settimer(di->timer, (di->waitms > 0) ? di->waitms : 1, 0) == -1)
+		initdone(di, DEVINIT_FAIL);
+	return;
+}
+
+static void
+initread(void *arg, int fd, int events)
+{
+	struct devinit *di = (struct devinit *)arg;
+
+	initnext(di, initlines(di));
+	return;
+}
+
+static void
+inittimer(void *arg)
+{
+	struct devinit *di = (struct devinit *)arg;
+
+	initnext(di, di->step(di, NULL));
+	return;
+}
+
+/*
+ * Bring a device up on ev, calling done with it once it is (or with NULL
+ * if it couldn't be), never from in here.  Returns NULL if it couldn't even
+ * start; the result is only good for dev_initcancel() until done's called.
+ */
+struct devinit *
+dev_initstart(const struct devdrv *drv, const char *devname, struct devstats *st,
+    struct evloop *ev, void (*done)(void *arg, struct dev *dev), void *arg)
+{
+	struct devinit *di;
+
+	if (!(di = (struct devinit *)malloc(sizeof(struct devinit))))
+		return NULL;
+	memset(di, 0, sizeof(struct devinit));
+	di->name = devname;
+	di->step = drv->initstep;
+	di->fd = di->rbfd = -1;
+	di->drv = drv;
+	di->st = st;
+	di->ev = ev;
+	di->done = done;
+	di->arg = arg;
+	if (!(di->timer = ev_addtimer(ev, inittimer, di)) ||
+	    (ev_settimer(di->timer, 1, 0) == -1)) {
+		ev_deltimer(di->timer);
+		free(di);
+		return NULL;
+	}
+	return di;
+}
+
+void
+dev_initcancel(struct devinit *di)
+{
+	if (!di)
+		return;
+	if (di->rbfd != -1)
+		ev_delfd(di->ev, di->rbfd);
+	ev_deltimer(di->timer);
+	initfinish(di, DEVINIT_FAIL);
+	free(di);
+	return;
+}
+
+/*
+ * Serial devices, framed out of an rbuf
+ */
+
+struct rbufdev {
+	struct dev dev;
+	int skipped; /* since the last frame, to go on the next one */
+	int dead; /* hit EOF or an error, say so next time */
+	struct rbuf rb;
+};
+
+struct dev *
+rbufdev_fdopen(const struct devdrv *drv, int fd, const struct rbuf *rb)
+{
+	struct rbufdev *rd;
+
+	if (!(rd = (struct rbufdev *)malloc(sizeof(struct rbufdev))))
+		return NULL;
+	memset(rd, 0, sizeof(struct rbufdev));
+	rbuf_init(&rd->rb, fd);
+	rd->rb.evdriven = 1;
+	/* carry on from where bringing it up left off, frames already read and all */
+	if (rb && rbuf_len(rb)) {
+		memcpy(rd->rb.buf, rbuf_data(rb), rbuf_len(rb));
+		rd->rb.end = rbuf_len(rb);
+	}
+	rd->dev.fd = fd;
+	return &rd->dev;
+}
+
+/*
+ * frame what's buffered, doing at most one read() when that runs out, so a
+ * device that's always got more can't keep us here.
+ */
+int
+rbufdev_read(struct dev *dev, struct frame *f, int n)
+{
+	struct rbufdev *rd = (struct rbufdev *)dev;
+	int got = 0, filled = 0, r;
+
+	if (rd->dead)
+		return -1;
+	while (got < n) {
+		memset(&f[got], '\0', sizeof(struct frame));
+		r = dev->drv->frame(&rd->rb, &f[got]);
+		if (f[got].skipped) {
+			MET_ADD(dev->st->skipped, f[got].skipped);
+			rd->skipped += f[got].skipped;
+		}
+		if (r == 1) {
+			f[got++].skipped = rd->skipped;
+			rd->skipped = 0;
+			continue;
+		} else if (r == 0)
+			continue;
+		else if (r != RBUF_AGAIN) {
+			logmsg("%s: device error\n", dev->name);
+			rd->dead = 1;
+			break;
+		}
+		if (filled)
+			break;
+		filled = 1;
+		r = rbuf_read(&rd->rb);
+		MET_ADD(dev->st->reads, 1);
+		if (r > 0)
+			MET_ADD(dev->st->bytes, r);
+		else if (r == RBUF_AGAIN)
+			break;
+		else {
+			if (r == 0)
+				logmsg("%s: EOF\n", dev->name);
+			else
+				logmsg("%s: read error: %s\n", dev->name, strerror(errno));
+			rd->dead = 1;
+			break;
+		}
+	}
+	MET_ADD(dev->st->frames, got);
+	return (got || !rd->dead) ? got : -1;
+}
+
+void
+rbufdev_close(struct dev *dev)
+{
+	close(dev->fd);
+	free(dev);
+	return;
+}
@@ -0,0 +1,119 @@
+
+#ifndef __MODES_DEVICE_H__
+#define __MODES_DEVICE_H__
+
+/*
+ * Device drivers.  Opening a device gets a struct dev with a non-blocking
+ * fd in it; when that's readable, dev_read() frames as much as it can
+ * without blocking into an array of frames, and returns how many.  Zero
+ * means wait for the fd again.  What a driver's frames carry (device clock
+ * ticks, a frame counter) is in its caps.
+ *
+ * microADS-B frames out of an rbuf with its one-frame-at-a-time reader; see
+ * rbufdev_*().  Aurora parses each read() incrementally instead (aurora.h).
+ * Either way, bytes skipped to resync are counted as they're skipped, and
+ * also left on the next frame (f->skipped) for seqtrack.
+ *
+ * Counters go in a struct devstats the caller hands dev_open(), so they
+ * outlive the device (and carry on across reopening it).  Only the reader
+ * writes them; other threads read them with MET_GET().
+ *
+ * Putting a serial device in the right mode (DEV_CAP_INIT) is a short
+ * conversation with it: reset it, wait for it to come back, send a command,
+ * wait for the reply.  Drivers write that as an initstep() that's called
+ * with each line the device sends, or with NULL to start and whenever
+ * di->waitms goes by without one, and that says whether it's done.
+ * dev_initstart() has the conversation on an event loop, so everything
+ * else carries on meanwhile; dev_open() and dev_initrun() wait for it.
+ */
+
+#include "frame.h"
+#include "rbuf.h"
+#include "evloop.h"
+
+#define DEV_CAP_TICKS 0x0001 /* frames have ticks, at tickhz */
+#define DEV_CAP_SEQNUM 0x0002 /* frames have a seqbits wide frame counter */
+#define DEV_CAP_INIT 0x0004 /* open() can put the device in the right mode (-I skips it) */
+#define DEV_CAP_REPLAY 0x0008 /* not live: can't overrun, so it can be made to wait */
+
+#define DEV_BATCH 64 /* frames per dev_read(), as modesd uses it */
+
+struct devstats {
+	unsigned long reads; /* read() calls */
+	unsigned long bytes;
+	unsigned long frames;
+	unsigned long skipped; /* bytes skipped to resync */
+};
+
+#define DEVINIT_DONE 0 /* di->fd is ready to frame from */
+#define DEVINIT_MORE 1 /* call again with the next line, or NULL after di->waitms */
+#define DEVINIT_FAIL (-1)
+
+#define DEVINIT_LINE_MAX 128
+
+struct dev;
+struct devinit;
+
+struct devdrv {
+	const char name[32];
+	int caps;
+	unsigned long tickhz; /* rate of frame->ticks, with DEV_CAP_TICKS */
+	int seqbits; /* width of frame->seqnum, with DEV_CAP_SEQNUM */
+	struct dev *(*open)(const struct devdrv *drv, const char *devname, int init); /* without openfd */
+	int (*read)(struct dev *dev, struct frame *f, int n);
+	void (*close)(struct dev *dev);
+
+	/* serial devices: opening to an fd as it is, bringing it up, and the rest on an fd */
+	int (*openfd)(const char *devname);
+	int (*initstep)(struct devinit *di, const char *line);
+	/* rb, if not NULL, is what bringing it up read from fd past the last line it wanted */
+	struct dev *(*fdopen)(const struct devdrv *drv, int fd, const struct rbuf *rb);
+
+	/* for rbufdev_*(): framing one frame */
+	int (*frame)(struct rbuf *rb, struct frame *frame);
+};
+
+struct devinit {
+	const char *name;
+	int (*step)(struct devinit *di, const char *line);
+	int mode; /* the driver's: what to put the device in, 0 for its default */
+	int fd; /* the driver's; -1 while it has nothing open, never swapped within a step */
+	int state; /* the driver's, from 0 */
+	int tries; /* the driver's */
+	int waitms; /* the driver's: how long to wait for a line */
+
+	/* the rest are dev_init*()'s */
+	int rbfd; /* what rb was set up for */
+	struct rbuf rb; /* lines from fd */
+	const struct devdrv *drv;
+	struct devstats *st;
+	struct evloop *ev;
+	struct evtimer *timer;
+	void (*done)(void *arg, struct dev *dev); /* with NULL if it failed */
+	void *arg;
+};
+
+/* drivers embed this first in their own state */
+struct dev {
+	const struct devdrv *drv;
+	const char *name;
+	int fd;
+	struct devstats *st; /* the caller's, atomic */
+};
+
+extern const struct devdrv *dev_find(const char *name);
+extern struct dev *dev_open(const struct devdrv *drv, const char *devname, int init,
+    struct devstats *st);
+extern int dev_read(struct dev *dev, struct frame *f, int n);
+extern void dev_close(struct dev *dev);
+
+extern int dev_initrun(struct devinit *di);
+extern struct devinit *dev_initstart(const struct devdrv *drv, const char *devname,
+    struct devstats *st, struct evloop *ev, void (*done)(void *arg, struct dev *dev), void *arg);
+extern void dev_initcancel(struct devinit *di);
+
+extern struct dev *rbufdev_fdopen(const struct devdrv *drv, int fd, const struct rbuf *rb);
+extern int rbufdev_read(struct dev *dev, struct frame *f, int n);
+extern void rbufdev_close(struct dev *dev);
+
+#endif /* ndef __MODES_DEVICE_H__ */
@@ -0,0 +1,453 @@
+/*
+ * fd and timer event loop
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/time.h>
+
+#ifdef __linux__
+#define HAVE_EPOLL
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#else
+#include <poll.h>
+#endif
+
+#include "util.h"
+#include "evloop.h"
+
+struct evfd {
+	int fd;
+	int events;
+	ev_fdcb cb;
+	void *arg;
+	int dead; /* removed, freed once we're out of any callbacks */
+	int always; /* regular file; epoll won't have it, but it's always ready */
+	struct evfd *next;
+};
+
+struct evtimer {
+	struct evloop *ev;
+	ev_timercb cb;
+	void *arg;
+#ifdef HAVE_EPOLL
+	int fd; /* timerfd */
+#else
+	int armed;
+	struct timeval due;
+	int interval; /* msecs, 0 for one-shot */
+#endif
+	int dead; /* deleted, freed once we're out of any callbacks */
+	struct evtimer *next;
+};
+
+struct evloop {
+#ifdef HAVE_EPOLL
+	int epfd;
+#endif
+	struct evfd *fds;
+	struct evtimer *timers;
+	int nalways;
+	int stop;
+};
+
+#define EV_MAXEVENTS 64
+
+struct evloop *
+ev_new(void)
+{
+	struct evloop *ev;
+
+	if (!(ev = (struct evloop *)malloc(sizeof(struct evloop))))
+		return NULL;
+	memset(ev, 0, sizeof(struct evloop));
+#ifdef HAVE_EPOLL
+	if ((ev->epfd = epoll_create(EV_MAXEVENTS)) == -1) {
+		logmsg("epoll_create: %s\n", strerror(errno));
+		free(ev);
+		return NULL;
+	}
+#endif
+	return ev;
+}
+
+static void
+ev_sweep(struct evloop *ev)
+{
+	struct evfd **efp = &ev->fds;
+	struct evtimer **tp = &ev->timers;
+
+	while (*efp) {
+		struct evfd *ef = *efp;
+		if (ef->dead) {
+			*efp = ef->next;
+			free(ef);
+		} else
+			efp = &ef->next;
+	}
+	while (*tp) {
+		struct evtimer *t = *tp;
+		if (t->dead) {
+			*tp = t->next;
+			free(t);
+		} else
+			tp = &t->next;
+	}
+	return;
+}
+
+void
+ev_free(struct evloop *ev)
+{
+	struct evtimer *t;
+	struct evfd *ef;
+
+	if (!ev) return;
+
+	for (t = ev->timers; t; t = t->next)
+		ev_deltimer(t);
+	for (ef = ev->fds; ef; ef = ef->next)
+		ef->dead = 1;
+	ev_sweep(ev);
+#ifdef HAVE_EPOLL
+	close(ev->epfd);
+#endif
+	free(ev);
+	return;
+}
+
+static struct evfd *
+ev_findfd(struct evloop *ev, int fd)
+{
+	struct evfd *ef;
+
+	for (ef = ev->fds; ef; ef = ef->next) {
+		if (!ef->dead && (ef->fd == fd))
+			return ef;
+	}
+	return NULL;
+}
+
+#ifdef HAVE_EPOLL
+static int
+ev_epollctl(struct evloop *ev, int op, struct evfd *ef)
+{
+	struct epoll_event ee;
+
+	if (ef->always)
+		return 0;
+
+	memset(&ee, 0, sizeof(ee));
+	if (ef->events & EV_READ)
+		ee.events |= EPOLLIN;
+	if (ef->events & EV_WRITE)
+		ee.events |= EPOLLOUT;
+	ee.data.ptr = ef;
+	if (epoll_ctl(ev->epfd, op, ef->fd, &ee) == -1) {
+		if ((op == EPOLL_CTL_ADD) && (errno == EPERM))
+			return -1; /* quietly; caller deals with it */
+		logmsg("epoll_ctl(%d): %s\n", ef->fd, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+#endif
+
+int
+ev_addfd(struct evloop *ev, int fd, int events, ev_fdcb cb, void *arg)
+{
+	struct evfd *ef;
+
+	if (!ev || (fd < 0) || !cb || ev_findfd(ev, fd))
+		return -1;
+
+	if (!(ef = (struct evfd *)malloc(sizeof(struct evfd))))
+		return -1;
+	memset(ef, 0, sizeof(struct evfd));
+	ef->fd = fd;
+	ef->events = events;
+	ef->cb = cb;
+	ef->arg = arg;
+#ifdef HAVE_EPOLL
+	if (ev_epollctl(ev, EPOLL_CTL_ADD, ef) == -1) {
+		if (errno != EPERM) {
+			free(ef);
+			return -1;
+		}
+		ef->always = 1;
+		ev->nalways++;
+	}
+#endif
+	ef->next = ev->fds;
+	ev->fds = ef;
+
+	return 0;
+}
+
+int
+ev_modfd(struct evloop *ev, int fd, int events)
+{
+	struct evfd *ef;
+
+	if (!(ef = ev_findfd(ev, fd)))
+		return -1;
+	if (ef->events == events)
+		return 0;
+	ef->events = events;
+#ifdef HAVE_EPOLL
+	return ev_epollctl(ev, EPOLL_CTL_MOD, ef);
+#else
+	return 0;
+#endif
+}
+
+void
+ev_delfd(struct evloop *ev, int fd)
+{
+	struct evfd *ef;
+
+	if (!(ef = ev_findfd(ev, fd)))
+		return;
+#ifdef HAVE_EPOLL
+	if (ef->always)
+		ev->nalways--;
+	else
+		epoll_ctl(ev->epfd, EPOLL_CTL_DEL, fd, NULL);
+#endif
+	ef->dead = 1;
+	return;
+}
+
+#ifdef HAVE_EPOLL
+static void
+ev_timerfired(void *arg, int fd, int events)
+{
+	struct evtimer *t = (struct evtimer *)arg;
+	unsigned long long expirations;
+
+	if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+		return;
+	t->cb(t->arg);
+	return;
+}
+#endif
+
+struct evtimer *
+ev_addtimer(struct evloop *ev, ev_timercb cb, void *arg)
+{
+	struct evtimer *t;
+
+	if (!ev || !cb)
+		return NULL;
+	if (!(t = (struct evtimer *)malloc(sizeof(struct evtimer))))
+		return NULL;
+	memset(t, 0, sizeof(struct evtimer));
+	t->ev = ev;
+	t->cb = cb;
+	t->arg = arg;
+#ifdef HAVE_EPOLL
+	if ((t->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK)) == -1) {
+		logmsg("timerfd_create: %s\n", strerror(errno));
+		free(t);
+		return NULL;
+	}
+	if (ev_addfd(ev, t->fd, EV_READ, ev_timerfired, t) == -1) {
+		close(t->fd);
+		free(t);
+		return NULL;
+	}
+#endif
+	t->next = ev->timers;
+	ev->timers = t;
+
+	return t;
+}
+
+/* fire in msecs, then every intervalmsecs if that's nonzero. msecs 0 disarms. */
+int
+ev_settimer(struct evtimer *t, int msecs, int intervalmsecs)
+{
+#ifdef HAVE_EPOLL
+	struct itimerspec its;
+#endif
+
+	if (t->dead)
+		return -1;
+#ifdef HAVE_EPOLL
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = msecs / 1000;
+	its.it_value.tv_nsec = (msecs % 1000) * 1000000L;
+	its.it_interval.tv_sec = intervalmsecs / 1000;
+	its.it_interval.tv_nsec = (intervalmsecs % 1000) * 1000000L;
+	if (timerfd_settime(t->fd, 0, &its, NULL) == -1) {
+		logmsg("timerfd_settime: %s\n", strerror(errno));
+		return -1;
+	}
+#else
+	t->armed = (msecs > 0);
+	t->interval = intervalmsecs;
+	gettimeofday(&t->due, NULL);
+	t->due.tv_sec += msecs / 1000;
+	t->due.tv_usec += (msecs % 1000) * 1000;
+	if (t->due.tv_usec >= 1000000) {
+		t->due.tv_sec++;
+		t->due.tv_usec -= 1000000;
+	}
+#endif
+	return 0;
+}
+
+/* from anywhere, its own callback included; like fds, it's freed by ev_sweep() */
+void
+ev_deltimer(struct evtimer *t)
+{
+	if (!t || t->dead) return;
+
+	t->dead = 1;
+#ifdef HAVE_EPOLL
+	ev_delfd(t->ev, t->fd);
+	close(t->fd);
+#else
+	t->armed = 0;
+#endif
+	return;
+}
+
+void
+ev_stop(struct evloop *ev)
+{
+	ev->stop = 1;
+	return;
+}
+
+int
+ev_stopped(struct evloop *ev)
+{
+	return ev->stop;
+}
+
+/*
+ * wait up to msecs (-1 for forever) and dispatch whatever happened. returns
+ * the number of callbacks made, or -1 on error.
+ */
+#ifdef HAVE_EPOLL
+int
+ev_run(struct evloop *ev, int msecs)
+{
+	struct epoll_event ees[EV_MAXEVENTS];
+	struct evfd *ef;
+	int n, i, fired = 0;
+
+	if ((n = epoll_wait(ev->epfd, ees, EV_MAXEVENTS,
+	    ev->nalways ? 0 : msecs)) == -1) {
+		if (errno == EINTR)
+			return 0;
+		logmsg("epoll_wait: %s\n", strerror(errno));
+		return -1;
+	}
+	for (ef = ev->fds; ev->nalways && ef; ef = ef->next) {
+		if (ef->always && !ef->dead) {
+			ef->cb(ef->arg, ef->fd, ef->events);
+			fired++;
+		}
+	}
+	for (i = 0; i < n; i++) {
+		int events = 0;
+
+		ef = (struct evfd *)ees[i].data.ptr;
+		if (ef->dead)
+			continue;
+		if (ees[i].events & EPOLLIN)
+			events |= EV_READ;
+		if (ees[i].events & EPOLLOUT)
+			events |= EV_WRITE;
+		if (ees[i].events & (EPOLLERR | EPOLLHUP))
+			events |= EV_ERROR;
+		ef->cb(ef->arg, ef->fd, events);
+		fired++;
+	}
+	ev_sweep(ev);
+
+	return fired;
+}
+#else
+static long
+ev_msecsuntil(const struct timeval *now, const struct timeval *then)
+{
+	return (then->tv_sec - now->tv_sec) * 1000L +
+	    (then->tv_usec - now->tv_usec) / 1000L;
+}
+
+int
+ev_run(struct evloop *ev, int msecs)
+{
+	struct pollfd pfds[EV_MAXEVENTS];
+	struct evfd *efs[EV_MAXEVENTS];
+	struct evtimer *t;
+	struct timeval now;
+	int n = 0, i, ret, fired = 0;
+	struct evfd *ef;
+
+	gettimeofday(&now, NULL);
+	for (t = ev->timers; t; t = t->next) {
+		if (t->armed) {
+			long left = ev_msecsuntil(&now, &t->due);
+			if (left < 0)
+				left = 0;
+			if ((msecs < 0) || (left < msecs))
+				msecs = left;
+		}
+	}
+	for (ef = ev->fds; ef && (n < EV_MAXEVENTS); ef = ef->next) {
+		if (ef->dead)
+			continue;
+		pfds[n].fd = ef->fd;
+		pfds[n].events = ((ef->events & EV_READ) ? POLLIN : 0) |
+		    ((ef->events & EV_WRITE) ? POLLOUT : 0);
+		pfds[n].revents = 0;
+		efs[n++] = ef;
+	}
+
+	if ((ret = poll(pfds, n, msecs)) == -1) {
+		if (errno == EINTR)
+			return 0;
+		logmsg("poll: %s\n", strerror(errno));
+		return -1;
+	}
+	for (i = 0; (ret > 0) && (i < n); i++) {
+		int events = 0;
+
+		if (!pfds[i].revents || efs[i]->dead)
+			continue;
+		if (pfds[i].revents & POLLIN)
+			events |= EV_READ;
+		if (pfds[i].revents & POLLOUT)
+			events |= EV_WRITE;
+		if (pfds[i].revents & (POLLERR | POLLHUP | POLLNVAL))
+			events |= EV_ERROR;
+		efs[i]->cb(efs[i]->arg, efs[i]->fd, events);
+		fired++;
+	}
+
+	gettimeofday(&now, NULL);
+	/* callbacks may delete any timer, but that only marks it dead */
+	for (t = ev->timers; t; t = t->next) {
+		if (!t->dead && t->armed && (ev_msecsuntil(&now, &t->due) <= 0)) {
+			if (t->interval)
+				ev_settimer(t, t->interval, t->interval);
+			else
+				t->armed = 0;
+			t->cb(t->arg);
+			fired++;
+		}
+	}
+	ev_sweep(ev);
+
+	return fired;
+}
+#endif
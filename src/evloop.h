@@ -0,0 +1,35 @@
+
+#ifndef __MODES_EVLOOP_H__
+#define __MODES_EVLOOP_H__
+
+/*
+ * Minimal fd/timer event loop.  epoll and timerfd on Linux, poll() and a
+ * timer list elsewhere.
+ */
+
+#define EV_READ 0x01
+#define EV_WRITE 0x02
+#define EV_ERROR 0x04 /* only ever reported, never asked for */
+
+struct evloop;
+struct evtimer;
+
+typedef void (*ev_fdcb)(void *arg, int fd, int events);
+typedef void (*ev_timercb)(void *arg);
+
+extern struct evloop *ev_new(void);
+extern void ev_free(struct evloop *ev);
+
+extern int ev_addfd(struct evloop *ev, int fd, int events, ev_fdcb cb, void *arg);
+extern int ev_modfd(struct evloop *ev, int fd, int events);
+extern void ev_delfd(struct evloop *ev, int fd);
+
+extern struct evtimer *ev_addtimer(struct evloop *ev, ev_timercb cb, void *arg);
+extern int ev_settimer(struct evtimer *t, int msecs, int intervalmsecs);
+extern void ev_deltimer(struct evtimer *t);
+
+extern int ev_run(struct evloop *ev, int msecs);
+extern void ev_stop(struct evloop *ev);
+extern int ev_stopped(struct evloop *ev);
+
+#endif /* ndef __MODES_EVLOOP_H__ */
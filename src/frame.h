@@ -3,14 +3,24 @@
 
 #include <sys/time.h>
 
+#define MODES_SHORT_LEN 7 /* bytes in a 56 bit squitter */
+#define MODES_LONG_LEN 14 /* bytes in a 112 bit extended squitter */
+
+/* DF >= 16 are all 112 bits; everything else is 56 */
+#define MODES_DF(b0) (((b0) >> 3) & 0x1f)
+#define MODES_DFLEN(df) (((df) >= 16) ? MODES_LONG_LEN : MODES_SHORT_LEN)
+
 struct frame {
 	struct timeval rxstart; /* wall-clock at first byte */
 	struct timeval rxend; /* wall-clock at last byte */
 	unsigned long long seqnum; /* sequence number (from device) */
 	unsigned long long ticks; /* clock ticks since device boot (from device) */
+	unsigned long long mlat; /* ticks as a 48 bit 12MHz count, for Beast; 0 if none */
 	int skipped; /* bytes skipped to resynch */
-	char data[28+1]; /* data as ascii hex string */
+	int len; /* bytes of data (MODES_SHORT_LEN or MODES_LONG_LEN) */
+	unsigned char df; /* downlink format */
+	unsigned char crc; /* parity check result, CRC_* from crc.h */
+	unsigned char data[MODES_LONG_LEN]; /* Mode-S message, binary */
 };
 
 #endif
-
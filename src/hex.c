@@ -0,0 +1,300 @@
+/*
+ * Vector hex kernels; see hex.h.
+ *
+ * Digits are classified without tables: c - '0' is a digit if it's <= 9
+ * unsigned, and (c | 0x20) - 'a' is a letter if it's <= 5, both of which
+ * are an unsigned min and a compare per vector.  Decoding then folds each
+ * pair of nibbles into a byte and packs the 16 bit lanes down.  Vector
+ * loops never read past len; a tail that doesn't fill a vector is done by
+ * backing up to end exactly at len, redoing a few bytes already checked,
+ * which is cheaper than finishing byte at a time.
+ */
+
+#include <string.h>
+
+#include "util.h"
+#include "hex.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define HEX_X86
+#include <immintrin.h>
+#endif
+
+static inline int
+hexdigit(unsigned char c)
+{
+	unsigned int d = c - '0', l = (c | 0x20) - 'a';
+
+	if (d <= 9)
+		return d;
+	if (l <= 5)
+		return l + 10;
+	return -1;
+}
+
+static int
+span_scalar(const char *src, int len)
+{
+	int i;
+
+	for (i = 0; (i < len) && (hexdigit(src[i]) != -1); i++)
+		;
+	return i;
+}
+
+static int
+decode_scalar(unsigned char *dst, const char *src, int len)
+{
+	return hexdecode(dst, src, len);
+}
+
+static int
+usable_scalar(void)
+{
+	return 1;
+}
+
+#ifdef HEX_X86
+
+/* nibble values in v, and 0xff in *ok for the bytes that were hex digits */
+__attribute__((target("sse2")))
+static inline __m128i
+nibbles_sse2(__m128i c, __m128i *ok)
+{
+	__m128i d = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+	__m128i l = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+	__m128i isd = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+	__m128i isl = _mm_cmpeq_epi8(_mm_min_epu8(l, _mm_set1_epi8(5)), l);
+
+	*ok = _mm_or_si128(isd, isl);
+	return _mm_or_si128(_mm_and_si128(isd, d),
+	    _mm_and_si128(isl, _mm_add_epi8(l, _mm_set1_epi8(10))));
+}
+
+/* two digits per 16 bit lane, first one in the low byte, to a byte per lane */
+__attribute__((target("sse2")))
+static inline __m128i
+pairs_sse2(__m128i v)
+{
+	return _mm_or_si128(_mm_slli_epi16(_mm_and_si128(v, _mm_set1_epi16(0x00ff)), 4),
+	    _mm_srli_epi16(v, 8));
+}
+
+__attribute__((target("sse2")))
+static int
+span_sse2(const char *src, int len)
+{
+	int off, m;
+	__m128i ok;
+
+	if (len < 16)
+		return span_scalar(src, len);
+	for (off = 0; off + 16 <= len; off += 16) {
+		nibbles_sse2(_mm_loadu_si128((const __m128i *)(src + off)), &ok);
+		if ((m = _mm_movemask_epi8(ok)) != 0xffff)
+			return off + __builtin_ctz(~m);
+	}
+	if (off < len) {
+		off = len - 16;
+		nibbles_sse2(_mm_loadu_si128((const __m128i *)(src + off)), &ok);
+		if ((m = _mm_movemask_epi8(ok)) != 0xffff)
+			return off + __builtin_ctz(~m);
+	}
+	return len;
+}
+
+__attribute__((target("sse2")))
+static int
+decode_sse2(unsigned char *dst, const char *src, int len)
+{
+	int n = 2*len, off;
+	__m128i bad = _mm_setzero_si128(), ok, a, b;
+
+	if (n < 16)
+		return decode_scalar(dst, src, len);
+	for (off = 0; off + 32 <= n; off += 32) {
+		a = nibbles_sse2(_mm_loadu_si128((const __m128i *)(src + off)), &ok);
+		bad = _mm_or_si128(bad, _mm_xor_si128(ok, _mm_set1_epi8(-1)));
+		b = nibbles_sse2(_mm_loadu_si128((const __m128i *)(src + off + 16)), &ok);
+		bad = _mm_or_si128(bad, _mm_xor_si128(ok, _mm_set1_epi8(-1)));
+		_mm_storeu_si128((__m128i *)(dst + off/2),
+		    _mm_packus_epi16(pairs_sse2(a), pairs_sse2(b)));
+	}
+	for (; off < n; off += 16) {
+		if (off + 16 > n)
+			off = n - 16;
+		a = nibbles_sse2(_mm_loadu_si128((const __m128i *)(src + off)), &ok);
+		bad = _mm_or_si128(bad, _mm_xor_si128(ok, _mm_set1_epi8(-1)));
+		_mm_storel_epi64((__m128i *)(dst + off/2),
+		    _mm_packus_epi16(pairs_sse2(a), a));
+	}
+	return _mm_movemask_epi8(bad) ? -1 : len;
+}
+
+static int
+usable_sse2(void)
+{
+	return __builtin_cpu_supports("sse2");
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+nibbles_avx2(__m256i c, __m256i *ok)
+{
+	__m256i d = _mm256_sub_epi8(c, _mm256_set1_epi8('0'));
+	__m256i l = _mm256_sub_epi8(_mm256_or_si256(c, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+	__m256i isd = _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(9)), d);
+	__m256i isl = _mm256_cmpeq_epi8(_mm256_min_epu8(l, _mm256_set1_epi8(5)), l);
+
+	*ok = _mm256_or_si256(isd, isl);
+	return _mm256_or_si256(_mm256_and_si256(isd, d),
+	    _mm256_and_si256(isl, _mm256_add_epi8(l, _mm256_set1_epi8(10))));
+}
+
+__attribute__((target("avx2")))
+static int
+span_avx2(const char *src, int len)
+{
+	int off;
+	unsigned int m;
+	__m256i ok;
+
+	if (len < 32)
+		return span_sse2(src, len);
+	for (off = 0; off + 32 <= len; off += 32) {
+		nibbles_avx2(_mm256_loadu_si256((const __m256i *)(src + off)), &ok);
+		if ((m = _mm256_movemask_epi8(ok)) != 0xffffffff)
+			return off + __builtin_ctz(~m);
+	}
+	if (off < len) {
+		off = len - 32;
+		nibbles_avx2(_mm256_loadu_si256((const __m256i *)(src + off)), &ok);
+		if ((m = _mm256_movemask_epi8(ok)) != 0xffffffff)
+			return off + __builtin_ctz(~m);
+	}
+	return len;
+}
+
+/*
+ * maddubs does the nibble pairing in one go (first digit * 16 + second),
+ * and since packus works within 128 bit halves, the permute brings the
+ * two halves' results together in the low half.
+ */
+__attribute__((target("avx2")))
+static int
+decode_avx2(unsigned char *dst, const char *src, int len)
+{
+	int n = 2*len, off;
+	__m256i bad = _mm256_setzero_si256(), ok, v;
+
+	if (n < 32)
+		return decode_sse2(dst, src, len);
+	for (off = 0; off < n; off += 32) {
+		if (off + 32 > n)
+			off = n - 32;
+		v = nibbles_avx2(_mm256_loadu_si256((const __m256i *)(src + off)), &ok);
+		bad = _mm256_or_si256(bad, _mm256_xor_si256(ok, _mm256_set1_epi8(-1)));
+		v = _mm256_maddubs_epi16(v, _mm256_set1_epi16(0x0110));
+		v = _mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), 0xd8);
+		_mm_storeu_si128((__m128i *)(dst + off/2), _mm256_castsi256_si128(v));
+	}
+	return _mm256_movemask_epi8(bad) ? -1 : len;
+}
+
+static int
+usable_avx2(void)
+{
+	return __builtin_cpu_supports("avx2");
+}
+
+#endif /* HEX_X86 */
+
+struct hexkern {
+	const char *name;
+	int (*usable)(void);
+	int (*span)(const char *src, int len);
+	int (*decode)(unsigned char *dst, const char *src, int len);
+};
+
+/* best first */
+static const struct hexkern kernels[] = {
+#ifdef HEX_X86
+	{ "avx2", usable_avx2, span_avx2, decode_avx2 },
+	{ "sse2", usable_sse2, span_sse2, decode_sse2 },
+#endif
+	{ "scalar", usable_scalar, span_scalar, decode_scalar },
+};
+#define NKERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+static const struct hexkern *kern;
+
+static const struct hexkern *
+getkern(void)
+{
+	const struct hexkern *k = __atomic_load_n(&kern, __ATOMIC_RELAXED);
+	int i;
+
+	if (k)
+		return k;
+	/* racing first callers all come up with the same answer */
+	for (i = 0; !kernels[i].usable(); i++)
+		;
+	k = &kernels[i];
+	__atomic_store_n(&kern, k, __ATOMIC_RELAXED);
+	return k;
+}
+
+/* the number of hex digits src starts with, up to len */
+int
+hex_span(const char *src, int len)
+{
+	return getkern()->span(src, len);
+}
+
+/* decode len bytes from 2*len hex digits. returns len, or -1 on a non-hex digit */
+int
+hex_decode(unsigned char *dst, const char *src, int len)
+{
+	return getkern()->decode(dst, src, len);
+}
+
+/* a big endian number of up to 16 digits; too short for vectors to pay */
+int
+hex_value(const char *src, int ndigits, unsigned long long *vp)
+{
+	unsigned long long v = 0;
+	int i, d, bad = 0;
+
+	if (ndigits > 16)
+		return -1;
+	for (i = 0; i < ndigits; i++) {
+		d = hexdigit(src[i]);
+		bad |= d;
+		v = (v << 4) | (d & 0xf);
+	}
+	if (bad < 0)
+		return -1;
+	*vp = v;
+	return 0;
+}
+
+const char *
+hex_kernel(void)
+{
+	return getkern()->name;
+}
+
+/* force a kernel, for benchmarking. -1 if it's unknown or the CPU can't */
+int
+hex_setkernel(const char *name)
+{
+	int i;
+
+	for (i = 0; i < NKERNELS; i++) {
+		if ((strcmp(kernels[i].name, name) == 0) && kernels[i].usable()) {
+			__atomic_store_n(&kern, &kernels[i], __ATOMIC_RELAXED);
+			return 0;
+		}
+	}
+	return -1;
+}
@@ -0,0 +1,25 @@
+
+#ifndef __MODES_HEX_H__
+#define __MODES_HEX_H__
+
+/*
+ * Hex kernels for the AVR/SPRUT text formats.  Framing a line is mostly
+ * "how many hex digits are there before the next delimiter", and decoding
+ * one is turning those digits into bytes; both are done a vector at a time
+ * (AVX2 or SSE2, whichever the CPU has, picked on first use) with a scalar
+ * fallback for short runs and other architectures.
+ *
+ * hex_span() is the framer: it returns the length of the run of hex digits
+ * at the start of src, so the byte after it is the delimiter (';' after the
+ * message, or whatever's wrong with the line), and everything before it is
+ * already validated.
+ */
+
+extern int hex_span(const char *src, int len);
+extern int hex_decode(unsigned char *dst, const char *src, int len);
+extern int hex_value(const char *src, int ndigits, unsigned long long *vp);
+
+extern const char *hex_kernel(void);
+extern int hex_setkernel(const char *name);
+
+#endif /* ndef __MODES_HEX_H__ */
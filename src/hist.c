@@ -0,0 +1,102 @@
+/*
+ * Log-linear histograms
+ */
+
+#include <string.h>
+
+#include "hist.h"
+
+void
+hist_reset(struct hist *h)
+{
+	memset(h, 0, sizeof(struct hist));
+	return;
+}
+
+static inline int
+hist_bucket(unsigned long long v)
+{
+	int shift;
+
+	if (v < 2 * HIST_SUB)
+		return v;
+	shift = (63 - __builtin_clzll(v)) - HIST_SUBBITS;
+	return (shift + 1) * HIST_SUB + (int)((v >> shift) - HIST_SUB);
+}
+
+/* largest value that lands in bucket i */
+static unsigned long long
+hist_bucketmax(int i)
+{
+	int shift;
+
+	if (i < 2 * HIST_SUB)
+		return i;
+	shift = i / HIST_SUB - 1;
+	return ((unsigned long long)(i % HIST_SUB + HIST_SUB + 1) << shift) - 1;
+}
+
+void
+hist_add(struct hist *h, unsigned long long v)
+{
+	if (!h->count || (v < h->min))
+		h->min = v;
+	if (v > h->max)
+		h->max = v;
+	h->count++;
+	h->sum += v;
+	h->buckets[hist_bucket(v)]++;
+	return;
+}
+
+void
+hist_merge(struct hist *dst, const struct hist *src)
+{
+	int i;
+
+	if (!src->count)
+		return;
+	if (!dst->count || (src->min < dst->min))
+		dst->min = src->min;
+	if (src->max > dst->max)
+		dst->max = src->max;
+	dst->count += src->count;
+	dst->sum += src->sum;
+	for (i = 0; i < HIST_BUCKETS; i++)
+		dst->buckets[i] += src->buckets[i];
+	return;
+}
+
+/* value at or below which pct percent of them fall, 0 if there are none */
+unsigned long long
+hist_pct(const struct hist *h, double pct)
+{
+	unsigned long want, seen = 0;
+	int i;
+
+	if (!h->count)
+		return 0;
+	want = (unsigned long)(h->count * pct / 100.0 + 0.5);
+	if (want < 1)
+		want = 1;
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= want) {
+			unsigned long long v = hist_bucketmax(i);
+			return (v > h->max) ? h->max : v;
+		}
+	}
+	return h->max;
+}
+
+/* how many are below v; exact when v is a power of 2 */
+unsigned long
+hist_countbelow(const struct hist *h, unsigned long long v)
+{
+	unsigned long n = 0;
+	int i;
+
+	for (i = 0; (i < HIST_BUCKETS) && (hist_bucketmax(i) < v); i++)
+		n += h->buckets[i];
+	return n;
+}
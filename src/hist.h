@@ -0,0 +1,30 @@
+
+#ifndef __MODES_HIST_H__
+#define __MODES_HIST_H__
+
+/*
+ * Log-linear histograms, for latencies and the like.  Values below
+ * 2*HIST_SUB are counted exactly; above that, each power of two is split
+ * into HIST_SUB buckets, so a percentile is within 1/HIST_SUB of the truth
+ * at any scale.  Fixed size, no allocation, adding is a few instructions.
+ */
+
+#define HIST_SUBBITS 5
+#define HIST_SUB (1 << HIST_SUBBITS)
+#define HIST_BUCKETS ((64 - HIST_SUBBITS + 1) * HIST_SUB)
+
+struct hist {
+	unsigned long count;
+	unsigned long long sum;
+	unsigned long long min;
+	unsigned long long max;
+	unsigned long buckets[HIST_BUCKETS];
+};
+
+extern void hist_reset(struct hist *h);
+extern void hist_add(struct hist *h, unsigned long long v);
+extern void hist_merge(struct hist *dst, const struct hist *src);
+extern unsigned long long hist_pct(const struct hist *h, double pct);
+extern unsigned long hist_countbelow(const struct hist *h, unsigned long long v);
+
+#endif /* ndef __MODES_HIST_H__ */
@@ -0,0 +1,199 @@
+/*
+ * Device node (re)appearance; see hotplug.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#ifdef __linux__
+#define HAVE_INOTIFY
+#include <sys/inotify.h>
+#endif
+
+#include "util.h"
+#include "hotplug.h"
+
+#define HP_MAXFIRE 16 /* callbacks for one event; more than enough devices in a directory */
+
+struct hpwatch {
+	int wd; /* -1 once the directory's gone */
+	char *name; /* in the directory */
+	hp_cb cb;
+	void *arg;
+	struct hpwatch *next;
+};
+
+struct hotplug {
+	struct evloop *ev;
+	int fd; /* inotify's, or -1 */
+	struct hpwatch *watches;
+};
+
+#ifdef HAVE_INOTIFY
+static void
+hp_fire(struct hotplug *hp, int wd, const char *name)
+{
+	struct { hp_cb cb; void *arg; } fire[HP_MAXFIRE];
+	struct hpwatch *w;
+	int n = 0, i;
+
+	/* callbacks may unwatch, so find them all first and check each is still there */
+	for (w = hp->watches; w && (n < HP_MAXFIRE); w = w->next) {
+		if ((w->wd == wd) && (strcmp(w->name, name) == 0)) {
+			fire[n].cb = w->cb;
+			fire[n++].arg = w->arg;
+		}
+	}
+	for (i = 0; i < n; i++) {
+		for (w = hp->watches; w; w = w->next) {
+			if ((w->wd == wd) && (w->arg == fire[i].arg) && (w->cb == fire[i].cb))
+				break;
+		}
+		if (w)
+			fire[i].cb(fire[i].arg);
+	}
+	return;
+}
+
+static void
+hp_read(void *arg, int fd, int events)
+{
+	struct hotplug *hp = (struct hotplug *)arg;
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	struct inotify_event *ie;
+	struct hpwatch *w;
+	int n;
+	char *p;
+
+	while ((n = read(fd, buf, sizeof(buf))) > 0) {
+		for (p = buf; p < buf + n; p += sizeof(struct inotify_event) + ie->len) {
+			ie = (struct inotify_event *)p;
+			if (ie->mask & IN_IGNORED) {
+				/* the directory went away; they're down to their timers */
+				for (w = hp->watches; w; w = w->next) {
+					if (w->wd == ie->wd)
+						w->wd = -1;
+				}
+			} else if (ie->len)
+				hp_fire(hp, ie->wd, ie->name);
+		}
+	}
+	if ((n == -1) && (errno != EAGAIN) && (errno != EWOULDBLOCK))
+		logmsg("inotify read: %s\n", strerror(errno));
+	return;
+}
+#endif
+
+struct hotplug *
+hp_new(struct evloop *ev)
+{
+	struct hotplug *hp;
+
+	if (!(hp = (struct hotplug *)malloc(sizeof(struct hotplug))))
+		return NULL;
+	memset(hp, 0, sizeof(struct hotplug));
+	hp->ev = ev;
+	hp->fd = -1;
+#ifdef HAVE_INOTIFY
+	if ((hp->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1)
+		logmsg("inotify: %s; noticing devices coming back by polling\n", strerror(errno));
+	else if (ev_addfd(ev, hp->fd, EV_READ, hp_read, hp) == -1) {
+		close(hp->fd);
+		hp->fd = -1;
+	}
+#endif
+	return hp;
+}
+
+void
+hp_free(struct hotplug *hp)
+{
+	struct hpwatch *w;
+
+	if (!hp)
+		return;
+	while ((w = hp->watches)) {
+		hp->watches = w->next;
+		free(w->name);
+		free(w);
+	}
+	if (hp->fd != -1) {
+		ev_delfd(hp->ev, hp->fd);
+		close(hp->fd);
+	}
+	free(hp);
+	return;
+}
+
+/* call cb when something called path turns up; -1 if that can't be noticed */
+int
+hp_watch(struct hotplug *hp, const char *path, hp_cb cb, void *arg)
+{
+#ifdef HAVE_INOTIFY
+	struct hpwatch *w;
+	const char *slash = strrchr(path, '/');
+	char dir[1024];
+	int wd;
+
+	if (!hp || (hp->fd == -1))
+		return -1;
+	if (!slash)
+		strcpy(dir, ".");
+	else if (slash == path)
+		strcpy(dir, "/");
+	else if ((slash - path) < sizeof(dir))
+		snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+	else
+		return -1;
+	if ((wd = inotify_add_watch(hp->fd, dir, IN_CREATE | IN_MOVED_TO | IN_ATTRIB)) == -1)
+		return -1;
+	if (!(w = (struct hpwatch *)malloc(sizeof(struct hpwatch))))
+		return -1;
+	if (!(w->name = strdup(slash ? (slash + 1) : path))) {
+		free(w);
+		return -1;
+	}
+	w->wd = wd;
+	w->cb = cb;
+	w->arg = arg;
+	w->next = hp->watches;
+	hp->watches = w;
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+/* everything watched for arg */
+void
+hp_unwatch(struct hotplug *hp, void *arg)
+{
+	struct hpwatch **wp, *w;
+
+	if (!hp)
+		return;
+	for (wp = &hp->watches; (w = *wp); ) {
+		if (w->arg != arg) {
+			wp = &w->next;
+			continue;
+		}
+		*wp = w->next;
+#ifdef HAVE_INOTIFY
+		{
+			struct hpwatch *o;
+
+			/* the directory's watch goes once nobody else wants it */
+			for (o = hp->watches; o && (o->wd != w->wd); o = o->next)
+				;
+			if (!o && (w->wd != -1))
+				inotify_rm_watch(hp->fd, w->wd);
+		}
+#endif
+		free(w->name);
+		free(w);
+	}
+	return;
+}
@@ -0,0 +1,27 @@
+
+#ifndef __MODES_HOTPLUG_H__
+#define __MODES_HOTPLUG_H__
+
+/*
+ * Noticing a device node come back: /dev/ttyUSB0 after it's been unplugged
+ * and plugged in again, or after a reset dropped it off the bus.  On Linux
+ * an inotify watch on the node's directory says when something by that
+ * name is created, moved in, or has its attributes changed (as udev does
+ * once it's set the permissions).  Anywhere else, or if the directory
+ * itself isn't there (/dev/serial/by-id with nothing plugged in),
+ * hp_watch() fails and the caller will have to keep trying on a timer.
+ * Either way the callback is only a hint to go and try opening it.
+ */
+
+#include "evloop.h"
+
+struct hotplug;
+
+typedef void (*hp_cb)(void *arg);
+
+extern struct hotplug *hp_new(struct evloop *ev);
+extern void hp_free(struct hotplug *hp);
+extern int hp_watch(struct hotplug *hp, const char *path, hp_cb cb, void *arg);
+extern void hp_unwatch(struct hotplug *hp, void *arg);
+
+#endif /* ndef __MODES_HOTPLUG_H__ */
@@ -0,0 +1,273 @@
+/*
+ * Metrics endpoint
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include "util.h"
+#include "hist.h"
+#include "metrics.h"
+
+static int met_fd = -1;
+static char *met_path = NULL; /* Unix socket to remove when we're done */
+static met_collectcb met_collect = NULL;
+static void *met_arg = NULL;
+static pthread_t met_thread;
+static int met_running = 0;
+static int met_pipe[2] = { -1, -1 }; /* written to stop the thread */
+
+/* -m [host:]port, or -m /path/to/socket */
+int
+met_parsearg(const char *optarg)
+{
+	int on = 1;
+
+	if (!optarg || !*optarg)
+		return -1;
+	if (met_fd != -1) {
+		fprintf(stderr, "only one metrics endpoint, please\n");
+		return -1;
+	}
+
+	if (index(optarg, '/')) {
+		struct sockaddr_un sun;
+
+		if (strlen(optarg) >= sizeof(sun.sun_path)) {
+			fprintf(stderr, "metrics socket path too long\n");
+			return -1;
+		}
+		memset(&sun, 0, sizeof(sun));
+		sun.sun_family = AF_UNIX;
+		strcpy(sun.sun_path, optarg);
+		unlink(optarg);
+		if (((met_fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) ||
+		    (bind(met_fd, (struct sockaddr *)&sun, sizeof(sun)) == -1)) {
+			fprintf(stderr, "unable to bind %s: %s\n", optarg, strerror(errno));
+			goto fail;
+		}
+		met_path = strdup(optarg);
+	} else {
+		struct sockaddr_in sin;
+		const char *pstr = optarg;
+		char *host = NULL;
+		int port;
+
+		memset(&sin, 0, sizeof(sin));
+		sin.sin_family = AF_INET;
+		sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK); /* local unless asked */
+		if (index(optarg, ':')) {
+			struct hostent *hp;
+
+			if (!(host = strdup(optarg)))
+				return -1;
+			*index(host, ':') = '\0';
+			pstr = optarg + strlen(host) + 1;
+			if (!(hp = gethostbyname(host))) {
+				fprintf(stderr, "unknown host '%s'\n", host);
+				free(host);
+				return -1;
+			}
+			memcpy(&sin.sin_addr, hp->h_addr, hp->h_length);
+			free(host);
+		}
+		if (((port = atoi(pstr)) <= 0) || (port > 65535)) {
+			fprintf(stderr, "invalid metrics port '%s'\n", pstr);
+			return -1;
+		}
+		sin.sin_port = htons(port);
+		if ((met_fd = socket(AF_INET, SOCK_STREAM, 0)) == -1)
+			goto fail;
+		setsockopt(met_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		if (bind(met_fd, (struct sockaddr *)&sin, sizeof(sin)) == -1) {
+			fprintf(stderr, "unable to bind metrics port %d: %s\n", port, strerror(errno));
+			goto fail;
+		}
+	}
+	if (listen(met_fd, 4) == -1) {
+		fprintf(stderr, "unable to listen for metrics: %s\n", strerror(errno));
+		goto fail;
+	}
+	return 0;
+fail:
+	if (met_fd != -1)
+		close(met_fd);
+	met_fd = -1;
+	return -1;
+}
+
+void
+met_printf(struct metbuf *mb, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	for (;;) {
+		va_start(ap, fmt);
+		n = vsnprintf(mb->buf + mb->len, mb->size - mb->len, fmt, ap);
+		va_end(ap);
+		if ((n >= 0) && (mb->len + n < mb->size))
+			break;
+		/* scrapes aren't the hot path; just grow it */
+		mb->size = mb->size ? (mb->size * 2) : 16384;
+		if (!(mb->buf = realloc(mb->buf, mb->size))) {
+			mb->len = mb->size = 0;
+			return;
+		}
+	}
+	mb->len += n;
+	return;
+}
+
+void
+met_help(struct metbuf *mb, const char *name, const char *type, const char *help)
+{
+	met_printf(mb, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+	return;
+}
+
+/*
+ * The same buckets every time, so no series come and go: up to each power
+ * of 2 up to MET_HISTTOP.  hist_countbelow(2^k) is exact, and counts the
+ * values <= 2^k - 1, so that's the bound.  scale converts to the unit in name.
+ */
+void
+met_hist(struct metbuf *mb, const char *name, const char *labels,
+    const struct hist *h, double scale)
+{
+	const char *sep = (labels && *labels) ? "," : "";
+	unsigned long long le;
+
+	if (!labels)
+		labels = "";
+	for (le = 1; le <= MET_HISTTOP; le <<= 1)
+		met_printf(mb, "%s_bucket{%s%sle=\"%g\"} %lu\n", name, labels, sep, (le - 1) * scale,
+		    hist_countbelow(h, le));
+	met_printf(mb, "%s_bucket{%s%sle=\"+Inf\"} %lu\n", name, labels, sep, h->count);
+	if (*labels) {
+		met_printf(mb, "%s_sum{%s} %g\n", name, labels, h->sum * scale);
+		met_printf(mb, "%s_count{%s} %lu\n", name, labels, h->count);
+	} else {
+		met_printf(mb, "%s_sum %g\n", name, h->sum * scale);
+		met_printf(mb, "%s_count %lu\n", name, h->count);
+	}
+	return;
+}
+
+static void
+met_serve(int fd)
+{
+	static const char hdr[] = "HTTP/1.0 200 OK\r\n"
+	    "Content-Type: text/plain; version=0.0.4\r\n"
+	    "Connection: close\r\n\r\n";
+	struct timeval tv = { 1, 0 };
+	struct metbuf mb;
+	char req[1024];
+	int n = 0, r, off;
+
+	/* a client that won't talk or won't listen only holds up other scrapes */
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	while ((n < sizeof(req) - 1) && ((r = read(fd, req + n, sizeof(req) - 1 - n)) > 0)) {
+		n += r;
+		req[n] = '\0';
+		if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n"))
+			break;
+	}
+	if ((n < 4) || strncmp(req, "GET ", 4)) {
+		static const char bad[] = "HTTP/1.0 400 Bad Request\r\nConnection: close\r\n\r\n";
+		write(fd, bad, sizeof(bad) - 1);
+		return;
+	}
+
+	memset(&mb, 0, sizeof(mb));
+	met_printf(&mb, "%s", hdr);
+	met_collect(&mb, met_arg);
+	for (off = 0; off < mb.len; off += r) {
+		if ((r = write(fd, mb.buf + off, mb.len - off)) <= 0)
+			break;
+	}
+	free(mb.buf);
+	return;
+}
+
+static void *
+met_main(void *arg)
+{
+	struct pollfd pfd[2];
+
+	pfd[0].fd = met_fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = met_pipe[0];
+	pfd[1].events = POLLIN;
+	for (;;) {
+		int fd;
+
+		if (poll(pfd, 2, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			logmsg("metrics: poll: %s\n", strerror(errno));
+			break;
+		}
+		if (pfd[1].revents)
+			break;
+		if ((fd = accept(met_fd, NULL, NULL)) == -1)
+			continue;
+		met_serve(fd);
+		close(fd);
+	}
+	return NULL;
+}
+
+/* start answering scrapes, if -m was given */
+int
+met_start(met_collectcb collect, void *arg)
+{
+	if (met_fd == -1)
+		return 0;
+	met_collect = collect;
+	met_arg = arg;
+	if (pipe(met_pipe) == -1)
+		return -1;
+	if (pthread_create(&met_thread, NULL, met_main, NULL)) {
+		logmsg("unable to start metrics thread\n");
+		return -1;
+	}
+	met_running = 1;
+	return 0;
+}
+
+void
+met_stop(void)
+{
+	if (met_running) {
+		write(met_pipe[1], "", 1);
+		pthread_join(met_thread, NULL);
+		met_running = 0;
+	}
+	if (met_pipe[0] != -1) {
+		close(met_pipe[0]);
+		close(met_pipe[1]);
+	}
+	if (met_fd != -1)
+		close(met_fd);
+	met_fd = -1;
+	if (met_path) {
+		unlink(met_path);
+		free(met_path);
+		met_path = NULL;
+	}
+	return;
+}
@@ -0,0 +1,37 @@
+#ifndef __MODES_METRICS_H__
+#define __MODES_METRICS_H__
+
+/*
+ * Prometheus text exposition over HTTP, on a TCP port or a Unix socket.
+ * Scrapes are answered on a thread of their own, so they never wait on
+ * (or hold up) the frame path; what they report is read with relaxed
+ * atomic loads of counters that each have exactly one writer.
+ */
+
+#include "hist.h"
+
+/* for counters with one writing thread: no locked instruction needed */
+#define MET_ADD(var, n) __atomic_store_n(&(var), (var) + (n), __ATOMIC_RELAXED)
+#define MET_GET(var) __atomic_load_n(&(var), __ATOMIC_RELAXED)
+
+#define MET_HISTTOP (1ULL << 26) /* met_hist()'s top bucket; a minute, in usecs */
+
+struct metbuf {
+	char *buf;
+	int len, size;
+};
+
+typedef void (*met_collectcb)(struct metbuf *mb, void *arg);
+
+extern int met_parsearg(const char *optarg);
+extern int met_start(met_collectcb collect, void *arg);
+extern void met_stop(void);
+
+/* for collect callbacks */
+extern void met_printf(struct metbuf *mb, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+extern void met_help(struct metbuf *mb, const char *name, const char *type, const char *help);
+extern void met_hist(struct metbuf *mb, const char *name, const char *labels,
+    const struct hist *h, double scale);
+
+#endif /* ndef __MODES_METRICS_H__ */
@@ -14,6 +14,9 @@
 #include <sys/time.h>
 
 #include "util.h"
+#include "hex.h"
+#include "rbuf.h"
+#include "device.h"
 #include "microadsb.h"
 #include "frame.h"
 
@@ -35,124 +38,151 @@ ma_setbaud(int fd)
 	return 0;
 }
 
-int
-ma_init(const char *devname, int bits)
-{
-	int fd;
+#define MA_RESET 0
+#define MA_REOPEN 1
+#define MA_VERSION 2
+#define MA_MODE 3
 
-	/*
-	 * it's best to always reset the device so we can ensure it's in the
-	 * right mode. even if it was just plugged into the current box, it
-	 * could be connected through a USB hub, which might have kept it
-	 * powered on, so we'd still get whatever state it was last in.
-	 */
-	fprintf(stderr, "resetting... ");
-	if ((fd = open(devname, O_WRONLY | O_NOCTTY | O_NDELAY)) == -1) {
-		fprintf(stderr, "\nunable to open %s for writing: %s\n", devname, strerror(errno));
-		return -1;
-	}
-	if (fcntl(fd, F_SETFL, O_APPEND) == -1) {
-		fprintf(stderr, "\nunable to restore blocking flag on %s\n", devname);
-		close(fd);
-		return -1;
-	}
-	if (ma_setbaud(fd) != 0) {
-		fprintf(stderr, "\nunable to set baud rate on %s\n", devname);
-		close(fd);
-		return -1;
-	}
-	if (write(fd, "#FF\n", 4) != 4) {
-		fprintf(stderr, "\nunable to write reset string to %s: %s\n", devname, strerror(errno));
-		close(fd);
-		return -1;
-	}
-	close(fd);
+#define MA_REOPENTRIES 10 /* a second apart */
+#define MA_REPLYMS 2000
+#define MA_MAXJUNK 64 /* lines that aren't replies before we give up on one */
 
-	/*
-	 * the reset will drop it off the bus for a bit; wait up to 10s for it
-	 * to come back, though something is screwy if it takes more than
-	 * three...
-	 */
-	int i;
-	for (i = 0; i < 10; i++) {
-		sleep(1);
-		fprintf(stderr, "%d ", i);
-		if ((fd = open(devname, O_RDWR | O_NOCTTY | O_NDELAY)) != -1)
-			break;
-	}
-	if (fd == -1) {
-		fprintf(stderr, "\nfailed to re-open device after reset: %s\n", strerror(errno));
-		return -1;
-	}
-	fprintf(stderr, "done\n");
-	if (fcntl(fd, F_SETFL, 0) == -1) {
-		fprintf(stderr, "\nunable to restore blocking flag on %s\n", devname);
-		close(fd);
-		return -1;
-	}
-	if (ma_setbaud(fd) != 0) {
-		fprintf(stderr, "unable to set baud rate on %s\n", devname);
-		close(fd);
+static int
+ma_command(struct devinit *di, const char *cmd)
+{
+	if (write(di->fd, cmd, strlen(cmd)) != strlen(cmd)) {
+		logmsg("%s: failed to write %.3s command to device: %s\n", di->name, cmd, strerror(errno));
 		return -1;
 	}
+	di->tries = 0;
+	di->waitms = MA_REPLYMS;
+	return 0;
+}
 
-	/* fetch the version string, just to make sure we haven't gone off the deep end. */
-	char verstr[128];
-	snprintf(verstr, sizeof(verstr), "#%02X\n", MADSB_CMD_READ_VERSION);
-	if (write(fd, verstr, strlen(verstr)) != strlen(verstr)) {
-		fprintf(stderr, "failed to write READ_VERSION command to device: %s\n", strerror(errno));
-		close(fd);
-		return -1;
-	}
-	if (readln(fd, verstr, sizeof(verstr)) == -1) {
-		fprintf(stderr, "failed to read version string from device\n");
-		close(fd);
-		return -1;
+/* a line of the device's that isn't the reply we're waiting for */
+static int
+ma_junk(struct devinit *di, const char *line)
+{
+	if (!line) {
+		logmsg("%s: no reply from device\n", di->name);
+		return DEVINIT_FAIL;
 	}
-	if ((strncmp(verstr, MADSB_KNOWNVERSION5, strlen(MADSB_KNOWNVERSION5)) != 0) &&
-	    (strncmp(verstr, MADSB_KNOWNVERSION6, strlen(MADSB_KNOWNVERSION6)) != 0) &&
-	    (strncmp(verstr, MADSB_KNOWNVERSION8, strlen(MADSB_KNOWNVERSION8)) != 0)) {
-		fprintf(stderr, "unknown version string: %s\n", verstr);
-		close(fd);
-		return -1;
+	if (++di->tries == MA_MAXJUNK) {
+		logmsg("%s: unexpected reply from device: %s\n", di->name, line);
+		return DEVINIT_FAIL;
 	}
-	logmsg("device version: %s\n", verstr);
+	return DEVINIT_MORE; /* frames from before the reset */
+}
 
-	/* set output mode */
-	char modestr[128];
-	snprintf(modestr, sizeof(modestr), "#%02X-%02X\n",
-	    MADSB_CMD_SET_MODE, bits);
-	if (write(fd, modestr, strlen(modestr)) != strlen(modestr)) {
-		fprintf(stderr, "failed to write SET_MODE command to device: %s\n", strerror(errno));
-		close(fd);
-		return -1;
-	}
-	if (readln(fd, modestr, sizeof(modestr)) == -1) {
-		fprintf(stderr, "failed to read mode string from device\n");
-		close(fd);
-		return -1;
-	}
-	if (strncmp(modestr, "#43", strlen("#43")) != 0) {
-		fprintf(stderr, "invalid response to SET_MODE string: %s\n", modestr);
+/* see device.h; di->mode is the MADSB_MODE_* bits, TC+FC if 0 */
+int
+ma_initstep(struct devinit *di, const char *line)
+{
+	char cmd[16];
+	int fd;
+
+	switch (di->state) {
+	case MA_RESET:
+		/*
+		 * it's best to always reset the device so we can ensure it's in the
+		 * right mode. even if it was just plugged into the current box, it
+		 * could be connected through a USB hub, which might have kept it
+		 * powered on, so we'd still get whatever state it was last in.
+		 */
+		logmsg("%s: resetting\n", di->name);
+		if ((fd = open(di->name, O_WRONLY | O_NOCTTY | O_NONBLOCK)) == -1) {
+			logmsg("%s: unable to open for writing: %s\n", di->name, strerror(errno));
+			return DEVINIT_FAIL;
+		}
+		if (ma_setbaud(fd) != 0) {
+			logmsg("%s: unable to set baud rate\n", di->name);
+			close(fd);
+			return DEVINIT_FAIL;
+		}
+		if (write(fd, "#FF\n", 4) != 4) {
+			logmsg("%s: unable to write reset string: %s\n", di->name, strerror(errno));
+			close(fd);
+			return DEVINIT_FAIL;
+		}
 		close(fd);
-		return -1;
+		/*
+		 * the reset will drop it off the bus for a bit; wait up to 10s for it
+		 * to come back, though something is screwy if it takes more than
+		 * three...
+		 */
+		di->state = MA_REOPEN;
+		di->tries = 0;
+		di->waitms = 1000;
+		return DEVINIT_MORE;
+
+	case MA_REOPEN:
+		if ((di->fd = open(di->name, O_RDWR | O_NOCTTY | O_NONBLOCK)) == -1) {
+			if (++di->tries < MA_REOPENTRIES)
+				return DEVINIT_MORE;
+			logmsg("%s: failed to re-open device after reset: %s\n", di->name, strerror(errno));
+			return DEVINIT_FAIL;
+		}
+		if (ma_setbaud(di->fd) != 0) {
+			logmsg("%s: unable to set baud rate\n", di->name);
+			return DEVINIT_FAIL;
+		}
+		/* fetch the version string, just to make sure we haven't gone off the deep end. */
+		snprintf(cmd, sizeof(cmd), "#%02X\n", MADSB_CMD_READ_VERSION);
+		if (ma_command(di, cmd) == -1)
+			return DEVINIT_FAIL;
+		di->state = MA_VERSION;
+		return DEVINIT_MORE;
+
+	case MA_VERSION:
+		if (!line || (line[0] != '#'))
+			return ma_junk(di, line);
+		if ((strncmp(line, MADSB_KNOWNVERSION5, strlen(MADSB_KNOWNVERSION5)) != 0) &&
+		    (strncmp(line, MADSB_KNOWNVERSION6, strlen(MADSB_KNOWNVERSION6)) != 0) &&
+		    (strncmp(line, MADSB_KNOWNVERSION8, strlen(MADSB_KNOWNVERSION8)) != 0)) {
+			logmsg("%s: unknown version string: %s\n", di->name, line);
+			return DEVINIT_FAIL;
+		}
+		logmsg("%s: device version: %s\n", di->name, line);
+
+		/* set output mode */
+		snprintf(cmd, sizeof(cmd), "#%02X-%02X\n", MADSB_CMD_SET_MODE,
+		    di->mode ? di->mode : (MADSB_MODE_ALL | MADSB_MODE_TIMECODE | MADSB_MODE_FRAMENUMBER));
+		if (ma_command(di, cmd) == -1)
+			return DEVINIT_FAIL;
+		di->state = MA_MODE;
+		return DEVINIT_MORE;
+
+	case MA_MODE:
+		if (!line || (line[0] != '#'))
+			return ma_junk(di, line);
+		if (strncmp(line, "#43", strlen("#43")) != 0) {
+			logmsg("%s: invalid response to SET_MODE string: %s\n", di->name, line);
+			return DEVINIT_FAIL;
+		}
+		return DEVINIT_DONE;
 	}
+	return DEVINIT_FAIL;
+}
 
-	return fd;
+/* bring the device up, waiting for it; returns the fd */
+int
+ma_init(const char *devname, int bits)
+{
+	struct devinit di;
+
+	memset(&di, 0, sizeof(di));
+	di.name = devname;
+	di.step = ma_initstep;
+	di.mode = bits;
+	return dev_initrun(&di);
 }
 
+/* as it is; see ma_initstep() for putting it in TC+FC mode */
 int
-ma_open(const char *devname, int init)
+ma_open(const char *devname)
 {
 	int fd;
 
-	if (init) {
-		return ma_init(devname,
-				MADSB_MODE_ALL|
-				MADSB_MODE_TIMECODE|
-				MADSB_MODE_FRAMENUMBER);
-	}
-
 	if ((fd = open(devname, O_RDONLY | O_NOCTTY | O_NDELAY)) == -1) {
 		fprintf(stderr, "unable to open %s for reading: %s\n", devname, strerror(errno));
 		return -1;
@@ -175,51 +205,38 @@ ma_open(const char *devname, int init)
 	return fd;
 }
 
-/* read until just after the next ";\r\n" (ie, the next byte should be @) */
+/*
+ * consume up to just after the next ";\n\r" (ie, the next byte should be @).
+ * returns 0 once there, else what rbuf_fill() said.
+ */
 static int
-resync(int fd)
+resync(struct rbuf *rb, struct frame *frame)
 {
-	int i = 0;
 	for (;;) {
-		unsigned char c;
-		if (readn(fd, &c, 1) != 1)
-			return -1;
-		i++;
-		if (c != ';')
-			continue;
-		/* note that ';' also occurs between the squitter and the frame number! */
+		unsigned char *buf = rbuf_data(rb);
+		unsigned char *cp = buf;
+		int len = rbuf_len(rb);
+		int r;
 
-		unsigned char b[2];
-		if (readn(fd, b, 2) != 2)
-			return -1;
-		i += 2;
-		/* again, note the backwards terminator... */
-		if ((b[0] == '\n') && (b[1] == '\r'))
-			break;
+		/* note that ';' also occurs between the squitter and the frame number! */
+		while ((len - (cp - buf)) >= 3 &&
+		    (cp = memchr(cp, ';', len - (cp - buf) - 2))) {
+			/* again, note the backwards terminator... */
+			if ((cp[1] == '\n') && (cp[2] == '\r')) {
+				rbuf_consume(rb, cp + 3 - buf);
+				frame->skipped += cp + 3 - buf;
+				return 0;
+			}
+			cp++;
+		}
+		/* keep a possible partial terminator for next time */
+		if (len > 2) {
+			rbuf_consume(rb, len - 2);
+			frame->skipped += len - 2;
+		}
+		if ((r = rbuf_fill(rb)) <= 0)
+			return r;
 	}
-	return i;
-}
-
-static unsigned long long
-extractTC(const char *buf)
-{
-	char tcstr[12 + 1];
-	memcpy(tcstr, buf, 12);
-	tcstr[12] = '\0';
-	unsigned long long tc = 0;
-	sscanf(tcstr, "%llX", &tc);
-	return tc;
-}
-
-static unsigned long
-extractFC(const char *buf)
-{
-	char fcstr[8 + 1];
-	memcpy(fcstr, buf, 8);
-	fcstr[8] = '\0';
-	unsigned long fc = 0;
-	sscanf(fcstr, "%lX", &fc);
-	return fc;
 }
 
 #define TC_LEN 12
@@ -235,52 +252,83 @@ extractFC(const char *buf)
  *
  * Note that the line terminator is \n\r (0x0a, 0x0d), not the rather
  * more common \r\n!
+ *
+ * Returns 1 for a frame, 0 if bytes were skipped, RBUF_AGAIN if there's
+ * not a whole frame buffered yet (non-blocking only), -1 on error.
  */
 int
-ma_read(int fd, struct frame *frame, int timeout)
+ma_read(struct rbuf *rb, struct frame *frame)
 {
-	char buf[ES_LEN_TOTAL + 1];
+	char *buf;
 	int len = SQ_LEN_TOTAL;
 	int n;
 
 	gettimeofday(&frame->rxstart, NULL);
 
-	alarm(timeout);
-	n = readn(fd, (unsigned char *)buf, len);
-	if (n == -1) {
-		logmsg("timeout\n");
-		return -1;
-	} else if (n < len) {
-		logmsg("EOF\n");
-		return -1;
-	}
+	/* reading is rbufdev_read()'s, and it says which device hit EOF or an error */
+	if ((n = rbuf_need(rb, len)) != 1)
+		return (n == RBUF_AGAIN) ? RBUF_AGAIN : -1;
 	gettimeofday(&frame->rxend, NULL);
-	alarm(0);
-	buf[len] = '\0';
+	buf = (char *)rbuf_data(rb);
 	if (buf[0] != '@') {
-		int n = resync(fd);
-		if (n == -1)
+		n = resync(rb, frame);
+		if (n == RBUF_AGAIN)
+			return RBUF_AGAIN;
+		if (n != 0)
 			return -1;
-		frame->skipped += n;
 		return 0;
 	}
-	if (buf[SQ_LEN_TOTAL - 1] != '\r') {
+	/*
+	 * the run of hex after the @ is the timecode and the squitter, and
+	 * it has to end at the ';' before the frame number; if it runs on
+	 * past a short one, it had better be a long one.
+	 */
+	n = hex_span(buf + 1, len - 1);
+	if (n == len - 1) {
 		len = ES_LEN_TOTAL;
-		if (readn(fd, (unsigned char *)(buf + SQ_LEN_TOTAL), len - SQ_LEN_TOTAL) < (len - SQ_LEN_TOTAL))
-			return -1;
-		buf[len] = '\0';
+		if ((n = rbuf_need(rb, len)) != 1)
+			return (n == RBUF_AGAIN) ? RBUF_AGAIN : -1;
+		buf = (char *)rbuf_data(rb);
 		gettimeofday(&frame->rxend, NULL);
+		n = hex_span(buf + 1, len - 1);
+	}
+	if ((n != TC_LEN + ((len == SQ_LEN_TOTAL) ? SQ_LEN : ES_LEN)) ||
+	    (buf[1 + n] != ';') || (buf[2 + n] != '#') ||
+	    (hex_span(buf + 3 + n, FC_LEN) != FC_LEN) ||
+	    (buf[len - 3] != ';') || (buf[len - 2] != '\n') || (buf[len - 1] != '\r')) {
+		/* drop the '@'; resync will take care of the rest next time */
+		rbuf_consume(rb, 1);
+		frame->skipped++;
+		return 0;
 	}
-	if ( (buf[len - 2] != '\n') || (buf[len - 1] != '\r') )
-		return 0; /* it'll start resync when called again */
-	buf[len - 2] = '\0'; len -= 2;
 
-	frame->ticks = extractTC(buf + 1);
-	frame->seqnum = extractFC(buf + len - FC_LEN - 1);
-	memcpy(frame->data, buf + 1 + TC_LEN, len - TC_LEN - 1 - 2 - FC_LEN - 1);
-	frame->data[len - TC_LEN - 1 - 2 - FC_LEN - 1] = '\0';
-	/* XXX correct time vs PIC clock */
+	/* all checked above, so these can't fail */
+	frame->len = (n - TC_LEN) / 2;
+	hex_decode(frame->data, buf + 1 + TC_LEN, frame->len);
+	frame->df = MODES_DF(frame->data[0]);
+	hex_value(buf + 1, TC_LEN, &frame->ticks);
+	hex_value(buf + len - 3 - FC_LEN, FC_LEN, &frame->seqnum);
+	rbuf_consume(rb, len);
+	/* rxstart is when we got to it; devclock.c corrects it from the ticks */
 	return 1;
 }
 
+/* the other way: what the device would send for f, in TC+FC mode. returns the length */
+int
+ma_encode(char *dst, const struct frame *f)
+{
+	static const char digits[] = "0123456789ABCDEF";
+	char *p = dst;
+	int i;
 
+	*p++ = '@';
+	for (i = TC_LEN - 1; i >= 0; i--)
+		*p++ = digits[(f->ticks >> (4 * i)) & 0xf];
+	p += hexencode(p, f->data, f->len);
+	*p++ = ';';
+	*p++ = '#';
+	for (i = FC_LEN - 1; i >= 0; i--)
+		*p++ = digits[(f->seqnum >> (4 * i)) & 0xf];
+	memcpy(p, ";\n\r", 3);
+	return p + 3 - dst;
+}
@@ -2,6 +2,8 @@
 #define __MODES_MICROADSB_H__
 
 #include "frame.h"
+#include "rbuf.h"
+#include "device.h"
 
 /* for the microADS-B v1 device with SPRUT firmware 5 */
 #define MADSB_KNOWNVERSION5 "#00-00-05-04"
@@ -20,8 +22,17 @@
 #define MADSB_MODE_TIMECODE      0x10
 #define MADSB_MODE_FRAMENUMBER   0x20
 
+/* the timecode counts the PIC's instruction clock, 48MHz/4 */
+#define MADSB_TICKHZ 12000000
+/* and the frame number is 8 hex digits */
+#define MADSB_SEQBITS 32
+/* the longest line, for ma_encode() */
+#define MADSB_LINE_MAX 54
+
 extern int ma_init(const char *devname, int bits);
-extern int ma_open(const char *devname, int init);
-extern int ma_read(int fd, struct frame *frame, int timeout);
+extern int ma_open(const char *devname);
+extern int ma_initstep(struct devinit *di, const char *line);
+extern int ma_read(struct rbuf *rb, struct frame *frame);
+extern int ma_encode(char *dst, const struct frame *f);
 
 #endif
@@ -0,0 +1,369 @@
+/*
+ * Mode-S downlink format decoding
+ *
+ * References are to ICAO Annex 10 Vol IV and DO-260B.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "frame.h"
+#include "crc.h"
+#include "modes.h"
+
+/*
+ * 13 bit ID/AC field (C1 A1 C2 A2 C4 A4 X B1 D1 B2 D2 B4 D4) to Mode A
+ * digits, one octal digit per nibble: 0xABCD.
+ */
+unsigned int
+modes_id13(unsigned int id13)
+{
+	unsigned int a = 0;
+
+	if (id13 & 0x1000) a |= 0x0010; /* C1 */
+	if (id13 & 0x0800) a |= 0x1000; /* A1 */
+	if (id13 & 0x0400) a |= 0x0020; /* C2 */
+	if (id13 & 0x0200) a |= 0x2000; /* A2 */
+	if (id13 & 0x0100) a |= 0x0040; /* C4 */
+	if (id13 & 0x0080) a |= 0x4000; /* A4 */
+	if (id13 & 0x0020) a |= 0x0100; /* B1 */
+	if (id13 & 0x0010) a |= 0x0001; /* D1 */
+	if (id13 & 0x0008) a |= 0x0200; /* B2 */
+	if (id13 & 0x0004) a |= 0x0002; /* D2 */
+	if (id13 & 0x0002) a |= 0x0400; /* B4 */
+	if (id13 & 0x0001) a |= 0x0004; /* D4 */
+	return a;
+}
+
+/*
+ * Gillham (Mode C) code, as Mode A digits, to altitude. returns 0 and sets
+ * *alt in feet, or -1 if it isn't a valid altitude code.
+ */
+int
+modes_gillham(unsigned int modea, int *alt)
+{
+	int hundreds = 0, fivehundreds = 0;
+
+	/* D1 is never used, and one of the C bits has to be set */
+	if ((modea & 0xffff8889) || !(modea & 0x00f0))
+		return -1;
+
+	/* C1 C2 C4: hundreds, in a 1-2-4 Gray code that skips 0 and 6 */
+	if (modea & 0x0010) hundreds ^= 0x007;
+	if (modea & 0x0020) hundreds ^= 0x003;
+	if (modea & 0x0040) hundreds ^= 0x001;
+	if ((hundreds & 5) == 5)
+		hundreds ^= 2; /* 7 <-> 5 */
+	if (hundreds > 5)
+		return -1;
+
+	/* D2 D4 A1 A2 A4 B1 B2 B4: five hundreds, Gray code */
+	if (modea & 0x0002) fivehundreds ^= 0x0ff;
+	if (modea & 0x0004) fivehundreds ^= 0x07f;
+	if (modea & 0x1000) fivehundreds ^= 0x03f;
+	if (modea & 0x2000) fivehundreds ^= 0x01f;
+	if (modea & 0x4000) fivehundreds ^= 0x00f;
+	if (modea & 0x0100) fivehundreds ^= 0x007;
+	if (modea & 0x0200) fivehundreds ^= 0x003;
+	if (modea & 0x0400) fivehundreds ^= 0x001;
+
+	/* hundreds run backwards in odd five hundreds */
+	if (fivehundreds & 1)
+		hundreds = 6 - hundreds;
+
+	*alt = ((fivehundreds * 5) + hundreds - 13) * 100;
+	return 0;
+}
+
+/* 3.1.2.6.5.4: 13 bit AC field. returns 0 and sets *alt, or -1 */
+int
+modes_ac13(unsigned int ac13, int *alt)
+{
+	if (ac13 == 0)
+		return -1; /* not available */
+	if (ac13 & 0x0040)
+		return -1; /* M bit: metric. XXX nobody seems to send these */
+	if (ac13 & 0x0010) { /* Q bit: 25ft increments, M and Q removed */
+		int n = ((ac13 & 0x1f80) >> 2) | ((ac13 & 0x0020) >> 1) | (ac13 & 0x000f);
+		*alt = (n * 25) - 1000;
+		return 0;
+	}
+	return modes_gillham(modes_id13(ac13), alt);
+}
+
+/* 12 bit extended squitter altitude: AC13 without the M bit */
+int
+modes_ac12(unsigned int ac12, int *alt)
+{
+	if (ac12 == 0)
+		return -1;
+	if (ac12 & 0x0010) {
+		int n = ((ac12 & 0x0fe0) >> 1) | (ac12 & 0x000f);
+		*alt = (n * 25) - 1000;
+		return 0;
+	}
+	return modes_gillham(modes_id13(((ac12 & 0x0fc0) << 1) | (ac12 & 0x003f)), alt);
+}
+
+/* surface movement field to knots */
+static int
+modes_movement(int mov)
+{
+	if (mov <= 8)
+		return 0; /* no information, stopped, or < 1kt */
+	if (mov <= 12)
+		return 1;
+	if (mov <= 38)
+		return 2 + (mov - 13) / 2;
+	if (mov <= 93)
+		return 15 + (mov - 39);
+	if (mov <= 108)
+		return 70 + (mov - 94) * 2;
+	if (mov <= 123)
+		return 100 + (mov - 109) * 5;
+	return 175;
+}
+
+static const char identchars[64] =
+    "#ABCDEFGHIJKLMNOPQRSTUVWXYZ##### ###############0123456789######";
+
+static void
+modes_decodeme(struct modes_msg *mm, const unsigned char *me)
+{
+	int tc = me[0] >> 3;
+	int st = me[0] & 7;
+
+	mm->metype = tc;
+	mm->mesub = st;
+	mm->flags |= MODES_HAS_ME;
+
+	if ((tc >= 1) && (tc <= 4)) { /* identification and category */
+		const unsigned char *p = me + 1;
+		int i;
+
+		mm->category = ((0xe - tc) << 4) | st; /* A0..D7 as 0xA0..0xD7 */
+		for (i = 0; i < 8; i += 4, p += 3) {
+			mm->ident[i + 0] = identchars[p[0] >> 2];
+			mm->ident[i + 1] = identchars[((p[0] & 0x3) << 4) | (p[1] >> 4)];
+			mm->ident[i + 2] = identchars[((p[1] & 0xf) << 2) | (p[2] >> 6)];
+			mm->ident[i + 3] = identchars[p[2] & 0x3f];
+		}
+		mm->ident[8] = '\0';
+		mm->flags |= MODES_HAS_IDENT;
+
+	} else if ((tc >= 5) && (tc <= 8)) { /* surface position */
+		int mov = ((me[0] & 0x7) << 4) | (me[1] >> 4);
+
+		mm->flags |= MODES_SURFACE | MODES_HAS_POS;
+		if ((mov > 0) && (mov < 125)) {
+			mm->speed = modes_movement(mov);
+			mm->flags |= MODES_HAS_VEL;
+		}
+		if (me[1] & 0x08) { /* track valid */
+			mm->track = ((((me[1] & 0x7) << 4) | (me[2] >> 4)) * 3600) / 128;
+			mm->flags |= MODES_HAS_HEADING;
+		}
+		mm->cprodd = (me[2] >> 2) & 1;
+		mm->cprlat = ((me[2] & 0x3) << 15) | (me[3] << 7) | (me[4] >> 1);
+		mm->cprlon = ((me[4] & 0x1) << 16) | (me[5] << 8) | me[6];
+
+	} else if (((tc >= 9) && (tc <= 18)) || ((tc >= 20) && (tc <= 22))) {
+		/* airborne position, baro (9-18) or GNSS (20-22) altitude */
+		unsigned int ac12 = (me[1] << 4) | (me[2] >> 4);
+
+		if (modes_ac12(ac12, &mm->altitude) == 0)
+			mm->flags |= MODES_HAS_ALT;
+		if (tc >= 20)
+			mm->flags |= MODES_ALT_GNSS;
+		mm->cprodd = (me[2] >> 2) & 1;
+		mm->cprlat = ((me[2] & 0x3) << 15) | (me[3] << 7) | (me[4] >> 1);
+		mm->cprlon = ((me[4] & 0x1) << 16) | (me[5] << 8) | me[6];
+		if (mm->cprlat || mm->cprlon)
+			mm->flags |= MODES_HAS_POS;
+
+	} else if (tc == 19) { /* airborne velocity */
+		int scale = ((st == 2) || (st == 4)) ? 4 : 1; /* supersonic */
+		int vr = ((me[4] & 0x7) << 6) | (me[5] >> 2);
+
+		if ((st == 1) || (st == 2)) {
+			int ew = ((me[1] & 0x3) << 8) | me[2];
+			int ns = ((me[3] & 0x7f) << 3) | (me[4] >> 5);
+
+			if (ew && ns) {
+				ew = (ew - 1) * scale;
+				ns = (ns - 1) * scale;
+				if (me[1] & 0x04) ew = -ew;
+				if (me[3] & 0x80) ns = -ns;
+				mm->speed = (int)(sqrt(ew * ew + ns * ns) + 0.5);
+				mm->track = (int)(atan2(ew, ns) * 1800.0 / M_PI + 0.5);
+				if (mm->track < 0)
+					mm->track += 3600;
+				mm->flags |= MODES_HAS_VEL | MODES_HAS_HEADING;
+			}
+		} else if ((st == 3) || (st == 4)) {
+			int as = ((me[3] & 0x7f) << 3) | (me[4] >> 5);
+
+			if (me[1] & 0x04) { /* heading available */
+				mm->track = ((((me[1] & 0x3) << 8) | me[2]) * 3600) / 1024;
+				mm->flags |= MODES_HAS_HEADING;
+			}
+			if (as) {
+				mm->speed = (as - 1) * scale;
+				mm->tas = (me[3] >> 7) & 1;
+				mm->flags |= MODES_HAS_AIRSPEED;
+			}
+		}
+		if (vr) {
+			mm->vrate = (vr - 1) * 64;
+			if (me[4] & 0x08)
+				mm->vrate = -mm->vrate;
+			mm->flags |= MODES_HAS_VRATE;
+		}
+
+	} else if ((tc == 28) && (st == 1)) { /* emergency/priority status */
+		mm->squawk = modes_id13(((me[1] & 0x1f) << 8) | me[2]);
+		mm->flags |= MODES_HAS_SQUAWK;
+	}
+	return;
+}
+
+/*
+ * Decode len (7 or 14) bytes of msg.  Returns 0, or -1 if the length
+ * doesn't match the DF.
+ */
+int
+modes_decode(struct modes_msg *mm, const unsigned char *msg, int len)
+{
+	unsigned int ac13;
+
+	mm->flags = 0;
+	mm->df = MODES_DF(msg[0]);
+	mm->len = len;
+	if (len != MODES_DFLEN(mm->df))
+		return -1;
+	mm->syndrome = modes_syndrome(msg, len);
+	ac13 = ((msg[2] & 0x1f) << 8) | msg[3]; /* also ID13 */
+
+	switch (mm->df) {
+	case 0: /* short air-air surveillance */
+	case 16: /* long air-air surveillance */
+		mm->vs = (msg[0] >> 2) & 1;
+		mm->ri = ((msg[1] & 0x7) << 1) | (msg[2] >> 7);
+		mm->flags |= MODES_HAS_VS;
+		if (mm->vs)
+			mm->flags |= MODES_SURFACE;
+		if (modes_ac13(ac13, &mm->altitude) == 0)
+			mm->flags |= MODES_HAS_ALT;
+		if (mm->df == 16) {
+			memcpy(mm->mb, msg + 4, 7);
+			mm->flags |= MODES_HAS_MB;
+		}
+		mm->aa = mm->syndrome;
+		mm->flags |= MODES_HAS_AA;
+		break;
+
+	case 4: /* surveillance, altitude reply */
+	case 5: /* surveillance, identity reply */
+	case 20: /* Comm-B, altitude reply */
+	case 21: /* Comm-B, identity reply */
+		mm->fs = msg[0] & 0x7;
+		mm->dr = msg[1] >> 3;
+		mm->um = ((msg[1] & 0x7) << 3) | (msg[2] >> 5);
+		mm->flags |= MODES_HAS_FS;
+		if ((mm->fs == 1) || (mm->fs == 3))
+			mm->flags |= MODES_SURFACE;
+		if ((mm->df == 4) || (mm->df == 20)) {
+			if (modes_ac13(ac13, &mm->altitude) == 0)
+				mm->flags |= MODES_HAS_ALT;
+		} else {
+			mm->squawk = modes_id13(ac13);
+			mm->flags |= MODES_HAS_SQUAWK;
+		}
+		if (mm->df >= 20) {
+			memcpy(mm->mb, msg + 4, 7);
+			mm->flags |= MODES_HAS_MB;
+		}
+		mm->aa = mm->syndrome;
+		mm->flags |= MODES_HAS_AA;
+		break;
+
+	case 11: /* all-call reply */
+		mm->ca = msg[0] & 0x7;
+		mm->aa = (msg[1] << 16) | (msg[2] << 8) | msg[3];
+		mm->flags |= MODES_HAS_AA;
+		if ((mm->syndrome & ~0x7f) == 0)
+			mm->flags |= MODES_CRC_OK;
+		if (mm->ca == 4)
+			mm->flags |= MODES_SURFACE;
+		break;
+
+	case 17: /* extended squitter */
+	case 18: /* extended squitter, non-transponder */
+		mm->ca = msg[0] & 0x7;
+		mm->aa = (msg[1] << 16) | (msg[2] << 8) | msg[3];
+		mm->flags |= MODES_HAS_AA;
+		if (mm->syndrome == 0)
+			mm->flags |= MODES_CRC_OK;
+		memcpy(mm->mb, msg + 4, 7);
+		/* DF18 CF 0/1 carry ordinary ES; the rest are TIS-B/ADS-R flavors */
+		if ((mm->df == 17) || (mm->ca <= 1))
+			modes_decodeme(mm, msg + 4);
+		break;
+
+	default:
+		break;
+	}
+	return 0;
+}
+
+static const char *fsnames[8] = {
+	"airborne", "ground", "alert,airborne", "alert,ground",
+	"alert,SPI", "SPI", "reserved", "unassigned"
+};
+
+/* one line, no newline. returns length like snprintf */
+int
+modes_sprint(char *buf, int buflen, const struct modes_msg *mm)
+{
+	int n = 0;
+
+#define P(...) do { \
+	n += snprintf(buf + n, (n < buflen) ? (buflen - n) : 0, __VA_ARGS__); \
+} while (0)
+
+	P("DF%d", mm->df);
+	if (mm->flags & MODES_HAS_AA)
+		P(" aa=%06X", mm->aa);
+	if ((mm->df == 11) || (mm->df == 17) || (mm->df == 18))
+		P(" crc=%s", (mm->flags & MODES_CRC_OK) ? "ok" : "bad");
+	if (mm->flags & MODES_HAS_FS)
+		P(" fs=%s", fsnames[mm->fs]);
+	if (mm->flags & MODES_HAS_VS)
+		P(" vs=%s", mm->vs ? "ground" : "airborne");
+	if (mm->flags & MODES_HAS_ME)
+		P(" me=%d.%d", mm->metype, mm->mesub);
+	if (mm->flags & MODES_HAS_IDENT)
+		P(" ident=%s cat=%02X", mm->ident, mm->category);
+	if (mm->flags & MODES_HAS_SQUAWK)
+		P(" squawk=%04X", mm->squawk);
+	if (mm->flags & MODES_HAS_ALT)
+		P(" alt=%d%s", mm->altitude, (mm->flags & MODES_ALT_GNSS) ? "gnss" : "");
+	if (mm->flags & MODES_HAS_POS)
+		P(" %s cpr=%s,%u,%u", (mm->flags & MODES_SURFACE) ? "surface" : "airborne",
+		    mm->cprodd ? "odd" : "even", mm->cprlat, mm->cprlon);
+	if (mm->flags & MODES_HAS_VEL)
+		P(" gs=%d", mm->speed);
+	if (mm->flags & MODES_HAS_AIRSPEED)
+		P(" %s=%d", mm->tas ? "tas" : "ias", mm->speed);
+	if (mm->flags & MODES_HAS_HEADING)
+		P(" %s=%d.%d", (mm->flags & MODES_HAS_VEL) ? "trk" : "hdg",
+		    mm->track / 10, mm->track % 10);
+	if (mm->flags & MODES_HAS_VRATE)
+		P(" vr=%d", mm->vrate);
+	if (mm->flags & MODES_HAS_MB)
+		P(" mb=%02X%02X%02X%02X%02X%02X%02X", mm->mb[0], mm->mb[1],
+		    mm->mb[2], mm->mb[3], mm->mb[4], mm->mb[5], mm->mb[6]);
+#undef P
+	return n;
+}
@@ -0,0 +1,72 @@
+
+#ifndef __MODES_MODES_H__
+#define __MODES_MODES_H__
+
+/*
+ * Mode-S downlink decoding.  Fills a fixed struct, no allocation; fields
+ * are only meaningful if the matching MODES_HAS_* flag is set.
+ */
+
+/* flags */
+#define MODES_HAS_AA 0x0001 /* aa valid (for AP formats, recovered from parity) */
+#define MODES_HAS_ALT 0x0002
+#define MODES_HAS_SQUAWK 0x0004
+#define MODES_HAS_IDENT 0x0008 /* callsign */
+#define MODES_HAS_POS 0x0010 /* raw CPR lat/lon */
+#define MODES_HAS_VEL 0x0020 /* ground speed/track */
+#define MODES_HAS_AIRSPEED 0x0040 /* airspeed/heading */
+#define MODES_HAS_VRATE 0x0080
+#define MODES_HAS_FS 0x0100 /* flight status */
+#define MODES_HAS_VS 0x0200 /* vertical status */
+#define MODES_HAS_MB 0x0400 /* Comm-B MB / DF16 MV field */
+#define MODES_HAS_ME 0x0800 /* extended squitter ME field */
+#define MODES_CRC_OK 0x1000 /* parity checked out (DF11/17/18 only) */
+#define MODES_ALT_GNSS 0x2000 /* altitude is GNSS height, not baro */
+#define MODES_SURFACE 0x4000 /* on the ground */
+#define MODES_HAS_HEADING 0x8000
+
+/* fs */
+#define MODES_FS_ALERT 0x2
+#define MODES_FS_SPI 0x4
+
+struct modes_msg {
+	unsigned int flags;
+	unsigned char df;
+	unsigned char len; /* bytes */
+	unsigned int aa; /* ICAO address */
+	unsigned int syndrome; /* CRC of data XOR AP/PI */
+
+	unsigned char ca; /* capability (DF11/17) or CF (DF18) */
+	unsigned char fs; /* flight status (DF4/5/20/21) */
+	unsigned char vs; /* vertical status (DF0/16), 1 = ground */
+	unsigned char ri; /* reply information (DF0/16) */
+	unsigned char dr; /* downlink request (DF4/5/20/21) */
+	unsigned char um; /* utility message (DF4/5/20/21) */
+
+	int altitude; /* feet */
+	unsigned short squawk; /* octal digits as hex, 0x7700 is 7700 */
+
+	/* extended squitter */
+	unsigned char metype; /* ME type code */
+	unsigned char mesub; /* ME subtype */
+	unsigned char category; /* emitter category (ident) */
+	char ident[9]; /* callsign, space padded, NUL terminated */
+	unsigned char cprodd; /* F bit */
+	unsigned int cprlat; /* 17 bit */
+	unsigned int cprlon; /* 17 bit */
+	int speed; /* knots; ground speed, or airspeed */
+	int track; /* tenths of a degree; track, or heading */
+	int vrate; /* ft/min */
+	unsigned char tas; /* airspeed is TAS not IAS */
+
+	unsigned char mb[7]; /* DF16 MV, DF20/21 MB, DF17/18 ME */
+};
+
+extern int modes_decode(struct modes_msg *mm, const unsigned char *msg, int len);
+extern unsigned int modes_id13(unsigned int id13);
+extern int modes_gillham(unsigned int modea, int *alt);
+extern int modes_ac13(unsigned int ac13, int *alt);
+extern int modes_ac12(unsigned int ac12, int *alt);
+extern int modes_sprint(char *buf, int buflen, const struct modes_msg *mm);
+
+#endif /* ndef __MODES_MODES_H__ */
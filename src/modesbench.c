@@ -0,0 +1,718 @@
+/*
+ * Benchmarks for each stage a frame goes through in modesd, fed from a
+ * timestamped AVR log (samples/adsblog.*) or, with -r, synthetic traffic:
+ *
+ *	sprut		the microadsb driver framing a SPRUT TC+FC stream from a pty
+ *	aurora		the aurora driver parsing an Aurora RAW stream from a pty
+ *	avr		avr_parse() of log lines
+ *	crc		modes_checkframe(), fixing single bit errors
+ *	decode		modes_decode()
+ *	avrout		formatting the AVR line modesd -v prints
+ *	beast		beast_encode()
+ *	udp		udp_send() to a local socket, a datagram per frame
+ *	udpbatch	the same, UDP_BENCHBATCH frames per sendmmsg()
+ *	pipeline	crc, decode and udpbatch, the way the output thread does them
+ *
+ * Each stage prints one line of key=value pairs, so runs can be kept and
+ * compared between releases ("make bench" writes them to bench.out).
+ * ns/frame comes from an untimed pass; the latency percentiles from a
+ * second pass that times every frame, less what reading the clock costs.
+ * For the pty stages that's how long the dev_read() that returned each
+ * frame took, its read() included.
+ */
+
+#define _GNU_SOURCE /* posix_openpt(), cfmakeraw() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <termios.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "util.h"
+#include "hex.h"
+#include "rbuf.h"
+#include "frame.h"
+#include "hist.h"
+#include "crc.h"
+#include "modes.h"
+#include "avr.h"
+#include "beast.h"
+#include "udp.h"
+#include "microadsb.h"
+#include "aurora.h"
+#include "device.h"
+#include "traffic.h"
+
+#define UDP_BENCHBATCH 64
+
+static void
+usage(const char *arg0)
+{
+	printf("\n");
+	printf("%s [-n passes] [-x kernel] [-s stage[,stage...]] logfile | -r frames\n", arg0);
+	printf("\n");
+	printf("\t-n passes\t\tgo through the frames this many times (default 1)\n");
+	printf("\t-x kernel\t\thex kernel: avx2, sse2 or scalar (default best available)\n");
+	printf("\t-s stages\t\tonly run these (sprut, aurora, avr, crc, decode, avrout, beast, udp, udpbatch, pipeline)\n");
+	printf("\t-r frames\t\tuse this many frames of synthetic traffic instead of a log\n");
+	printf("\n");
+	exit(2);
+}
+
+struct bench {
+	struct frame *frames;
+	long nframes;
+	char **lines; /* the log lines frames came from, for avr */
+	int passes;
+	struct hist lat; /* ns, timed pass only */
+	unsigned long long elapsed; /* ns, if the stage had setup not to count */
+	unsigned long syscalls;
+	unsigned long received; /* by the UDP sink */
+};
+
+struct stage {
+	const char *name;
+	/* go through everything once; returns frames done */
+	long (*run)(struct bench *b, int timed);
+};
+
+static unsigned long long clockcost; /* ns it takes to read the clock */
+
+static inline unsigned long long
+nsnow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline void
+addlat(struct bench *b, unsigned long long start)
+{
+	unsigned long long d = nsnow() - start;
+
+	hist_add(&b->lat, (d > clockcost) ? (d - clockcost) : 0);
+	return;
+}
+
+static void
+calibrate(void)
+{
+	unsigned long long t, d, min = ~0ULL;
+	int i;
+
+	for (i = 0; i < 10000; i++) {
+		t = nsnow();
+		if ((d = nsnow() - t) < min)
+			min = d;
+	}
+	clockcost = min;
+	return;
+}
+
+static int
+gotframe(struct bench *b, const struct frame *f, const char *line, int *sizep)
+{
+	if (b->nframes == *sizep) {
+		*sizep = *sizep ? (*sizep * 2) : 65536;
+		if (!(b->frames = realloc(b->frames, *sizep * sizeof(struct frame))) ||
+		    !(b->lines = realloc(b->lines, *sizep * sizeof(char *))))
+			return -1;
+	}
+	b->frames[b->nframes] = *f;
+	if (!(b->lines[b->nframes++] = strdup(line)))
+		return -1;
+	return 0;
+}
+
+static int
+loadlog(struct bench *b, const char *fn)
+{
+	FILE *fp;
+	char line[256];
+	int size = 0;
+
+	if (!(fp = fopen(fn, "r"))) {
+		fprintf(stderr, "unable to open %s: %s\n", fn, strerror(errno));
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		struct frame f;
+
+		memset(&f, '\0', sizeof(f));
+		if ((avr_parse(line, strlen(line), &f) == -1) || !timerisset(&f.rxstart))
+			continue;
+		if (gotframe(b, &f, line, &size) == -1) {
+			fclose(fp);
+			return -1;
+		}
+	}
+	fclose(fp);
+	return 0;
+}
+
+/* a couple of hundred aircraft, as traffic.c makes them, 3% with a bit flipped */
+static int
+randframes(struct bench *b, long n)
+{
+	struct traffic *tr;
+	char line[64];
+	int size = 0, k;
+	long i;
+
+	if (!(tr = tr_new(200, 37.7749, -122.4194, 10, 0.03, 1)))
+		return -1;
+	for (i = 0; i < n; i++) {
+		struct frame f;
+
+		tr_next(tr, &f);
+		k = snprintf(line, sizeof(line), "%ld.%06ld *", f.rxstart.tv_sec, (long)f.rxstart.tv_usec);
+		k += hexencode(line + k, f.data, f.len);
+		strcpy(line + k, ";\n");
+		if (gotframe(b, &f, line, &size) == -1) {
+			tr_free(tr);
+			return -1;
+		}
+	}
+	tr_free(tr);
+	return 0;
+}
+
+/*
+ * Device streams, as the devices would have sent them
+ */
+
+static char *
+growstream(char *out, size_t len, size_t *sizep, size_t need)
+{
+	if ((*sizep - len) >= need)
+		return out;
+	*sizep = *sizep ? (*sizep * 2) : (1 << 20);
+	return realloc(out, *sizep);
+}
+
+/* SPRUT in TC+FC mode, with the timecode from the receive times */
+static char *
+mksprut(struct bench *b, size_t *lenp)
+{
+	char *out = NULL;
+	size_t len = 0, size = 0;
+	unsigned long long fc = 0;
+	long i;
+	int pass;
+
+	for (pass = 0; pass < b->passes; pass++) {
+		for (i = 0; i < b->nframes; i++) {
+			struct frame f = b->frames[i];
+
+			if (!(out = growstream(out, len, &size, MADSB_LINE_MAX)))
+				return NULL;
+			f.ticks = (unsigned long long)f.rxstart.tv_sec * MADSB_TICKHZ +
+			    (unsigned long long)f.rxstart.tv_usec * (MADSB_TICKHZ / 1000000);
+			f.seqnum = fc++;
+			len += ma_encode(out + len, &f);
+		}
+	}
+	*lenp = len;
+	return out;
+}
+
+/* Aurora RAW mode */
+static char *
+mkaurora(struct bench *b, size_t *lenp)
+{
+	char *out = NULL;
+	size_t len = 0, size = 0;
+	long i;
+	int pass;
+
+	for (pass = 0; pass < b->passes; pass++) {
+		for (i = 0; i < b->nframes; i++) {
+			if (!(out = growstream(out, len, &size, AURORA_FRAME_MAX)))
+				return NULL;
+			len += aurora_encode((unsigned char *)out + len, &b->frames[i]);
+		}
+	}
+	*lenp = len;
+	return out;
+}
+
+static int
+openpty_raw(int *slavep)
+{
+	struct termios tios;
+	int m, s;
+
+	if ((m = posix_openpt(O_RDWR | O_NOCTTY)) == -1 ||
+	    grantpt(m) == -1 ||
+	    unlockpt(m) == -1) {
+		fprintf(stderr, "unable to allocate pty: %s\n", strerror(errno));
+		return -1;
+	}
+	if ((s = open(ptsname(m), O_RDWR | O_NOCTTY)) == -1) {
+		fprintf(stderr, "unable to open %s: %s\n", ptsname(m), strerror(errno));
+		close(m);
+		return -1;
+	}
+	if (tcgetattr(s, &tios) == 0) {
+		cfmakeraw(&tios);
+		tcsetattr(s, TCSANOW, &tios);
+	}
+	*slavep = s;
+	return m;
+}
+
+/* feed stream through a pty from a child, and frame it with the driver, as modesd does */
+static long
+ptystage(struct bench *b, int timed, char *(*mkfn)(struct bench *, size_t *), const char *drvname)
+{
+	size_t len;
+	char *stream, *name;
+	long want = b->nframes * b->passes, got = 0;
+	unsigned long polls = 0;
+	struct devstats st;
+	struct dev *dev;
+	int mfd, sfd;
+	pid_t pid;
+
+	if (!(stream = mkfn(b, &len)))
+		return -1;
+	if ((mfd = openpty_raw(&sfd)) == -1) {
+		free(stream);
+		return -1;
+	}
+	if (!(name = strdup(ptsname(mfd))) || ((pid = fork()) == -1)) {
+		fprintf(stderr, "fork: %s\n", strerror(errno));
+		free(stream);
+		free(name);
+		return -1;
+	}
+	if (pid == 0) {
+		size_t off = 0;
+		close(sfd);
+		while (off < len) {
+			int w = write(mfd, stream + off, len - off);
+			if (w <= 0)
+				_exit(1);
+			off += w;
+		}
+		/* let the reader drain before we hang up */
+		tcdrain(mfd);
+		sleep(1);
+		_exit(0);
+	}
+	close(mfd);
+
+	memset(&st, 0, sizeof(st));
+	if (!(dev = dev_open(dev_find(drvname), name, 0, &st))) {
+		kill(pid, SIGTERM);
+		waitpid(pid, NULL, 0);
+		close(sfd);
+		free(stream);
+		free(name);
+		return -1;
+	}
+	b->elapsed = nsnow();
+	while (got < want) {
+		struct frame f[DEV_BATCH];
+		struct pollfd pfd;
+		unsigned long long t = timed ? nsnow() : 0, d;
+		int i, r;
+
+		if ((r = dev_read(dev, f, DEV_BATCH)) == -1)
+			break;
+		if (r == 0) {
+			pfd.fd = dev->fd;
+			pfd.events = POLLIN;
+			polls++;
+			if (poll(&pfd, 1, 5000) <= 0)
+				break;
+			continue;
+		}
+		got += r;
+		if (timed) {
+			d = nsnow() - t;
+			for (i = 0; i < r; i++)
+				hist_add(&b->lat, (d > clockcost) ? (d - clockcost) : 0);
+		}
+	}
+	b->elapsed = nsnow() - b->elapsed;
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+	dev_close(dev);
+	close(sfd);
+	free(stream);
+	free(name);
+	b->syscalls += st.reads + polls;
+	return got;
+}
+
+static long
+sprut(struct bench *b, int timed)
+{
+	return ptystage(b, timed, mksprut, "microadsb");
+}
+
+static long
+aurora(struct bench *b, int timed)
+{
+	return ptystage(b, timed, mkaurora, "aurora");
+}
+
+/*
+ * In memory stages
+ */
+
+/* for stages that'd otherwise be optimized into nothing */
+static volatile unsigned long sink;
+
+static long
+avr(struct bench *b, int timed)
+{
+	long i, n = 0;
+	int pass;
+
+	for (pass = 0; pass < b->passes; pass++) {
+		for (i = 0; i < b->nframes; i++) {
+			struct frame f;
+			unsigned long long t = timed ? nsnow() : 0;
+
+			memset(&f, '\0', sizeof(f));
+			if (avr_parse(b->lines[i], strlen(b->lines[i]), &f) != -1)
+				n++;
+			if (timed)
+				addlat(b, t);
+		}
+	}
+	return n;
+}
+
+static long
+crc(struct bench *b, int timed)
+{
+	long i, n = 0;
+	int pass;
+
+	for (pass = 0; pass < b->passes; pass++) {
+		for (i = 0; i < b->nframes; i++) {
+			struct frame f = b->frames[i];
+			unsigned long long t = timed ? nsnow() : 0;
+
+			sink += modes_checkframe(&f, 1);
+			if (timed)
+				addlat(b, t);
+			n++;
+		}
+	}
+	return n;
+}
+
+static long
+decode(struct bench *b, int timed)
+{
+	long i, n = 0;
+	int pass;
+
+	for (pass = 0; pass < b->passes; pass++) {
+		for (i = 0; i < b->nframes; i++) {
+			struct modes_msg mm;
+			unsigned long long t = timed ? nsnow() : 0;
+
+			sink += modes_decode(&mm, b->frames[i].data, b->frames[i].len);
+			if (timed)
+				addlat(b, t);
+			n++;
+		}
+	}
+	return n;
+}
+
+static long
+avrout(struct bench *b, int timed)
+{
+	long i, n = 0;
+	int pass;
+
+	for (pass = 0; pass < b->passes; pass++) {
+		for (i = 0; i < b->nframes; i++) {
+			const struct frame *f = &b->frames[i];
+			char hex[2*MODES_LONG_LEN + 1], buf[256];
+			unsigned long long t = timed ? nsnow() : 0;
+
+			hex[hexencode(hex, f->data, f->len)] = '\0';
+			sink += snprintf(buf, sizeof(buf), "%ld.%06ld *%s;\n",
+			    f->rxstart.tv_sec, (long)f->rxstart.tv_usec, hex);
+			if (timed)
+				addlat(b, t);
+			n++;
+		}
+	}
+	return n;
+}
+
+static long
+beast(struct bench *b, int timed)
+{
+	long i, n = 0;
+	int pass;
+
+	for (pass = 0; pass < b->passes; pass++) {
+		for (i = 0; i < b->nframes; i++) {
+			unsigned char buf[BEAST_MAX];
+			unsigned long long t = timed ? nsnow() : 0;
+
+			sink += beast_encode(buf, &b->frames[i]);
+			if (timed)
+				addlat(b, t);
+			n++;
+		}
+	}
+	return n;
+}
+
+/*
+ * UDP to a local sink, which counts what arrives so we know the sends
+ * weren't just dropped
+ */
+
+static int sinkfd = -1;
+static volatile int sinkstop = 0;
+static unsigned long sinkgot = 0; /* under the sink thread until joined */
+
+static void *
+udpsink(void *arg)
+{
+	char buf[65536];
+	int n;
+
+	while (!sinkstop) {
+		if ((n = recv(sinkfd, buf, sizeof(buf), 0)) > 0) {
+			char *cp;
+
+			/* a line per frame, however they were packed */
+			for (cp = buf; (cp = memchr(cp, ';', buf + n - cp)); cp++)
+				sinkgot++;
+		}
+	}
+	return NULL;
+}
+
+static long
+udpstage(struct bench *b, int timed, int batch, int full)
+{
+	struct sockaddr_in sin;
+	socklen_t sinlen = sizeof(sin);
+	struct timeval to = { 0, 100000 };
+	struct udp_stats us;
+	pthread_t thread;
+	long i, n = 0;
+	int pass, rcvbuf = 8 << 20;
+
+	if ((sinkfd = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
+		return -1;
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	setsockopt(sinkfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	setsockopt(sinkfd, SOL_SOCKET, SO_RCVTIMEO, &to, sizeof(to));
+	if ((bind(sinkfd, (struct sockaddr *)&sin, sizeof(sin)) == -1) ||
+	    (getsockname(sinkfd, (struct sockaddr *)&sin, &sinlen) == -1) ||
+	    (udp_addport("127.0.0.1", ntohs(sin.sin_port), UDP_RAW) == -1)) {
+		fprintf(stderr, "unable to set up UDP sink: %s\n", strerror(errno));
+		close(sinkfd);
+		return -1;
+	}
+	sinkstop = 0;
+	sinkgot = 0;
+	if (pthread_create(&thread, NULL, udpsink, NULL)) {
+		udp_clearports();
+		close(sinkfd);
+		return -1;
+	}
+	udp_setbatch(batch, 0, 0);
+	udp_getstats(&us, 1);
+
+	b->elapsed = nsnow();
+	for (pass = 0; pass < b->passes; pass++) {
+		for (i = 0; i < b->nframes; i++) {
+			struct frame f = b->frames[i];
+			unsigned long long t = timed ? nsnow() : 0;
+
+			if (full) {
+				struct modes_msg mm;
+
+				if (modes_checkframe(&f, 1) == CRC_BAD)
+					continue;
+				sink += modes_decode(&mm, f.data, f.len);
+			}
+			udp_send(&f);
+			if (timed)
+				addlat(b, t);
+			n++;
+		}
+	}
+	udp_flush();
+	b->elapsed = nsnow() - b->elapsed;
+	udp_getstats(&us, 1);
+	b->syscalls += us.syscalls;
+
+	/* give the sink a moment to catch up */
+	usleep(200000);
+	sinkstop = 1;
+	pthread_join(thread, NULL);
+	b->received += sinkgot;
+	udp_clearports();
+	close(sinkfd);
+	return n;
+}
+
+static long
+udp(struct bench *b, int timed)
+{
+	return udpstage(b, timed, 1, 0);
+}
+
+static long
+udpbatch(struct bench *b, int timed)
+{
+	return udpstage(b, timed, UDP_BENCHBATCH, 0);
+}
+
+static long
+pipeline(struct bench *b, int timed)
+{
+	return udpstage(b, timed, UDP_BENCHBATCH, 1);
+}
+
+static const struct stage stages[] = {
+	{ "sprut", sprut },
+	{ "aurora", aurora },
+	{ "avr", avr },
+	{ "crc", crc },
+	{ "decode", decode },
+	{ "avrout", avrout },
+	{ "beast", beast },
+	{ "udp", udp },
+	{ "udpbatch", udpbatch },
+	{ "pipeline", pipeline },
+};
+#define NSTAGES (sizeof(stages) / sizeof(stages[0]))
+
+static int
+runstage(struct bench *b, const struct stage *s)
+{
+	unsigned long long start, end;
+	unsigned long syscalls;
+	long n;
+
+	b->syscalls = b->received = 0;
+	b->elapsed = 0;
+	start = nsnow();
+	n = s->run(b, 0);
+	end = nsnow();
+	if (b->elapsed)
+		end = start + b->elapsed;
+	if (n <= 0) {
+		fprintf(stderr, "%s: failed\n", s->name);
+		return -1;
+	}
+	syscalls = b->syscalls;
+
+	hist_reset(&b->lat);
+	b->received = 0;
+	s->run(b, 1);
+
+	double secs = (end - start) / 1e9;
+	printf("stage=%s frames=%ld secs=%.3f frames_per_sec=%.0f ns_per_frame=%.1f "
+	    "syscalls_per_frame=%.4f p50_ns=%llu p99_ns=%llu p999_ns=%llu",
+	    s->name, n, secs, n / secs, (end - start) / (double)n, syscalls / (double)n,
+	    hist_pct(&b->lat, 50), hist_pct(&b->lat, 99), hist_pct(&b->lat, 99.9));
+	if (b->received)
+		printf(" received=%lu", b->received);
+	printf("\n");
+	fflush(stdout);
+	return 0;
+}
+
+static int
+wanted(const char *list, const char *name)
+{
+	const char *cp = list;
+	int len = strlen(name);
+
+	if (!list)
+		return 1;
+	while ((cp = strstr(cp, name))) {
+		if (((cp == list) || (cp[-1] == ',')) && ((cp[len] == '\0') || (cp[len] == ',')))
+			return 1;
+		cp += len;
+	}
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	setappname(argv[0]);
+	struct bench b;
+	const char *only = NULL;
+	long nrand = 0;
+	int c, i, err = 0;
+
+	memset(&b, 0, sizeof(b));
+	b.passes = 1;
+	while ((c = getopt(argc, argv, "n:r:s:x:")) != -1) {
+		switch (c) {
+			case 'n': b.passes = atoi(optarg); break;
+			case 'r': nrand = atol(optarg); break;
+			case 's': only = optarg; break;
+			case 'x':
+				if (hex_setkernel(optarg) == -1) {
+					fprintf(stderr, "hex kernel %s unknown or unsupported here\n", optarg);
+					exit(2);
+				}
+				break;
+			default: usage(argv[0]);
+		}
+	}
+	if ((b.passes <= 0) || (nrand < 0) || ((optind >= argc) == !nrand))
+		usage(argv[0]);
+	for (i = 0; only && (i < NSTAGES); i++)
+		err |= wanted(only, stages[i].name);
+	if (only && !err) {
+		fprintf(stderr, "no known stages in '%s'\n", only);
+		exit(2);
+	}
+
+	crc_init();
+	signal(SIGPIPE, SIG_IGN);
+	if ((nrand ? randframes(&b, nrand) : loadlog(&b, argv[optind])) == -1) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	if (b.nframes == 0) {
+		fprintf(stderr, "no frames in %s\n", argv[optind]);
+		exit(1);
+	}
+	calibrate();
+
+	printf("# modesbench source=%s frames=%ld passes=%d kernel=%s clock_ns=%llu\n",
+	    nrand ? "synthetic" : argv[optind], b.nframes, b.passes, hex_kernel(), clockcost);
+	for (err = 0, i = 0; i < NSTAGES; i++) {
+		if (wanted(only, stages[i].name) && (runstage(&b, &stages[i]) == -1))
+			err = 1;
+	}
+	return err;
+}
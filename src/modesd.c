@@ -5,61 +5,1023 @@
  */
 
 #include <sys/time.h>
-#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <errno.h>
 #include <ctype.h>
+#include <signal.h>
+#include <pthread.h>
 
 #include "util.h"
 #include "udp.h"
 #include "frame.h"
-
-#include "microadsb.h"
-#include "aurora.h"
+#include "rbuf.h"
+#include "evloop.h"
+#include "crc.h"
+#include "modes.h"
+#include "capture.h"
+#include "ring.h"
+#include "hist.h"
+#include "aircraft.h"
+#include "dedup.h"
+#include "tcp.h"
+#include "beast.h"
+#include "devclock.h"
+#include "seqtrack.h"
+#include "metrics.h"
+#include "device.h"
+#include "replay.h"
+#include "hotplug.h"
+#include "shmring.h"
 
 static void
 usage(const char *arg0)
 {
 	printf("\n");
-	printf("%s [-I] [-v] -d /dev/device -t type [-U host:port[:protocol]]\n", arg0);
+	printf("%s [-I] [-O] [-T secs] [-k] [-v] [-m [host:]port|path] -d /dev/device[:type] [-d ...] [-t type] [-S speed] [-U host:port[:protocol]] [-L [host:]port[:protocol] [-Q frames] [-K policy]] [-B frames] [-W msecs] [-P] [-C policy] [-w file [-z]] [-H name[:frames]] [-A secs [-R lat,lon]] [-D msecs [-M msecs]]\n", arg0);
 	printf("\n");
-	printf("\t-d /dev/device\t\tfilename of AVR-format-speaking Mode-S decoder (required)\n");
+	printf("\t-d /dev/device[:type]\tfilename of AVR-format-speaking Mode-S decoder (required, may be repeated)\n");
 	printf("\t-I\t\t\tassume device already in correct mode (TC+FC for microADS-B, RAW mode for Aurora)\n");
-	printf("\t-t type\t\t\tdevice type (know: microadsb, aurora)\n");
-	printf("\t-T secs\t\t\texit if no data for n seconds\n");
+	printf("\t-t type\t\t\tdevice type for -d without one (know: microadsb, aurora, replay)\n");
+	printf("\t-S speed\t\treplay devices (AVR logs or capture files) at this many times real time, 0 for as fast as possible (default 1)\n");
+	printf("\t-T secs\t\t\treopen a device if no data for n seconds (default 2)\n");
+	printf("\t-O\t\t\tdon't reopen devices that fail or go quiet, exit when none are left\n");
 	printf("\t-U host:port[:protocol]\tSend UDP messages to host:port. Protocol may be:\n");
 	printf("\t\t\t\t\t*XXXXXXXXXXXXXX;\traw (default)\n");
 	printf("\t\t\t\t\tAV*XXXXXXXXXXXXXX;\tplaneplotter\n");
-	printf("\t-v\t\t\tprint Mode-S messages to stdout\n");
+	printf("\t\t\t\t\tbeast\t\t\tBeast binary, with 12MHz device timestamps\n");
+	printf("\t-L [host:]port[:protocol]\tlisten for TCP clients, protocols as for -U\n");
+	printf("\t-Q frames\t\tqueue up to this many frames for each TCP client (default 4096)\n");
+	printf("\t-K policy\t\twhat to do when a TCP client's queue is full. Policy may be:\n");
+	printf("\t\t\t\t\tdrop\tdrop the oldest frames (default)\n");
+	printf("\t\t\t\t\tdisconnect\tdisconnect the client\n");
+	printf("\t-B frames\t\tbatch up to this many frames per UDP send (default 1)\n");
+	printf("\t-W msecs\t\tsend a partial UDP batch once its oldest frame is this old (default 5 if -B)\n");
+	printf("\t-P\t\t\tpack a batch into as few UDP datagrams as possible, one frame per line\n");
+	printf("\t-C policy\t\tparity check DF11/17/18 before sending. Policy may be:\n");
+	printf("\t\t\t\t\toff\tdon't check (default)\n");
+	printf("\t\t\t\t\tflag\tcheck and count, but send everything\n");
+	printf("\t\t\t\t\tdrop\tdon't send bad frames\n");
+	printf("\t\t\t\t\tfix\tcorrect single bit errors, drop the rest\n");
+	printf("\t\t\t\t\tfix2\talso correct two bit errors in 112 bit frames\n");
+	printf("\t-m [host:]port|path\tserve Prometheus metrics over HTTP, on localhost unless a host is given, or a Unix socket\n");
+	printf("\t-k\t\t\tkeep host receive times, don't restamp frames from device clocks\n");
+	printf("\t-v\t\t\tprint Mode-S messages to stdout (twice to decode them too)\n");
+	printf("\t-w file\t\t\twrite frames to a binary capture file (read with modesdecode)\n");
+	printf("\t-z\t\t\tcompress the capture file, typically 3-4x smaller (needs a ZLIB=1 build)\n");
+	printf("\t-H name[:frames]\tpublish frames to a shared memory ring for local readers (modesdecode -H); frames a power of two (default %d)\n", SR_SLOTS);
+	printf("\t-A secs\t\t\ttrack aircraft, forgetting them after this long unheard\n");
+	printf("\t-R lat,lon\t\treceiver position, for decoding surface positions\n");
+	printf("\t-D msecs\t\tonly pass on the first copy of a frame heard by several devices within msecs\n");
+	printf("\t-M msecs\t\thold first copies this long and say which devices heard them (with -v)\n");
 	printf("\n");
 	exit(2);
 }
 
-struct devtype {
-	const char name[32];
-	int (*open)(const char *devname, int init);
-	int (*read)(int fd, struct frame *frame, int timeout);
+/* each only ever written by one thread, so MET_ADD() will do */
+struct devcounts {
+	unsigned long overruns; /* frames dropped with the ring full; reader's */
+	unsigned long reconnects; /* times it's come back after being lost; reader's */
+	unsigned long frames; /* the rest are the output thread's */
+	unsigned long bytes;
+	unsigned long badcrc;
+	unsigned long fixedcrc;
+	unsigned long dups;
+	unsigned long df[32];
 };
-static const struct devtype devtypes[] = {
-	{ "microadsb", ma_open, ma_read },
-	{ "aurora", aurora_open, aurora_read },
+
+/*
+ * A device that fails, or goes quiet for -T secs, is closed and waited for:
+ * tried again on a timer that backs off, and straight away if hotplug.c
+ * sees its node come back.  Then it's brought up again on the event loop
+ * (DS_INIT) while the other devices and the outputs carry on.  Files and
+ * replays are just done at their end, as is everything with -O.
+ */
+#define DS_WAIT 0 /* for it to come back (or to be opened the first time) */
+#define DS_INIT 1 /* being brought up */
+#define DS_UP 2 /* being read */
+#define DS_DONE 3 /* for good */
+
+#define DEV_RETRYMS 1000 /* first wait after losing a device */
+#define DEV_RETRYMAXMS 30000
+
+struct device {
+	char *name;
+	const struct devdrv *drv;
+	struct dev *dev;
+	int fd; /* dev's, or -1 once it's closed; atomic */
+	int state; /* DS_*; the rest are the reader's but where it says */
+	struct devinit *init; /* while DS_INIT */
+	struct evtimer *retry; /* while DS_WAIT */
+	int retryms;
+	int everup;
+	struct evtimer *idle;
+	int index; /* bit in a dedup mask */
+	int isfile; /* can't overrun, so wait for the ring rather than drop */
+	struct frame held[DEV_BATCH]; /* a file's frames waiting for room in the ring */
+	int nheld, heldoff;
+	struct evtimer *stall; /* while there are any; the file isn't read meanwhile */
+	int heard; /* frames since the idle timer last went off */
+	struct devstats st; /* the driver's; reader's */
+	struct devstats stlast; /* what stats() last saw */
+	struct devcounts c; /* cumulative, for stats() and metrics */
+	struct devcounts clast; /* what stats() last saw */
+	struct seqtrack seq; /* reader's */
+	struct seqcounts seqlast;
+	struct devclock clock; /* output thread's */
+	long clockppb; /* drift, as of the last stats(); atomic */
+
+	struct device *next;
 };
-#define DEVTYPESLEN (sizeof(devtypes) / sizeof(devtype))
+static struct device *devices = NULL;
+static int ndevices = 0; /* not DS_DONE */
+static int initdevs = 1; /* bring devices up; -I turns it off */
+static int reconnect = 1; /* -O turns it off */
+static struct hotplug *hotplug = NULL;
+static int startfailed = 0; /* a device failed before any came up; exit 2 */
+static int anyup = 0; /* some device has been up */
+
+/*
+ * The main thread only reads devices (ev); everything downstream of framing
+ * runs on the output thread (oev), fed through the ring.  A slow UDP target
+ * or stdout can then only fill the ring, never hold up the serial ports.
+ */
+static struct evloop *ev = NULL;
+static struct evloop *oev = NULL;
+static struct ring *ring = NULL;
+#define RING_FRAMES 8192
+static struct hist queuelat; /* usecs from ring_commit() to sent, output thread's */
+static struct hist queuelattotal; /* all of them, for metrics; under histlock */
+static pthread_mutex_t histlock = PTHREAD_MUTEX_INITIALIZER;
+static int naircraft = 0; /* as of the last stats(); atomic */
+static int verbose = 0;
+static int readto = 2; /* seconds */
+static int batch = 0, window = -1, pack = 0;
+static int tcpout = 0; /* -L given */
+static int discipline = 1; /* restamp frames from device ticks; -k turns it off */
+
+#define CRCPOLICY_OFF 0
+#define CRCPOLICY_FLAG 1
+#define CRCPOLICY_DROP 2
+#define CRCPOLICY_FIX 3
+#define CRCPOLICY_FIX2 4
+static const char *crcpolicies[] = { "off", "flag", "drop", "fix", "fix2" };
+static int crcpolicy = CRCPOLICY_OFF;
+static struct timeval statTime;
+static struct capture *capture = NULL;
+static struct shmring *shmring = NULL; /* -H; output thread's but for sr_published() */
+static volatile sig_atomic_t quit = 0;
+static struct actable *aircraft = NULL; /* -A; output thread's */
+static int acexpire = 0;
+static struct dedup *dedup = NULL; /* -D; output thread's */
+static int dedupms = 0, mergems = 0;
+#define DEDUP_FRAMES 16384
+
+/* -d /dev/device[:type] */
+static int
+adddevice(const char *arg)
+{
+	struct device *d, **dp;
+	char *cp;
+
+	if (!(d = (struct device *)malloc(sizeof(struct device))))
+		return -1;
+	memset(d, 0, sizeof(struct device));
+	if (!(d->name = strdup(arg))) {
+		free(d);
+		return -1;
+	}
+	d->fd = -1;
+	if ((cp = rindex(d->name, ':')) && (d->drv = dev_find(cp + 1)))
+		*cp = '\0';
+
+	/* keep them in command line order */
+	for (dp = &devices; *dp; dp = &(*dp)->next)
+		d->index++;
+	*dp = d;
+	return 0;
+}
+
+/* everything after dedup; rxmask says which devices heard it */
+static void
+sendframe(struct frame *f, unsigned int rxmask)
+{
+	/* decode once, for both the table and -vv */
+	struct modes_msg mm;
+	int decoded = -1;
+	if (aircraft || (verbose > 1))
+		decoded = modes_decode(&mm, f->data, f->len);
+	if (aircraft && (decoded == 0))
+		ac_update(aircraft, &mm, &f->rxstart);
+	if (verbose) {
+		char hex[2*MODES_LONG_LEN + 1];
+		char buf[256], rx[256];
+		int n = 0;
+
+		hex[hexencode(hex, f->data, f->len)] = '\0';
+		rx[0] = '\0';
+		if (mergems) {
+			struct device *d;
+
+			for (d = devices; d && (n < sizeof(rx)); d = d->next) {
+				if (rxmask & (1U << ((d->index < DD_MAXRX) ? d->index : (DD_MAXRX - 1))))
+					n += snprintf(rx + n, sizeof(rx) - n, "%s%s", n ? "," : " rx=", d->name);
+			}
+		}
+		if (verbose > 1) {
+			if (decoded == -1)
+				snprintf(buf, sizeof(buf), "DF%d bad length", f->df);
+			else
+				modes_sprint(buf, sizeof(buf), &mm);
+			printf("%ld.%06ld *%s; %s%s\n", f->rxstart.tv_sec, (long)f->rxstart.tv_usec, hex, buf, rx);
+		} else
+			printf("%ld.%06ld *%s;%s\n", f->rxstart.tv_sec, (long)f->rxstart.tv_usec, hex, rx);
+	}
+	if (capture && (cap_write(capture, f) == -1)) {
+		logmsg("capture write failed, no longer capturing\n");
+		cap_close(capture);
+		capture = NULL;
+	}
+	if (shmring)
+		sr_publish(shmring, f, rxmask);
+	/* XXX support ASTERIX here as well? */
+	if (udp_send(f) < 0)
+		logmsg("failed to send message to one or more UDP hosts\n");
+	tcp_send(f);
+	return;
+}
+
+/* send whatever dedup has held long enough */
+static void
+sendheld(unsigned long long now)
+{
+	struct frame f;
+	unsigned int rxmask;
+
+	while (dd_next(dedup, now, &f, &rxmask))
+		sendframe(&f, rxmask);
+	return;
+}
+
+static void
+handleframe(struct device *d, struct frame *f, unsigned long long enq)
+{
+	if (crcpolicy != CRCPOLICY_OFF) {
+		int maxfix = (crcpolicy == CRCPOLICY_FIX2) ? 2 :
+		    (crcpolicy == CRCPOLICY_FIX) ? 1 : 0;
+		int crc = modes_checkframe(f, maxfix);
+
+		if (crc == CRC_FIXED)
+			MET_ADD(d->c.fixedcrc, 1);
+		else if (crc == CRC_BAD) {
+			MET_ADD(d->c.badcrc, 1);
+			if (crcpolicy != CRCPOLICY_FLAG)
+				return;
+		}
+	}
+	MET_ADD(d->c.frames, 1);
+	MET_ADD(d->c.bytes, f->len);
+	MET_ADD(d->c.df[f->df & 0x1f], 1);
+	if (d->drv->caps & DEV_CAP_TICKS)
+		f->mlat = beast_ticks(f->ticks, d->drv->tickhz);
+	if (discipline)
+		dc_stamp(&d->clock, f);
+	if (dedup) {
+		if (mergems)
+			sendheld(enq); /* makes room, if it's full */
+		if (!dd_add(dedup, f, d->index, enq)) {
+			MET_ADD(d->c.dups, 1);
+			return;
+		}
+		if (mergems)
+			return; /* sendheld() will get it */
+	}
+	sendframe(f, 1U << ((d->index < DD_MAXRX) ? d->index : (DD_MAXRX - 1)));
+	return;
+}
+
+static void lostdevice(struct device *d);
+static void devread(void *arg, int fd, int events);
+
+/* into the ring, as many as fit; how many that was */
+static int
+queueframes(struct device *d, const struct frame *fs, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		struct ring_ent *e;
+
+		if (!(e = ring_claim(ring))) {
+			if (d->isfile)
+				break;
+			MET_ADD(d->c.overruns, 1);
+			continue;
+		}
+		e->f = fs[i];
+		e->arg = d;
+		ring_commit(ring);
+	}
+	return i;
+}
+
+/* a file's waiting for room in the ring; see if there is any yet */
+static void
+devstall(void *arg)
+{
+	struct device *d = (struct device *)arg;
+	int n;
+
+	n = queueframes(d, d->held + d->heldoff, d->nheld - d->heldoff);
+	d->heldoff += n;
+	d->heard += n; /* it's not idle, just waiting */
+	ring_kick(ring);
+	if (d->heldoff < d->nheld)
+		return;
+	d->nheld = d->heldoff = 0;
+	ev_settimer(d->stall, 0, 0);
+	if (ev_addfd(ev, d->dev->fd, EV_READ, devread, d) == -1)
+		lostdevice(d);
+	return;
+}
+
+static void
+devread(void *arg, int fd, int events)
+{
+	struct device *d = (struct device *)arg;
+	struct frame fs[DEV_BATCH];
+	int n, i, queued;
+
+	/* frame everything that came in, then straight into the ring */
+	do {
+		if ((n = dev_read(d->dev, fs, DEV_BATCH)) == -1) {
+			lostdevice(d);
+			break;
+		}
+		for (i = 0; i < n; i++) {
+			if (fs[i].skipped)
+				seq_skipped(&d->seq, fs[i].skipped);
+			seq_frame(&d->seq, fs[i].seqnum);
+		}
+		d->heard += n;
+		if ((queued = queueframes(d, fs, n)) < n) {
+			/*
+			 * A file that's got ahead of the outputs: rather than wait
+			 * here, holding up every other device, stop reading it until
+			 * the output thread has made room for the rest.
+			 */
+			memcpy(d->held, fs + queued, (n - queued) * sizeof(struct frame));
+			d->nheld = n - queued;
+			d->heldoff = 0;
+			ev_delfd(ev, d->dev->fd);
+			if ((!d->stall && !(d->stall = ev_addtimer(ev, devstall, d))) ||
+			    (ev_settimer(d->stall, 1, 1) == -1))
+				lostdevice(d);
+			break;
+		}
+	} while (n == DEV_BATCH);
+	ring_kick(ring);
+	return;
+}
+
+static void
+devidle(void *arg)
+{
+	struct device *d = (struct device *)arg;
+
+	if (d->heard == 0) {
+		logmsg("%s: no data for %d seconds\n", d->name, readto);
+		lostdevice(d);
+		return;
+	}
+	d->heard = 0;
+	return;
+}
+
+/* it's open and in the right mode: read it */
+static int
+attachdevice(struct device *d, struct dev *dev)
+{
+	struct stat st;
+
+	d->isfile = (d->drv->caps & DEV_CAP_REPLAY) ||
+	    ((fstat(dev->fd, &st) == 0) && S_ISREG(st.st_mode));
+	if (ev_addfd(ev, dev->fd, EV_READ, devread, d) == -1) {
+		dev_close(dev);
+		return -1;
+	}
+	if (!(d->idle = ev_addtimer(ev, devidle, d)) ||
+	    (ev_settimer(d->idle, readto * 1000, readto * 1000) == -1)) {
+		ev_deltimer(d->idle);
+		d->idle = NULL;
+		ev_delfd(ev, dev->fd);
+		dev_close(dev);
+		return -1;
+	}
+	d->dev = dev;
+	d->state = DS_UP;
+	d->retryms = 0;
+	d->heard = 1; /* a whole -T before it can be idle */
+	if (d->everup) {
+		logmsg_always("%s: back\n", d->name);
+		MET_ADD(d->c.reconnects, 1);
+		seq_reset(&d->seq);
+	}
+	d->everup = 1;
+	anyup = 1;
+	__atomic_store_n(&d->fd, dev->fd, __ATOMIC_RELAXED);
+	return 0;
+}
+
+/* whatever it's doing, stop, and leave it as DS_WAIT with nothing pending */
+static void
+stopdevice(struct device *d)
+{
+	switch (d->state) {
+	case DS_UP:
+		ev_delfd(ev, d->dev->fd);
+		ev_deltimer(d->idle);
+		d->idle = NULL;
+		ev_deltimer(d->stall);
+		d->stall = NULL;
+		d->nheld = d->heldoff = 0;
+		__atomic_store_n(&d->fd, -1, __ATOMIC_RELAXED);
+		dev_close(d->dev);
+		d->dev = NULL;
+		break;
+	case DS_INIT:
+		dev_initcancel(d->init);
+		d->init = NULL;
+		break;
+	case DS_WAIT:
+		hp_unwatch(hotplug, d);
+		ev_deltimer(d->retry);
+		d->retry = NULL;
+		break;
+	case DS_DONE:
+		return;
+	}
+	d->state = DS_WAIT;
+	return;
+}
+
+static void
+enddevice(struct device *d)
+{
+	if (d->state == DS_DONE)
+		return;
+	stopdevice(d);
+	d->state = DS_DONE;
+	if (--ndevices == 0) {
+		logmsg("no devices left\n");
+		ev_stop(ev);
+	}
+	return;
+}
+
+static void startdevice(struct device *d);
+
+static void
+devretry(void *arg)
+{
+	struct device *d = (struct device *)arg;
+
+	if (d->state != DS_WAIT)
+		return;
+	/* not there yet; try again later, unless hotplug says sooner */
+	if (access(d->name, F_OK) == -1) {
+		if ((d->retryms *= 2) > DEV_RETRYMAXMS)
+			d->retryms = DEV_RETRYMAXMS;
+		logmsg_always("%s: still not there, trying again in %ds\n", d->name, d->retryms / 1000);
+		if (ev_settimer(d->retry, d->retryms, 0) == -1)
+			enddevice(d);
+		return;
+	}
+	stopdevice(d);
+	startdevice(d);
+	return;
+}
+
+/* it failed, went away or went quiet: wait and try again, if it's worth it */
+static void
+lostdevice(struct device *d)
+{
+	stopdevice(d);
+	/*
+	 * Until something's come up, a device that fails is most likely a
+	 * mistake on the command line.  After that, whatever it is, it's
+	 * retried like one that's been lost, and the rest carry on.
+	 */
+	if (!anyup) {
+		logmsg("%s: unable to bring up device\n", d->name);
+		startfailed = 1;
+		enddevice(d);
+		ev_stop(ev);
+		return;
+	}
+	if (!reconnect || d->isfile || (d->drv->caps & DEV_CAP_REPLAY)) {
+		enddevice(d);
+		return;
+	}
+	/* back off if it keeps failing; attachdevice() starts it over */
+	if (!d->retryms)
+		d->retryms = DEV_RETRYMS;
+	else if ((d->retryms *= 2) > DEV_RETRYMAXMS)
+		d->retryms = DEV_RETRYMAXMS;
+	logmsg_always("%s: trying again in %ds\n", d->name, d->retryms / 1000);
+	hp_watch(hotplug, d->name, devretry, d); /* no matter if it can't */
+	if (!(d->retry = ev_addtimer(ev, devretry, d)) ||
+	    (ev_settimer(d->retry, d->retryms, 0) == -1)) {
+		logmsg("%s: unable to set retry timer\n", d->name);
+		enddevice(d);
+	}
+	return;
+}
+
+static void
+devup(void *arg, struct dev *dev)
+{
+	struct device *d = (struct device *)arg;
+
+	d->init = NULL;
+	if (dev && (attachdevice(d, dev) == 0)) {
+		/* frames that came in with the last reply won't wake us */
+		devread(d, dev->fd, EV_READ);
+		return;
+	}
+	lostdevice(d);
+	return;
+}
+
+/* open it, or start bringing it up; from DS_WAIT with nothing pending */
+static void
+startdevice(struct device *d)
+{
+	struct dev *dev;
+
+	logmsg_always("using device on %s, type %s\n", d->name, d->drv->name);
+	if (initdevs && d->drv->initstep) {
+		if ((d->init = dev_initstart(d->drv, d->name, &d->st, ev, devup, d))) {
+			d->state = DS_INIT;
+			return;
+		}
+	} else if ((dev = dev_open(d->drv, d->name, 0, &d->st)) && (attachdevice(d, dev) == 0))
+		return;
+	lostdevice(d);
+	return;
+}
+
+static void
+stats(void *arg)
+{
+	struct timeval now;
+	struct device *d;
+	double secs;
+
+	gettimeofday(&now, NULL);
+	secs = (now.tv_sec - statTime.tv_sec) + (now.tv_usec - statTime.tv_usec) / 1e6;
+	statTime = now;
+
+	for (d = devices; d; d = d->next) {
+		unsigned long skipped = MET_GET(d->st.skipped) - d->stlast.skipped;
+		unsigned long overruns = MET_GET(d->c.overruns) - d->clast.overruns;
+		unsigned long frames = d->c.frames - d->clast.frames;
+		unsigned long badcrc = d->c.badcrc - d->clast.badcrc;
+		unsigned long fixedcrc = d->c.fixedcrc - d->clast.fixedcrc;
+		unsigned long dups = d->c.dups - d->clast.dups;
+
+		d->stlast.skipped += skipped;
+		d->clast.overruns += overruns;
+		d->clast.frames += frames;
+		d->clast.badcrc += badcrc;
+		d->clast.fixedcrc += fixedcrc;
+		d->clast.dups += dups;
+		/* closed, and nothing left over from before it was */
+		if ((__atomic_load_n(&d->fd, __ATOMIC_RELAXED) == -1) &&
+		    !frames && !skipped && !overruns)
+			continue;
+		if (devices->next)
+			logmsg_always("%s: %g frames/sec, %g skipped bytes/sec\n", d->name, frames / secs, skipped / secs);
+		else
+			logmsg_always("%g frames/sec, %g skipped bytes/sec\n", frames / secs, skipped / secs);
+		if (overruns)
+			logmsg_always("%s: %lu frames dropped, output queue full\n", d->name, overruns);
+		if (d->drv->caps & DEV_CAP_SEQNUM) {
+			struct seqcounts sc;
+
+			seq_counts(&d->seq, &sc);
+			if ((sc.devlost != d->seqlast.devlost) || (sc.linelost != d->seqlast.linelost) ||
+			    (sc.restarts != d->seqlast.restarts))
+				logmsg_always("%s: frames lost: %lu in the device, %lu on the line (%lu resyncs)%s\n",
+				    d->name, sc.devlost - d->seqlast.devlost, sc.linelost - d->seqlast.linelost,
+				    sc.resyncs - d->seqlast.resyncs,
+				    (sc.restarts != d->seqlast.restarts) ? ", frame counter restarted" : "");
+			d->seqlast = sc;
+		}
+		if (crcpolicy != CRCPOLICY_OFF)
+			logmsg_always("%s: %g bad CRC/sec, %g fixed/sec\n", d->name, badcrc / secs, fixedcrc / secs);
+		if (dedup)
+			logmsg_always("%s: %g duplicates/sec\n", d->name, dups / secs);
+		if (discipline && (d->drv->caps & DEV_CAP_TICKS)) {
+			double ppm, late;
+			unsigned long resets;
+
+			dc_getstats(&d->clock, &ppm, &late, &resets);
+			__atomic_store_n(&d->clockppb, (long)(ppm * 1000), __ATOMIC_RELAXED);
+			logmsg_always("%s: clock %+.2fppm, host times %.0fus late on average%s\n",
+			    d->name, ppm, late * 1e6, resets ? ", reset" : "");
+		}
+	}
+	if (queuelat.count) {
+		logmsg("queue latency %lluus p50, %lluus p99, %lluus p99.9, %lluus max\n",
+		    hist_pct(&queuelat, 50), hist_pct(&queuelat, 99),
+		    hist_pct(&queuelat, 99.9), queuelat.max);
+		pthread_mutex_lock(&histlock);
+		hist_merge(&queuelattotal, &queuelat);
+		pthread_mutex_unlock(&histlock);
+		hist_reset(&queuelat);
+	}
+	if (aircraft) {
+		int gone = ac_expire(aircraft, &now, acexpire);
+		__atomic_store_n(&naircraft, ac_count(aircraft), __ATOMIC_RELAXED);
+		logmsg("%d aircraft, %d expired\n", ac_count(aircraft), gone);
+	}
+	if (tcpout) {
+		static struct tcp_stats tslast;
+		struct tcp_stats ts;
+
+		tcp_getstats(&ts);
+		if (ts.clients || (ts.accepted != tslast.accepted) || (ts.kicked != tslast.kicked))
+			logmsg("%d TCP clients, %g frames/sec queued, %ld dropped, %ld disconnected for falling behind\n",
+			    ts.clients, (ts.frames - tslast.frames) / secs, ts.dropped - tslast.dropped,
+			    ts.kicked - tslast.kicked);
+		tslast = ts;
+	}
+	if ((batch > 1) || (window > 0)) {
+		struct udp_stats us;
+		udp_getstats(&us, 1);
+		if (us.batches > 0)
+			logmsg("%g frames/UDP batch, %g UDP sends/sec, batch latency %.2fms avg, %.2fms max\n",
+			    us.frames / (double)us.batches, us.syscalls / secs,
+			    us.latsum / us.batches / 1000.0, us.latmax / 1000.0);
+	}
+	fflush(stdout);
+	return;
+}
+
+struct udptargets {
+	struct udptarget {
+		char label[300];
+		struct udp_tstats st;
+	} *t;
+	int n, size;
+};
+
+/* gathered first, so each metric's samples can go out together */
+static void
+metudp(void *arg, const char *host, unsigned short port, const struct udp_tstats *ts)
+{
+	struct udptargets *ut = (struct udptargets *)arg;
+
+	if (ut->n == ut->size) {
+		struct udptarget *t;
+
+		if (!(t = realloc(ut->t, (ut->size ? (ut->size * 2) : 8) * sizeof(struct udptarget))))
+			return;
+		ut->t = t;
+		ut->size = ut->size ? (ut->size * 2) : 8;
+	}
+	snprintf(ut->t[ut->n].label, sizeof(ut->t[ut->n].label), "target=\"%s:%u\"", host, port);
+	ut->t[ut->n++].st = *ts;
+	return;
+}
+
+/* some device can do it, so a metric about it will have samples */
+static int
+anycap(int caps)
+{
+	struct device *d;
+
+	for (d = devices; d; d = d->next) {
+		if (d->drv->caps & caps)
+			return 1;
+	}
+	return 0;
+}
+
+/* on the metrics thread: only atomic reads of what the others write */
+static void
+metcollect(struct metbuf *mb, void *arg)
+{
+	struct device *d;
+	struct tcp_stats ts;
+	struct udptargets ut;
+	struct hist h;
+	int df, i;
+
+#define DEVCOUNTER(metric, help, field) \
+	met_help(mb, "modesd_" metric, "counter", help); \
+	for (d = devices; d; d = d->next) \
+		met_printf(mb, "modesd_" metric "{device=\"%s\"} %lu\n", d->name, MET_GET(d->field));
+	DEVCOUNTER("frames_total", "Frames framed from the device.", c.frames);
+	DEVCOUNTER("bytes_total", "Mode-S payload bytes from the device.", c.bytes);
+	DEVCOUNTER("skipped_bytes_total", "Bytes skipped to resynchronize.", st.skipped);
+	DEVCOUNTER("device_reads_total", "read() calls on the device.", st.reads);
+	DEVCOUNTER("device_read_bytes_total", "Bytes read from the device, framing and all.", st.bytes);
+	DEVCOUNTER("device_reconnects_total", "Times the device came back after being lost.", c.reconnects);
+	DEVCOUNTER("crc_bad_total", "Frames failing the parity check.", c.badcrc);
+	DEVCOUNTER("crc_fixed_total", "Frames corrected by the parity check.", c.fixedcrc);
+	DEVCOUNTER("duplicates_total", "Frames dropped as already heard by another device.", c.dups);
+#undef DEVCOUNTER
+
+	met_help(mb, "modesd_frames_by_df_total", "counter", "Frames by downlink format.");
+	for (d = devices; d; d = d->next) {
+		for (df = 0; df < 32; df++) {
+			unsigned long n = MET_GET(d->c.df[df]);
+			if (n)
+				met_printf(mb, "modesd_frames_by_df_total{device=\"%s\",df=\"%d\"} %lu\n",
+				    d->name, df, n);
+		}
+	}
+
+	met_help(mb, "modesd_lost_frames_total", "counter", "Frames lost, by where.");
+	for (d = devices; d; d = d->next) {
+		struct seqcounts sc;
+
+		met_printf(mb, "modesd_lost_frames_total{device=\"%s\",where=\"queue\"} %lu\n",
+		    d->name, MET_GET(d->c.overruns));
+		if (!(d->drv->caps & DEV_CAP_SEQNUM))
+			continue;
+		seq_counts(&d->seq, &sc);
+		met_printf(mb, "modesd_lost_frames_total{device=\"%s\",where=\"device\"} %lu\n",
+		    d->name, sc.devlost);
+		met_printf(mb, "modesd_lost_frames_total{device=\"%s\",where=\"line\"} %lu\n",
+		    d->name, sc.linelost);
+	}
+	if (anycap(DEV_CAP_SEQNUM)) {
+		met_help(mb, "modesd_resyncs_total", "counter", "Times garbage had to be skipped to find a frame.");
+		for (d = devices; d; d = d->next) {
+			struct seqcounts sc;
+
+			if (!(d->drv->caps & DEV_CAP_SEQNUM))
+				continue;
+			seq_counts(&d->seq, &sc);
+			met_printf(mb, "modesd_resyncs_total{device=\"%s\"} %lu\n", d->name, sc.resyncs);
+		}
+		met_help(mb, "modesd_counter_restarts_total", "counter", "Times the device's frame counter started over.");
+		for (d = devices; d; d = d->next) {
+			struct seqcounts sc;
+
+			if (!(d->drv->caps & DEV_CAP_SEQNUM))
+				continue;
+			seq_counts(&d->seq, &sc);
+			met_printf(mb, "modesd_counter_restarts_total{device=\"%s\"} %lu\n", d->name, sc.restarts);
+		}
+	}
+	met_help(mb, "modesd_device_up", "gauge", "Whether the device is open.");
+	for (d = devices; d; d = d->next)
+		met_printf(mb, "modesd_device_up{device=\"%s\"} %d\n", d->name,
+		    __atomic_load_n(&d->fd, __ATOMIC_RELAXED) != -1);
+	if (discipline && anycap(DEV_CAP_TICKS)) {
+		met_help(mb, "modesd_clock_drift_ppm", "gauge", "Device clock drift against the host's.");
+		for (d = devices; d; d = d->next) {
+			if (d->drv->caps & DEV_CAP_TICKS)
+				met_printf(mb, "modesd_clock_drift_ppm{device=\"%s\"} %g\n", d->name,
+				    __atomic_load_n(&d->clockppb, __ATOMIC_RELAXED) / 1000.0);
+		}
+	}
+
+	memset(&ut, 0, sizeof(ut));
+	udp_foreach(metudp, &ut);
+#define UDPCOUNTER(metric, help, field) \
+	met_help(mb, "modesd_udp_" metric, "counter", help); \
+	for (i = 0; i < ut.n; i++) \
+		met_printf(mb, "modesd_udp_" metric "{%s} %lu\n", ut.t[i].label, ut.t[i].st.field);
+	if (ut.n) {
+		UDPCOUNTER("datagrams_total", "Datagrams sent to each UDP target.", datagrams);
+		UDPCOUNTER("frames_total", "Frames sent to each UDP target.", frames);
+		UDPCOUNTER("bytes_total", "Bytes sent to each UDP target.", bytes);
+		UDPCOUNTER("errors_total", "Failed sends to each UDP target.", errors);
+		UDPCOUNTER("partial_sends_total", "Sends to each UDP target that went out short.", partial);
+	}
+#undef UDPCOUNTER
+	free(ut.t);
+	if (tcpout) {
+		tcp_getstats(&ts);
+		met_help(mb, "modesd_tcp_clients", "gauge", "Connected TCP clients.");
+		met_printf(mb, "modesd_tcp_clients %d\n", ts.clients);
+		met_help(mb, "modesd_tcp_accepted_total", "counter", "TCP clients accepted.");
+		met_printf(mb, "modesd_tcp_accepted_total %lu\n", ts.accepted);
+		met_help(mb, "modesd_tcp_frames_total", "counter", "Frames queued for TCP clients, summed over clients.");
+		met_printf(mb, "modesd_tcp_frames_total %lu\n", ts.frames);
+		met_help(mb, "modesd_tcp_dropped_frames_total", "counter", "Frames lost to full TCP client queues.");
+		met_printf(mb, "modesd_tcp_dropped_frames_total %lu\n", ts.dropped);
+		met_help(mb, "modesd_tcp_disconnected_slow_total", "counter", "TCP clients disconnected for falling behind.");
+		met_printf(mb, "modesd_tcp_disconnected_slow_total %lu\n", ts.kicked);
+	}
+	if (shmring) {
+		met_help(mb, "modesd_shm_frames_total", "counter", "Frames published to the shared memory ring.");
+		met_printf(mb, "modesd_shm_frames_total %llu\n", sr_published(shmring));
+	}
+	if (aircraft) {
+		met_help(mb, "modesd_aircraft", "gauge", "Aircraft being tracked.");
+		met_printf(mb, "modesd_aircraft %d\n", __atomic_load_n(&naircraft, __ATOMIC_RELAXED));
+	}
+
+	pthread_mutex_lock(&histlock);
+	h = queuelattotal;
+	pthread_mutex_unlock(&histlock);
+	met_help(mb, "modesd_queue_latency_seconds", "histogram",
+	    "From a frame being framed to it being sent, as of the last 2 second stats period.");
+	met_hist(mb, "modesd_queue_latency_seconds", NULL, &h, 1e-6);
+	return;
+}
+
+static void
+ringwake(void *arg, int fd, int events)
+{
+	ring_woke(ring);
+	return;
+}
+
+/* msecs until the output thread has something to do besides the ring */
+static int
+outputwait(void)
+{
+	int u = udp_flushwait(), m = -1;
+
+	if (dedup && mergems)
+		m = dd_wait(dedup, ring_now());
+	if (u == -1)
+		return m;
+	return ((m == -1) || (u < m)) ? u : m;
+}
+
+/* the output thread: drain the ring into the outputs, until it's closed */
+static void *
+output(void *arg)
+{
+	for (;;) {
+		struct ring_ent *e;
+
+		while ((e = ring_peek(ring))) {
+			handleframe((struct device *)e->arg, &e->f, e->enq);
+			hist_add(&queuelat, ring_now() - e->enq);
+			ring_release(ring);
+		}
+		if (dedup && mergems)
+			sendheld(ring_now());
+		if (udp_flushwait() == 0) {
+			if (udp_flush() < 0)
+				logmsg("failed to send messages to one or more UDP hosts\n");
+		}
+		tcp_flush();
+		if (ring_closed(ring) && !ring_peek(ring)) {
+			if (dedup && mergems)
+				sendheld(~0ULL); /* everything, now */
+			break;
+		}
+		/* still busy, just see to the timers */
+		if (ev_run(oev, ring_sleep(ring) ? outputwait() : 0) == -1)
+			break;
+	}
+	return NULL;
+}
+
+static void
+sigquit(int sig)
+{
+	quit = 1;
+	return;
+}
 
 int
 main(int argc, char *argv[])
 {
 	setappname(argv[0]);
-	char *devname = NULL;
-	const struct devtype *devtype = NULL;
-	int init = 1; // default to re-initializing the device
-	int verbose = 0;
-	int readto = 2; /* seconds */
+	const struct devdrv *devtype = NULL;
+	struct device *d;
+	const char *capfn = NULL;
+	char *shmname = NULL, *p;
+	int shmslots = SR_SLOTS;
+	int capflags = 0;
+
+	double reflat, reflon;
+	int hasref = 0;
+	double speed;
 
 	int c;
 	opterr = 0;
-	while ((c = getopt(argc, argv, "Id:t:T:U:v")) != -1) {
+	int tcpqueue = 4096, tcppolicy = TCP_POLICY_DROP;
+	while ((c = getopt(argc, argv, "A:B:C:D:H:Id:kK:L:m:M:OPQ:S:t:T:R:U:vW:w:z")) != -1) {
 		switch (c) {
-			case 'I': init = 0; break;
-			case 'd': devname = optarg; break;
+			case 'A':
+				acexpire = atoi(optarg);
+				if (acexpire <= 0) {
+					fprintf(stderr, "invalid aircraft expiry time (%d)\n", acexpire);
+					exit(2);
+				}
+				break;
+			case 'B':
+				batch = atoi(optarg);
+				if (batch <= 0) {
+					fprintf(stderr, "invalid UDP batch size (%d)\n", batch);
+					exit(2);
+				}
+				break;
+			case 'C':
+				for (crcpolicy = 0; crcpolicy < (sizeof(crcpolicies) / sizeof(crcpolicies[0])); crcpolicy++) {
+					if (strcmp(optarg, crcpolicies[crcpolicy]) == 0)
+						break;
+				}
+				if (crcpolicy == (sizeof(crcpolicies) / sizeof(crcpolicies[0]))) {
+					fprintf(stderr, "unknown CRC policy '%s'\n", optarg);
+					exit(2);
+				}
+				break;
+			case 'D':
+				dedupms = atoi(optarg);
+				if (dedupms <= 0) {
+					fprintf(stderr, "invalid dedup window (%d)\n", dedupms);
+					exit(2);
+				}
+				break;
+			case 'M':
+				mergems = atoi(optarg);
+				if (mergems <= 0) {
+					fprintf(stderr, "invalid merge hold time (%d)\n", mergems);
+					exit(2);
+				}
+				break;
+			case 'H':
+				shmname = optarg;
+				if ((p = strrchr(optarg, ':'))) {
+					*p++ = '\0';
+					shmslots = atoi(p);
+				}
+				if (!*shmname || (shmslots <= 0) || (shmslots & (shmslots - 1))) {
+					fprintf(stderr, "invalid shared memory ring '%s'\n", optarg);
+					exit(2);
+				}
+				break;
+			case 'I': initdevs = 0; break;
+			case 'k': discipline = 0; break;
+			case 'm':
+				if (met_parsearg(optarg) == -1)
+					exit(2);
+				break;
+			case 'K':
+				if (strcmp(optarg, "drop") == 0)
+					tcppolicy = TCP_POLICY_DROP;
+				else if (strcmp(optarg, "disconnect") == 0)
+					tcppolicy = TCP_POLICY_DISCONNECT;
+				else {
+					fprintf(stderr, "unknown TCP queue policy '%s'\n", optarg);
+					exit(2);
+				}
+				break;
+			case 'L':
+				if (tcp_parsearg(optarg) == -1)
+					exit(2);
+				tcpout = 1;
+				break;
+			case 'Q':
+				tcpqueue = atoi(optarg);
+				if (tcpqueue <= 0) {
+					fprintf(stderr, "invalid TCP queue length (%d)\n", tcpqueue);
+					exit(2);
+				}
+				break;
+			case 'O': reconnect = 0; break;
+			case 'P': pack = 1; break;
+			case 'S':
+				speed = atof(optarg);
+				if (speed < 0) {
+					fprintf(stderr, "invalid replay speed (%g)\n", speed);
+					exit(2);
+				}
+				replay_setspeed(speed);
+				break;
+			case 'W':
+				window = atoi(optarg);
+				if (window < 0) {
+					fprintf(stderr, "invalid UDP batch window (%d)\n", window);
+					exit(2);
+				}
+				break;
+			case 'd':
+				if (adddevice(optarg) == -1)
+					exit(2);
+				break;
+			case 'R':
+				if ((sscanf(optarg, "%lf,%lf", &reflat, &reflon) != 2) ||
+				    (reflat < -90) || (reflat > 90) || (reflon < -180) || (reflon > 180)) {
+					fprintf(stderr, "invalid receiver position '%s'\n", optarg);
+					exit(2);
+				}
+				hasref = 1;
+				break;
 			case 'U':
 				if (udp_parsearg(optarg) == -1) {
 					usage(argv[0]);
@@ -67,15 +1029,7 @@ main(int argc, char *argv[])
 				}
 				break;
 			case 't':
-				devtype = NULL;
-				{
-					int i;
-					for (i = 0; i < DEVTYPESLEN; i++) {
-					if (strcmp(optarg, devtypes[i].name) == 0)
-						devtype = &devtypes[i];
-					}
-				}
-				if (devtype == NULL) {
+				if ((devtype = dev_find(optarg)) == NULL) {
 					fprintf(stderr, "unknown device type '%s'\n", optarg);
 					exit(2);
 				}
@@ -88,6 +1042,8 @@ main(int argc, char *argv[])
 				}
 				break;
 			case 'v': verbose++; break;
+			case 'w': capfn = optarg; break;
+			case 'z': capflags |= CAP_COMPRESS; break;
 			case '?':
 				if (optopt == 'd')
 					fprintf(stderr, "-d requires argument\n");
@@ -96,53 +1052,112 @@ main(int argc, char *argv[])
 				usage(argv[0]); exit(2);
 		}
 	}
-	if (!devname || !devtype)
+	if (!devices)
 		usage(argv[0]);
+	for (d = devices; d; d = d->next) {
+		if (!d->drv && !(d->drv = devtype)) {
+			fprintf(stderr, "no type given for %s\n", d->name);
+			usage(argv[0]);
+		}
+	}
+	if ((batch > 1) && (window == -1))
+		window = 5;
+	if ((batch == 0) && (window > 0))
+		batch = -1; /* as many as will fit */
+	udp_setbatch(batch ? batch : 1, window, pack);
+	tcp_setqueue(tcpqueue, tcppolicy);
+	crc_init();
+	if (capfn && !(capture = cap_create(capfn, capflags)))
+		exit(2);
+	if (shmname && !(shmring = sr_create(shmname, shmslots))) {
+		logmsg("unable to create shared memory ring %s: %s\n", shmname, strerror(errno));
+		exit(2);
+	}
+	if (mergems && !dedupms)
+		dedupms = 500;
+	if (dedupms && !(dedup = dd_new(DEDUP_FRAMES, dedupms, mergems)))
+		exit(2);
+	if (acexpire) {
+		if (!(aircraft = ac_new(1024)))
+			exit(2);
+		if (hasref)
+			ac_setref(aircraft, reflat, reflon);
+	}
+	/* so the capture gets its index */
+	signal(SIGINT, sigquit);
+	signal(SIGTERM, sigquit);
+	signal(SIGPIPE, SIG_IGN); /* TCP clients going away are handled where we write */
 
-	logmsg("using device on %s, type %s\n", devname, devtype->name);
-	int devfd = devtype->open(devname, init);
-	if (devfd == -1)
+	if (!(ev = ev_new()) || !(oev = ev_new()))
+		exit(2);
+	if (!(ring = ring_new(RING_FRAMES)) ||
+	    (ev_addfd(oev, ring_wakefd(ring), EV_READ, ringwake, NULL) == -1))
+		exit(2);
+	if (tcp_start(oev) == -1)
+		exit(2);
+	hist_reset(&queuelat);
+	if (reconnect && !(hotplug = hp_new(ev)))
 		exit(2);
+	for (d = devices; d; d = d->next) {
+		/* once: they see a restart for themselves, and go on from it */
+		dc_init(&d->clock, (d->drv->caps & DEV_CAP_TICKS) ? d->drv->tickhz : 0);
+		seq_init(&d->seq, (d->drv->caps & DEV_CAP_SEQNUM) ? d->drv->seqbits : 0);
+		ndevices++;
+		startdevice(d);
+		/* didn't even open */
+		if (startfailed)
+			exit(2);
+	}
+
+	struct evtimer *statTimer = ev_addtimer(oev, stats, NULL);
+	if (!statTimer || (ev_settimer(statTimer, 2000, 2000) == -1))
+		exit(2);
+	gettimeofday(&statTime, NULL);
 
-	/* used only for generating EINTR */
-	signal(SIGALRM, SIG_IGN);
+	/* signals are for the main thread, where they'll interrupt the device loop */
+	pthread_t outthread;
+	sigset_t sigs, oldsigs;
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGINT);
+	sigaddset(&sigs, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &sigs, &oldsigs);
+	if (pthread_create(&outthread, NULL, output, NULL)) {
+		logmsg("unable to start output thread\n");
+		exit(2);
+	}
+	pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
 
-	long nFrames = 0;
-	long nSkipped = 0;
-	time_t nTime = time(NULL);
+	if (met_start(metcollect, NULL) == -1)
+		exit(2);
+	/* from here on a burst of errors queues up rather than stalling whoever hit them */
+	if (log_start() == -1)
+		logmsg("unable to start log writer, logging directly\n");
 
-	/* XXX exit loop if no valid data received in N seconds (should use a timer--many places can block) */
 	logmsg("starting...\n");
-	for (;;) {
-		struct frame f;
-		int ret;
-
-		memset(&f, '\0', sizeof(struct frame));
-		ret = devtype->read(devfd, &f, readto);
-		if (ret == -1) {
-			logmsg("device error, exiting\n");
+	while (!ev_stopped(ev) && !quit) {
+		if (ev_run(ev, -1) == -1)
 			break;
-		}
-		if (ret == 0) {
-			nSkipped += f.skipped;
-			continue;
-		}
-
-		if (verbose)
-			printf("%ld.%06ld *%s;\n", f.rxstart.tv_sec, (long)f.rxstart.tv_usec, f.data);
-		/* XXX support ASTERIX here as well? */
-		if (udp_send(f.data) < 0)
-			logmsg("failed to send message to one or more UDP hosts\n");
-		nFrames++;
-
-		if ((time(NULL) - nTime) > 2) {
-			logmsg("%g frames/sec, %g skipped bytes/sec\n", nFrames / (double)(time(NULL) - nTime), nSkipped / (double)(time(NULL) - nTime));
-			nFrames = 0; nSkipped = 0; nTime = time(NULL);
-			fflush(stdout);
-		}
 	}
 	logmsg("ending...\n");
 
+	/* let the output thread finish what's queued */
+	ring_close(ring);
+	pthread_join(outthread, NULL);
+	stats(NULL);
+	met_stop();
+
+	udp_flush();
 	udp_clearports();
-	return 0;
+	tcp_stop();
+	cap_close(capture);
+	sr_destroy(shmring);
+	ac_free(aircraft);
+	dd_free(dedup);
+	for (d = devices; d; d = d->next)
+		enddevice(d);
+	hp_free(hotplug);
+	ev_free(ev);
+	ev_free(oev);
+	ring_free(ring);
+	return startfailed ? 2 : 0;
 }
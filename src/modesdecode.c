@@ -0,0 +1,290 @@
+/*
+ * Decode AVR logs (as written by modesd -v) or capture files (modesd -w)
+ * offline, or what a running modesd is publishing to shared memory (-H).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "util.h"
+#include "frame.h"
+#include "crc.h"
+#include "avr.h"
+#include "modes.h"
+#include "capture.h"
+#include "aircraft.h"
+#include "shmring.h"
+
+static void
+usage(const char *arg0)
+{
+	printf("\n");
+	printf("%s [-b passes] [-s secs] [-e secs] [-w file [-z]] [-a [-R lat,lon]] [-H name | file ...]\n", arg0);
+	printf("\n");
+	printf("\t-b passes\t\tdon't print, just time decoding everything this many times\n");
+	printf("\t-s secs\t\t\tskip frames received before this time (seconds since the epoch)\n");
+	printf("\t-e secs\t\t\tskip frames received after this time (with -H, stop at the first)\n");
+	printf("\t-w file\t\t\tdon't print, write the frames to a capture file\n");
+	printf("\t-z\t\t\tcompress the capture file, typically 3-4x smaller (needs a ZLIB=1 build)\n");
+	printf("\t-a\t\t\tdon't print frames, track aircraft and print them at the end\n");
+	printf("\t-R lat,lon\t\treceiver position, for decoding surface positions\n");
+	printf("\t-H name\t\t\tread frames as modesd -H publishes them, until it stops or we're interrupted\n");
+	printf("\n");
+	exit(2);
+}
+
+static struct timeval from, until; /* -s/-e, zero if not given */
+static struct capture *out = NULL; /* -w */
+static struct actable *aircraft = NULL; /* -a */
+
+#define SHM_POLLUSECS 1000 /* between looks when the ring's empty */
+
+static volatile sig_atomic_t stop = 0;
+
+static void
+sigstop(int sig)
+{
+	stop = 1;
+	return;
+}
+
+static void
+secstotv(const char *arg, struct timeval *tv)
+{
+	double secs = atof(arg);
+
+	tv->tv_sec = secs;
+	tv->tv_usec = (secs - tv->tv_sec) * 1e6 + 0.5;
+	return;
+}
+
+/*
+ * returns 0, 1 if it's past -e, -1 on error.  Past -e isn't the end of a
+ * file: frames from several devices aren't strictly in time order.
+ */
+static int
+gotframe(const struct frame *f, struct frame **framesp, int *nframesp, int *sizep)
+{
+	if (timerisset(&from) && timercmp(&f->rxstart, &from, <))
+		return 0;
+	if (timerisset(&until) && timercmp(&f->rxstart, &until, >))
+		return 1;
+
+	if (framesp) {
+		if (*nframesp == *sizep) {
+			*sizep = *sizep ? (*sizep * 2) : 65536;
+			if (!(*framesp = realloc(*framesp, *sizep * sizeof(struct frame)))) {
+				fprintf(stderr, "out of memory\n");
+				return -1;
+			}
+		}
+		(*framesp)[(*nframesp)++] = *f;
+	} else if (out) {
+		if (cap_write(out, f) == -1)
+			return -1;
+	} else if (aircraft) {
+		struct modes_msg mm;
+
+		if (modes_decode(&mm, f->data, f->len) == 0)
+			ac_update(aircraft, &mm, &f->rxstart);
+	} else {
+		struct modes_msg mm;
+		char hex[2*MODES_LONG_LEN + 1];
+		char buf[256];
+
+		hex[hexencode(hex, f->data, f->len)] = '\0';
+		if (modes_decode(&mm, f->data, f->len) == -1)
+			snprintf(buf, sizeof(buf), "DF%d bad length", f->df);
+		else
+			modes_sprint(buf, sizeof(buf), &mm);
+		printf("%ld.%06ld *%s; %s\n", f->rxstart.tv_sec,
+		    (long)f->rxstart.tv_usec, hex, buf);
+	}
+	return 0;
+}
+
+static void
+printac(void *arg, struct aircraft *ac)
+{
+	printf("%06x %5lu msgs %ld.%06ld-%ld.%06ld", ac->addr, ac->messages,
+	    ac->first.tv_sec, (long)ac->first.tv_usec, ac->last.tv_sec, (long)ac->last.tv_usec);
+	if (ac->flags & AC_HAS_IDENT)
+		printf(" ident=%s", ac->ident);
+	if (ac->flags & AC_HAS_SQUAWK)
+		printf(" squawk=%04x", ac->squawk);
+	if (ac->flags & AC_HAS_ALT)
+		printf(" alt=%d%s", ac->altitude, (ac->flags & AC_ALT_GNSS) ? "gnss" : "");
+	if (ac->flags & AC_SURFACE)
+		printf(" surface");
+	if (ac->flags & AC_HAS_POS)
+		printf(" pos=%.5f,%.5f", ac->lat, ac->lon);
+	if (ac->flags & (AC_HAS_VEL | AC_HAS_AIRSPEED))
+		printf(" %s=%d %s=%.1f", (ac->flags & AC_HAS_VEL) ? "gs" : "as", ac->speed,
+		    (ac->flags & AC_HAS_VEL) ? "track" : "hdg", ac->track / 10.0);
+	if (ac->flags & AC_HAS_VRATE)
+		printf(" vrate=%d", ac->vrate);
+	printf("\n");
+	return;
+}
+
+static int
+decodefile(FILE *fp, struct frame **framesp, int *nframesp, int *sizep)
+{
+	char line[256];
+
+	while (fgets(line, sizeof(line), fp)) {
+		struct frame f;
+
+		memset(&f, 0, sizeof(f));
+		if (avr_parse(line, strlen(line), &f) == -1)
+			continue;
+		if (gotframe(&f, framesp, nframesp, sizep) == -1)
+			return -1;
+	}
+	return 0;
+}
+
+static int
+decodecapture(const char *fn, struct frame **framesp, int *nframesp, int *sizep)
+{
+	struct capture *cap;
+	struct frame f;
+	int ret;
+
+	if (!(cap = cap_open(fn)))
+		return -1;
+	/* straight to the block -s is in, via the index */
+	if (timerisset(&from))
+		cap_seek(cap, &from);
+	while ((ret = cap_read(cap, &f)) == 1) {
+		if ((ret = gotframe(&f, framesp, nframesp, sizep)) == -1)
+			break;
+	}
+	cap_close(cap);
+	return (ret == -1) ? -1 : 0;
+}
+
+static int
+decodeshm(const char *name, struct frame **framesp, int *nframesp, int *sizep)
+{
+	struct shmring *sr;
+	struct frame f;
+	int ret = 0, n;
+
+	if (!(sr = sr_attach(name))) {
+		fprintf(stderr, "unable to read shared memory ring %s: %s\n", name,
+		    (errno == EPROTO) ? "not a frame ring, or not this version's" : strerror(errno));
+		return -1;
+	}
+	signal(SIGINT, sigstop);
+	signal(SIGTERM, sigstop);
+	while (!stop && ((n = sr_read(sr, &f, NULL)) != -1)) {
+		if (n == 0) {
+			fflush(stdout);
+			usleep(SHM_POLLUSECS);
+			continue;
+		}
+		if ((ret = gotframe(&f, framesp, nframesp, sizep)) != 0)
+			break;
+	}
+	if (sr_lost(sr))
+		fprintf(stderr, "%llu frames lost to falling behind\n", sr_lost(sr));
+	sr_detach(sr);
+	return (ret == -1) ? -1 : 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	setappname(argv[0]);
+	int passes = 0;
+	struct frame *frames = NULL;
+	int nframes = 0, size = 0;
+	const char *outfn = NULL, *shmname = NULL;
+	int outflags = 0;
+	int track = 0, hasref = 0;
+	double reflat, reflon;
+	int c, i;
+
+	while ((c = getopt(argc, argv, "ab:e:H:R:s:w:z")) != -1) {
+		switch (c) {
+			case 'a': track = 1; break;
+			case 'R':
+				if (sscanf(optarg, "%lf,%lf", &reflat, &reflon) != 2)
+					usage(argv[0]);
+				hasref = 1;
+				break;
+			case 'b': passes = atoi(optarg); break;
+			case 'e': secstotv(optarg, &until); break;
+			case 'H': shmname = optarg; break;
+			case 's': secstotv(optarg, &from); break;
+			case 'w': outfn = optarg; break;
+			case 'z': outflags |= CAP_COMPRESS; break;
+			default: usage(argv[0]);
+		}
+	}
+	crc_init();
+	if (outfn && !passes && !(out = cap_create(outfn, outflags)))
+		exit(1);
+	if (track && !passes && !out) {
+		if (!(aircraft = ac_new(1024)))
+			exit(1);
+		if (hasref)
+			ac_setref(aircraft, reflat, reflon);
+	}
+
+	if (shmname && (optind != argc))
+		usage(argv[0]);
+	if (shmname && (decodeshm(shmname, passes ? &frames : NULL, &nframes, &size) == -1))
+		exit(1);
+	for (i = optind; !shmname && ((i < argc) || (i == optind)); i++) {
+		FILE *fp = stdin;
+
+		if ((i < argc) && cap_iscapture(argv[i])) {
+			if (decodecapture(argv[i], passes ? &frames : NULL, &nframes, &size) == -1)
+				exit(1);
+			continue;
+		}
+		if ((i < argc) && !(fp = fopen(argv[i], "r"))) {
+			fprintf(stderr, "unable to open %s: %s\n", argv[i], strerror(errno));
+			exit(1);
+		}
+		if (decodefile(fp, passes ? &frames : NULL, &nframes, &size) == -1)
+			exit(1);
+		if (fp != stdin)
+			fclose(fp);
+	}
+
+	if (passes && nframes) {
+		struct timeval start, end;
+		struct modes_msg mm;
+		unsigned long sum = 0;
+		int pass;
+
+		gettimeofday(&start, NULL);
+		for (pass = 0; pass < passes; pass++) {
+			for (i = 0; i < nframes; i++) {
+				modes_decode(&mm, frames[i].data, frames[i].len);
+				sum += mm.flags ^ mm.aa; /* so it isn't optimized away */
+			}
+		}
+		gettimeofday(&end, NULL);
+		double secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+		printf("frames=%ld secs=%.3f frames/sec=%.0f ns/frame=%.1f (%lx)\n",
+		    (long)nframes * passes, secs, nframes * (double)passes / secs,
+		    secs * 1e9 / (nframes * (double)passes), sum & 0xf);
+	}
+	if (aircraft) {
+		ac_foreach(aircraft, printac, NULL);
+		ac_free(aircraft);
+	}
+	if (cap_close(out) == -1)
+		exit(1);
+	free(frames);
+	return 0;
+}
@@ -0,0 +1,237 @@
+/*
+ * Generate synthetic Mode-S traffic (see traffic.h) the way a receiver
+ * would send it, for load testing modesd and whatever's downstream of it:
+ *
+ *	modesgen -p -a 20000 -S 0		# print a pty name, then flood it
+ *	modesd -d /dev/pts/N:microadsb ...
+ *
+ * or into a pipe or file with -o (modesd -d file:replay wants -f avr).
+ * Frames are written when they're due, -S times faster than real time,
+ * or as fast as they can be with -S 0; a summary of what was sent goes to
+ * stderr at the end.
+ */
+
+#define _GNU_SOURCE /* posix_openpt(), cfmakeraw() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/time.h>
+
+#include "util.h"
+#include "crc.h"
+#include "ring.h"
+#include "frame.h"
+#include "microadsb.h"
+#include "aurora.h"
+#include "traffic.h"
+
+#define GEN_BUFSIZE 65536
+#define GEN_AHEADUSECS 1000 /* don't bother sleeping for less */
+
+#define FMT_MICROADSB 0
+#define FMT_AURORA 1
+#define FMT_AVR 2
+
+static void
+usage(const char *arg0)
+{
+	printf("\n");
+	printf("%s [-a aircraft] [-c lat,lon] [-r replies] [-e fraction] [-f format] [-o file | -p] [-S speed] [-n frames] [-t secs] [-s seed]\n", arg0);
+	printf("\n");
+	printf("\t-a aircraft\t\thow many (default 200); each sends about 5 squitters a second\n");
+	printf("\t-c lat,lon\t\twhere they fly around (default San Francisco)\n");
+	printf("\t-r replies\t\tDF4/5/20/21 replies a second from each aircraft (default 2)\n");
+	printf("\t-e fraction\t\tof frames to flip a bit in (default 0)\n");
+	printf("\t-f format\t\tmicroadsb, aurora or avr (default microadsb)\n");
+	printf("\t-o file\t\t\twrite to this file or fifo (default stdout)\n");
+	printf("\t-p\t\t\twrite to a new pty, printing its name\n");
+	printf("\t-S speed\t\ttimes real time; 0 is as fast as possible (default 1)\n");
+	printf("\t-n frames\t\tstop after this many\n");
+	printf("\t-t secs\t\t\tstop after this much simulated time\n");
+	printf("\t-s seed\t\t\tfor the random number generator (default 1)\n");
+	printf("\n");
+	exit(2);
+}
+
+static volatile sig_atomic_t stop = 0;
+
+static void
+sigstop(int sig)
+{
+	stop = 1;
+	return;
+}
+
+/* the master side of a raw pty, keeping the slave open so it never hangs up */
+static int
+openpty_raw(void)
+{
+	struct termios tios;
+	int m, s;
+
+	if ((m = posix_openpt(O_RDWR | O_NOCTTY)) == -1 ||
+	    grantpt(m) == -1 ||
+	    unlockpt(m) == -1) {
+		fprintf(stderr, "unable to allocate pty: %s\n", strerror(errno));
+		return -1;
+	}
+	if ((s = open(ptsname(m), O_RDWR | O_NOCTTY)) == -1) {
+		fprintf(stderr, "unable to open %s: %s\n", ptsname(m), strerror(errno));
+		close(m);
+		return -1;
+	}
+	if (tcgetattr(s, &tios) == 0) {
+		cfmakeraw(&tios);
+		tcsetattr(s, TCSANOW, &tios);
+	}
+	printf("%s\n", ptsname(m));
+	fflush(stdout);
+	return m;
+}
+
+static int
+flush(int fd, const char *buf, int len)
+{
+	int off = 0, w;
+
+	while (off < len) {
+		if ((w = write(fd, buf + off, len - off)) == -1) {
+			if (errno == EINTR) {
+				if (stop)
+					return -1;
+				continue;
+			}
+			if (errno != EPIPE)
+				fprintf(stderr, "write failed: %s\n", strerror(errno));
+			return -1;
+		}
+		off += w;
+	}
+	return 0;
+}
+
+static int
+encode(char *dst, int fmt, const struct frame *f)
+{
+	int n;
+
+	switch (fmt) {
+	case FMT_MICROADSB:
+		return ma_encode(dst, f);
+	case FMT_AURORA:
+		return aurora_encode((unsigned char *)dst, f);
+	}
+	n = sprintf(dst, "%ld.%06ld *", f->rxstart.tv_sec, (long)f->rxstart.tv_usec);
+	n += hexencode(dst + n, f->data, f->len);
+	memcpy(dst + n, ";\n", 2);
+	return n + 2;
+}
+
+int
+main(int argc, char **argv)
+{
+	setappname(argv[0]);
+	static char buf[GEN_BUFSIZE];
+	const char *outfn = NULL;
+	struct traffic *tr;
+	struct sigaction sa;
+	double lat = 37.7749, lon = -122.4194, replies = 2, biterrors = 0, speed = 1, secs = 0;
+	unsigned long long start, now, due, frames = 0, maxframes = 0;
+	unsigned int seed = 1;
+	int c, fd = 1, fmt = FMT_MICROADSB, pty = 0, len = 0, naircraft = 200;
+
+	while ((c = getopt(argc, argv, "a:c:e:f:n:o:pr:s:S:t:")) != -1) {
+		switch (c) {
+			case 'a': naircraft = atoi(optarg); break;
+			case 'c':
+				if (sscanf(optarg, "%lf,%lf", &lat, &lon) != 2)
+					usage(argv[0]);
+				break;
+			case 'e': biterrors = atof(optarg); break;
+			case 'f':
+				if (strcmp(optarg, "microadsb") == 0)
+					fmt = FMT_MICROADSB;
+				else if (strcmp(optarg, "aurora") == 0)
+					fmt = FMT_AURORA;
+				else if (strcmp(optarg, "avr") == 0)
+					fmt = FMT_AVR;
+				else {
+					fprintf(stderr, "unknown format %s\n", optarg);
+					exit(2);
+				}
+				break;
+			case 'n': maxframes = strtoull(optarg, NULL, 10); break;
+			case 'o': outfn = optarg; break;
+			case 'p': pty = 1; break;
+			case 'r': replies = atof(optarg); break;
+			case 's': seed = strtoul(optarg, NULL, 0); break;
+			case 'S': speed = atof(optarg); break;
+			case 't': secs = atof(optarg); break;
+			default: usage(argv[0]);
+		}
+	}
+	if ((optind != argc) || (naircraft <= 0) || (replies < 0) || (speed < 0) || (secs < 0) ||
+	    (biterrors < 0) || (biterrors > 1) || (outfn && pty))
+		usage(argv[0]);
+	if ((lat < -85) || (lat > 85) || (lon < -180) || (lon > 180)) {
+		fprintf(stderr, "-c wants a latitude within 85 degrees of the equator and a longitude\n");
+		exit(2);
+	}
+
+	crc_init();
+	signal(SIGPIPE, SIG_IGN);
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sigstop;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	if (pty && ((fd = openpty_raw()) == -1))
+		exit(1);
+	if (outfn && ((fd = open(outfn, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)) {
+		fprintf(stderr, "unable to open %s: %s\n", outfn, strerror(errno));
+		exit(1);
+	}
+	if (!(tr = tr_new(naircraft, lat, lon, replies, biterrors, seed))) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	start = ring_now();
+	while (!stop && (!maxframes || (frames < maxframes))) {
+		struct frame f;
+
+		tr_next(tr, &f);
+		if (secs && (tr_now(tr) > secs * 1e6))
+			break;
+		if (speed > 0) {
+			due = start + tr_now(tr) / speed;
+			/* only wait once we're well ahead, flushing what's due first */
+			if ((now = ring_now()) + GEN_AHEADUSECS < due) {
+				if (flush(fd, buf, len) == -1)
+					break;
+				len = 0;
+				usleep(due - now);
+			}
+		}
+		len += encode(buf + len, fmt, &f);
+		frames++;
+		if (len > GEN_BUFSIZE - 128) {
+			if (flush(fd, buf, len) == -1)
+				break;
+			len = 0;
+		}
+	}
+	flush(fd, buf, len);
+	now = ring_now();
+	fprintf(stderr, "%llu frames, %.3f secs simulated in %.3f, %.0f frames/sec\n",
+	    frames, tr_now(tr) / 1e6, (now - start) / 1e6,
+	    (now > start) ? (frames * 1e6 / (now - start)) : 0.0);
+	tr_free(tr);
+	return 0;
+}
@@ -0,0 +1,106 @@
+/*
+ * Buffered device input
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "rbuf.h"
+
+void
+rbuf_init(struct rbuf *rb, int fd)
+{
+	rb->fd = fd;
+	rb->evdriven = 0;
+	rb->start = rb->end = 0;
+	rb->fills = rb->bytes = 0;
+	return;
+}
+
+/*
+ * one read() of as much as will fit. returns bytes read, 0 on EOF,
+ * RBUF_AGAIN if a non-blocking fd had nothing, -1 on error (errno intact).
+ */
+int
+rbuf_read(struct rbuf *rb)
+{
+	int n;
+
+	/* what's left is normally just the start of a frame, so this is cheap */
+	if (rb->start == rb->end)
+		rb->start = rb->end = 0;
+	else if (rb->start > 0) {
+		memmove(rb->buf, rb->buf + rb->start, rb->end - rb->start);
+		rb->end -= rb->start;
+		rb->start = 0;
+	}
+	if (rb->end == RBUF_SIZE)
+		return -1; /* framer let it fill up with junk */
+
+	n = read(rb->fd, rb->buf + rb->end, RBUF_SIZE - rb->end);
+	rb->fills++;
+	if (n > 0) {
+		rb->end += n;
+		rb->bytes += n;
+	} else if ((n == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+		return RBUF_AGAIN;
+	return n;
+}
+
+/* what framers call when they run out: rbuf_read(), unless the loop does that */
+int
+rbuf_fill(struct rbuf *rb)
+{
+	if (rb->evdriven)
+		return RBUF_AGAIN;
+	return rbuf_read(rb);
+}
+
+/*
+ * fill until at least n bytes are buffered. returns 1, or what rbuf_fill()
+ * returned if it didn't get there.
+ */
+int
+rbuf_need(struct rbuf *rb, int n)
+{
+	if (n > RBUF_SIZE)
+		return -1;
+	while (rbuf_len(rb) < n) {
+		int r = rbuf_fill(rb);
+		if (r <= 0)
+			return r;
+	}
+	return 1;
+}
+
+/* like fgets, but strips \r and \n. returns length or -1. */
+int
+rbuf_readln(struct rbuf *rb, char *buf, int buflen)
+{
+	int i = 0;
+
+	for (;;) {
+		unsigned char *p = rbuf_data(rb);
+		unsigned char *nl = memchr(p, '\n', rbuf_len(rb));
+		int n = nl ? (nl - p) : rbuf_len(rb);
+
+		while ((n > 0) && (i < (buflen - 1))) {
+			if (*p != '\r')
+				buf[i++] = *p;
+			p++, n--;
+			rbuf_consume(rb, 1);
+		}
+		if (nl && (p == nl)) {
+			rbuf_consume(rb, 1);
+			break;
+		}
+		if (i >= (buflen - 1))
+			break;
+		if (rbuf_fill(rb) <= 0)
+			return -1;
+	}
+	buf[i] = '\0';
+
+	return i;
+}
@@ -0,0 +1,37 @@
+
+#ifndef __MODES_RBUF_H__
+#define __MODES_RBUF_H__
+
+/*
+ * Per-device input buffer.  Each fill is a single read() of whatever the
+ * device has ready; framers then scan the buffered bytes in place and
+ * consume what they've used.  Unconsumed bytes are kept contiguous (they're
+ * slid back to the front before each read()) so a framer never has to deal
+ * with a frame wrapped around the end of the buffer.
+ */
+
+#define RBUF_SIZE 4096
+
+#define RBUF_AGAIN (-2) /* non-blocking fd has nothing more for now */
+
+struct rbuf {
+	int fd;
+	int evdriven; /* the event loop does the read()s; framers never block */
+	int start; /* first unconsumed byte */
+	int end; /* one past last valid byte */
+	unsigned long fills; /* read() calls made */
+	unsigned long bytes; /* bytes read */
+	unsigned char buf[RBUF_SIZE];
+};
+
+extern void rbuf_init(struct rbuf *rb, int fd);
+extern int rbuf_read(struct rbuf *rb);
+extern int rbuf_fill(struct rbuf *rb);
+extern int rbuf_need(struct rbuf *rb, int n);
+extern int rbuf_readln(struct rbuf *rb, char *buf, int buflen);
+
+#define rbuf_data(rb) ((rb)->buf + (rb)->start)
+#define rbuf_len(rb) ((rb)->end - (rb)->start)
+#define rbuf_consume(rb, n) ((rb)->start += (n))
+
+#endif /* ndef __MODES_RBUF_H__ */
@@ -0,0 +1,227 @@
+/*
+ * Replaying recorded frames as a device; see replay.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "util.h"
+#include "metrics.h"
+#include "ring.h"
+#include "avr.h"
+#include "capture.h"
+#include "replay.h"
+
+/* as many as one pipe write can take without being split */
+#define REPLAY_BATCH (PIPE_BUF / sizeof(struct frame))
+#define REPLAY_NAPUSECS 100000 /* longest sleep before checking for stop */
+
+struct replay {
+	struct dev dev;
+	FILE *fp; /* an AVR log, */
+	struct capture *cap; /* or a capture */
+	int wfd; /* the thread's end of the pipe */
+	pthread_t thread;
+	int stop; /* atomic */
+};
+
+static double speed = 1.0; /* 0 is as fast as possible */
+
+void
+replay_setspeed(double s)
+{
+	speed = s;
+	return;
+}
+
+/* returns 1 and fills in f, 0 at the end, -1 on error */
+static int
+nextframe(struct replay *rp, struct frame *f)
+{
+	char line[256];
+
+	memset(f, '\0', sizeof(struct frame));
+	if (rp->cap)
+		return cap_read(rp->cap, f);
+	while (fgets(line, sizeof(line), rp->fp)) {
+		if (avr_parse(line, strlen(line), f) != -1)
+			return 1;
+		memset(f, '\0', sizeof(struct frame));
+	}
+	return ferror(rp->fp) ? -1 : 0;
+}
+
+static int
+writeframes(struct replay *rp, struct frame *f, int n)
+{
+	if (n == 0)
+		return 0;
+	/* one write of at most PIPE_BUF, so the reader only ever sees whole frames */
+	if (write(rp->wfd, f, n * sizeof(struct frame)) != n * sizeof(struct frame)) {
+		if (errno != EPIPE)
+			logmsg("%s: replay write failed: %s\n", rp->dev.name, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/* sleep until the monotonic time is due, or we're told to stop */
+static int
+waituntil(struct replay *rp, unsigned long long due)
+{
+	unsigned long long now;
+
+	while ((now = ring_now()) < due) {
+		if (__atomic_load_n(&rp->stop, __ATOMIC_RELAXED))
+			return -1;
+		usleep(((due - now) < REPLAY_NAPUSECS) ? (due - now) : REPLAY_NAPUSECS);
+	}
+	return 0;
+}
+
+static void *
+replayer(void *arg)
+{
+	struct replay *rp = (struct replay *)arg;
+	struct frame batch[REPLAY_BATCH];
+	unsigned long long first = 0, start = 0;
+	int n = 0, r;
+
+	while (!__atomic_load_n(&rp->stop, __ATOMIC_RELAXED)) {
+		struct frame *f = &batch[n];
+
+		if ((r = nextframe(rp, f)) != 1) {
+			if (r == -1)
+				logmsg("%s: replay read error\n", rp->dev.name);
+			break;
+		}
+		if ((speed > 0) && timerisset(&f->rxstart)) {
+			unsigned long long t = f->rxstart.tv_sec * 1000000ULL + f->rxstart.tv_usec;
+
+			if (!start) {
+				first = t;
+				start = ring_now();
+			} else if (t > first) {
+				unsigned long long due = start + (t - first) / speed;
+
+				/* send what's due before waiting for what isn't */
+				if (due > ring_now()) {
+					if (writeframes(rp, batch, n) == -1)
+						break;
+					memmove(&batch[0], f, sizeof(struct frame));
+					f = &batch[n = 0];
+					if (waituntil(rp, due) == -1)
+						break;
+				}
+			}
+		}
+		gettimeofday(&f->rxstart, NULL);
+		f->rxend = f->rxstart;
+		f->skipped = 0;
+		if (++n == REPLAY_BATCH) {
+			if (writeframes(rp, batch, n) == -1)
+				break;
+			n = 0;
+		}
+	}
+	writeframes(rp, batch, n);
+	close(rp->wfd); /* the reader sees EOF */
+	rp->wfd = -1;
+	return NULL;
+}
+
+struct dev *
+replay_open(const struct devdrv *drv, const char *fn, int init)
+{
+	struct replay *rp;
+	int fds[2];
+
+	if (!(rp = (struct replay *)malloc(sizeof(struct replay))))
+		return NULL;
+	memset(rp, 0, sizeof(struct replay));
+	rp->dev.name = fn;
+	if (cap_iscapture(fn)) {
+		if (!(rp->cap = cap_open(fn))) {
+			free(rp);
+			return NULL;
+		}
+	} else if (!(rp->fp = fopen(fn, "r"))) {
+		logmsg("unable to open %s for replay: %s\n", fn, strerror(errno));
+		free(rp);
+		return NULL;
+	}
+	if (pipe(fds) == -1) {
+		logmsg("unable to make replay pipe: %s\n", strerror(errno));
+		goto fail;
+	}
+	rp->dev.fd = fds[0];
+	rp->wfd = fds[1];
+	if (pthread_create(&rp->thread, NULL, replayer, rp)) {
+		logmsg("unable to start replay thread for %s\n", fn);
+		close(fds[0]);
+		close(fds[1]);
+		goto fail;
+	}
+	if (speed > 0)
+		logmsg("replaying %s at %gx\n", fn, speed);
+	else
+		logmsg("replaying %s as fast as possible\n", fn);
+	return &rp->dev;
+
+fail:
+	if (rp->cap)
+		cap_close(rp->cap);
+	if (rp->fp)
+		fclose(rp->fp);
+	free(rp);
+	return NULL;
+}
+
+int
+replay_read(struct dev *dev, struct frame *f, int n)
+{
+	int r;
+
+	r = read(dev->fd, f, n * sizeof(struct frame));
+	MET_ADD(dev->st->reads, 1);
+	if (r > 0) {
+		MET_ADD(dev->st->bytes, r);
+		MET_ADD(dev->st->frames, r / sizeof(struct frame));
+		return r / sizeof(struct frame);
+	}
+	if ((r == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+		return 0;
+	if (r == 0)
+		logmsg("%s: end of replay\n", dev->name);
+	else
+		logmsg("%s: read error: %s\n", dev->name, strerror(errno));
+	return -1;
+}
+
+void
+replay_close(struct dev *dev)
+{
+	struct replay *rp = (struct replay *)dev;
+	struct frame f[REPLAY_BATCH];
+
+	/* the thread may be blocked writing; drain until it's gone */
+	__atomic_store_n(&rp->stop, 1, __ATOMIC_RELAXED);
+	fcntl(dev->fd, F_SETFL, 0);
+	while (read(dev->fd, f, sizeof(f)) > 0)
+		;
+	pthread_join(rp->thread, NULL);
+	close(dev->fd);
+	if (rp->cap)
+		cap_close(rp->cap);
+	if (rp->fp)
+		fclose(rp->fp);
+	free(rp);
+	return;
+}
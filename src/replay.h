@@ -0,0 +1,23 @@
+
+#ifndef __MODES_REPLAY_H__
+#define __MODES_REPLAY_H__
+
+/*
+ * The replay driver plays back an AVR log (as modesd -v writes them) or a
+ * capture file as if it were a receiver: at the speed it was recorded, some
+ * multiple of that, or as fast as whatever's reading it will take it.  A
+ * thread reads and paces the file and writes frames down a pipe, whose read
+ * end is the device's fd, so to the event loop it's just another device.
+ *
+ * Frames are stamped with the time they're replayed, not the time they were
+ * recorded; lines with no timestamp go out right after the one before.
+ */
+
+#include "device.h"
+
+extern void replay_setspeed(double speed);
+extern struct dev *replay_open(const struct devdrv *drv, const char *fn, int init);
+extern int replay_read(struct dev *dev, struct frame *f, int n);
+extern void replay_close(struct dev *dev);
+
+#endif /* ndef __MODES_REPLAY_H__ */
@@ -0,0 +1,198 @@
+/*
+ * Lock-free SPSC frame queue
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+#include "util.h"
+#include "frame.h"
+#include "ring.h"
+
+#define RING_CACHELINE 64
+
+struct ring {
+	struct ring_ent *ents;
+	unsigned int mask; /* size - 1, size a power of 2 */
+	int wakefd[2];
+
+	/* producer's */
+	unsigned int head __attribute__((aligned(RING_CACHELINE))); /* next to fill */
+	unsigned int tailcache; /* last tail seen, to avoid touching the consumer's line */
+
+	/* consumer's */
+	unsigned int tail __attribute__((aligned(RING_CACHELINE))); /* next to take */
+	unsigned int headcache;
+
+	/* shared flags */
+	int sleeping __attribute__((aligned(RING_CACHELINE)));
+	int closed;
+};
+
+struct ring *
+ring_new(int size)
+{
+	struct ring *r;
+	int n;
+
+	for (n = 1; n < size; n <<= 1)
+		;
+	if (posix_memalign((void **)&r, RING_CACHELINE, sizeof(struct ring)))
+		return NULL;
+	memset(r, 0, sizeof(struct ring));
+	r->mask = n - 1;
+	if (!(r->ents = calloc(n, sizeof(struct ring_ent)))) {
+		free(r);
+		return NULL;
+	}
+	if (pipe(r->wakefd) == -1) {
+		logmsg("pipe: %s\n", strerror(errno));
+		free(r->ents);
+		free(r);
+		return NULL;
+	}
+	fcntl(r->wakefd[0], F_SETFL, O_NONBLOCK);
+	fcntl(r->wakefd[1], F_SETFL, O_NONBLOCK);
+	return r;
+}
+
+void
+ring_free(struct ring *r)
+{
+	if (!r) return;
+
+	close(r->wakefd[0]);
+	close(r->wakefd[1]);
+	free(r->ents);
+	free(r);
+	return;
+}
+
+/* monotonic usecs, for enq */
+unsigned long long
+ring_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/*
+ * Producer side
+ */
+
+/* slot to build the next frame in, or NULL if the ring's full */
+struct ring_ent *
+ring_claim(struct ring *r)
+{
+	if (r->head - r->tailcache > r->mask) {
+		r->tailcache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+		if (r->head - r->tailcache > r->mask)
+			return NULL;
+	}
+	return &r->ents[r->head & r->mask];
+}
+
+/* hand over what's in the slot ring_claim() gave out */
+void
+ring_commit(struct ring *r)
+{
+	r->ents[r->head & r->mask].enq = ring_now();
+	__atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+	return;
+}
+
+/* after a burst of commits: wake the consumer, if it's asleep */
+void
+ring_kick(struct ring *r)
+{
+	char c = 0;
+
+	/* pairs with ring_sleep(): either we see it asleep, or it sees the frames */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&r->sleeping, __ATOMIC_RELAXED) &&
+	    __atomic_exchange_n(&r->sleeping, 0, __ATOMIC_SEQ_CST)) {
+		if ((write(r->wakefd[1], &c, 1) == -1) && (errno != EAGAIN))
+			logmsg("ring wakeup: %s\n", strerror(errno));
+	}
+	return;
+}
+
+/* no more frames coming */
+void
+ring_close(struct ring *r)
+{
+	char c = 0;
+
+	__atomic_store_n(&r->closed, 1, __ATOMIC_SEQ_CST);
+	if ((write(r->wakefd[1], &c, 1) == -1) && (errno != EAGAIN))
+		logmsg("ring wakeup: %s\n", strerror(errno));
+	return;
+}
+
+/*
+ * Consumer side
+ */
+
+/* oldest frame, or NULL if there isn't one. stays put until ring_release(). */
+struct ring_ent *
+ring_peek(struct ring *r)
+{
+	if (r->tail == r->headcache) {
+		r->headcache = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		if (r->tail == r->headcache)
+			return NULL;
+	}
+	return &r->ents[r->tail & r->mask];
+}
+
+void
+ring_release(struct ring *r)
+{
+	__atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+	return;
+}
+
+/*
+ * about to wait on ring_wakefd(). returns 1 if that's fine, 0 if frames
+ * turned up in the meantime and it shouldn't.
+ */
+int
+ring_sleep(struct ring *r)
+{
+	__atomic_store_n(&r->sleeping, 1, __ATOMIC_SEQ_CST);
+	if ((__atomic_load_n(&r->head, __ATOMIC_SEQ_CST) != r->tail) || ring_closed(r)) {
+		__atomic_store_n(&r->sleeping, 0, __ATOMIC_RELAXED);
+		return 0;
+	}
+	return 1;
+}
+
+/* ring_wakefd() went readable */
+void
+ring_woke(struct ring *r)
+{
+	char buf[64];
+
+	while (read(r->wakefd[0], buf, sizeof(buf)) > 0)
+		;
+	__atomic_store_n(&r->sleeping, 0, __ATOMIC_RELAXED);
+	return;
+}
+
+int
+ring_wakefd(struct ring *r)
+{
+	return r->wakefd[0];
+}
+
+int
+ring_closed(struct ring *r)
+{
+	return __atomic_load_n(&r->closed, __ATOMIC_ACQUIRE);
+}
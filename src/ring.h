@@ -0,0 +1,43 @@
+
+#ifndef __MODES_RING_H__
+#define __MODES_RING_H__
+
+/*
+ * Single producer, single consumer frame queue between two threads.  No
+ * locks: each side owns one index and only reads the other's.  Frames are
+ * built in place (claim a slot, fill it, commit), so nothing's copied.
+ *
+ * The consumer can sleep in its event loop on ring_wakefd(); the producer
+ * only writes to it when the consumer has said it's going to sleep, so a
+ * busy pipeline makes no wakeup syscalls at all.
+ */
+
+#include "frame.h"
+
+struct ring_ent {
+	void *arg; /* whatever the producer wants to say about it */
+	unsigned long long enq; /* ring_now() at commit */
+	struct frame f;
+};
+
+struct ring;
+
+extern struct ring *ring_new(int size);
+extern void ring_free(struct ring *r);
+extern unsigned long long ring_now(void);
+
+/* producer */
+extern struct ring_ent *ring_claim(struct ring *r);
+extern void ring_commit(struct ring *r);
+extern void ring_kick(struct ring *r);
+extern void ring_close(struct ring *r);
+
+/* consumer */
+extern struct ring_ent *ring_peek(struct ring *r);
+extern void ring_release(struct ring *r);
+extern int ring_sleep(struct ring *r);
+extern void ring_woke(struct ring *r);
+extern int ring_wakefd(struct ring *r);
+extern int ring_closed(struct ring *r);
+
+#endif /* ndef __MODES_RING_H__ */
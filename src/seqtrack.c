@@ -0,0 +1,78 @@
+/*
+ * Frame counter gap accounting
+ */
+
+#include <string.h>
+
+#include "seqtrack.h"
+
+void
+seq_init(struct seqtrack *st, int bits)
+{
+	memset(st, 0, sizeof(struct seqtrack));
+	st->bits = bits;
+	return;
+}
+
+/* a new connection: its counter starts wherever it does, but keep the counts */
+void
+seq_reset(struct seqtrack *st)
+{
+	st->valid = 0;
+	st->skipped = 0;
+	return;
+}
+
+void
+seq_skipped(struct seqtrack *st, int bytes)
+{
+	st->skipped += bytes;
+	return;
+}
+
+void
+seq_frame(struct seqtrack *st, unsigned long long seqnum)
+{
+	unsigned long long mask, gap;
+	int skipped = st->skipped;
+
+	st->skipped = 0;
+	if (!st->bits)
+		return;
+	mask = (st->bits < 64) ? ((1ULL << st->bits) - 1) : ~0ULL;
+	seqnum &= mask;
+	if (!st->valid) {
+		st->valid = 1;
+		st->last = seqnum;
+		return;
+	}
+
+	if (skipped)
+		__atomic_fetch_add(&st->n.resyncs, 1, __ATOMIC_RELAXED);
+	gap = (seqnum - st->last - 1) & mask;
+	if (gap > SEQ_MAXGAP) {
+		/* backwards, or too far forward to believe */
+		__atomic_fetch_add(&st->n.restarts, 1, __ATOMIC_RELAXED);
+	} else {
+		if (seqnum < st->last)
+			__atomic_fetch_add(&st->n.wraps, 1, __ATOMIC_RELAXED);
+		if (gap && skipped)
+			__atomic_fetch_add(&st->n.linelost, gap, __ATOMIC_RELAXED);
+		else if (gap)
+			__atomic_fetch_add(&st->n.devlost, gap, __ATOMIC_RELAXED);
+	}
+	st->last = seqnum;
+	return;
+}
+
+/* a consistent enough copy of the counters, from any thread */
+void
+seq_counts(struct seqtrack *st, struct seqcounts *c)
+{
+	c->devlost = __atomic_load_n(&st->n.devlost, __ATOMIC_RELAXED);
+	c->linelost = __atomic_load_n(&st->n.linelost, __ATOMIC_RELAXED);
+	c->resyncs = __atomic_load_n(&st->n.resyncs, __ATOMIC_RELAXED);
+	c->wraps = __atomic_load_n(&st->n.wraps, __ATOMIC_RELAXED);
+	c->restarts = __atomic_load_n(&st->n.restarts, __ATOMIC_RELAXED);
+	return;
+}
@@ -0,0 +1,39 @@
+#ifndef __MODES_SEQTRACK_H__
+#define __MODES_SEQTRACK_H__
+
+/*
+ * Loss accounting from a device's frame counter.  A gap in the counter
+ * with nothing but clean frames around it was lost before the device
+ * sent it; a gap we had to skip garbage to get past was lost on the
+ * serial line.  (Frames we lose ourselves, with the ring full, are
+ * counted where they're dropped; they've already been counted here.)
+ *
+ * Updated by the reader; the counters only ever go up, and can be read
+ * from another thread.
+ */
+
+struct seqcounts {
+	unsigned long devlost;
+	unsigned long linelost;
+	unsigned long resyncs; /* times we had to skip garbage */
+	unsigned long wraps;
+	unsigned long restarts; /* the counter jumped, so who knows */
+};
+
+struct seqtrack {
+	int bits; /* counter width, 0 if the device has none */
+	int valid;
+	unsigned long long last;
+	int skipped; /* bytes of garbage since the last frame */
+	struct seqcounts n; /* atomic */
+};
+
+#define SEQ_MAXGAP 100000 /* more than this and it's not a gap, the device restarted */
+
+extern void seq_init(struct seqtrack *st, int bits);
+extern void seq_reset(struct seqtrack *st);
+extern void seq_skipped(struct seqtrack *st, int bytes);
+extern void seq_frame(struct seqtrack *st, unsigned long long seqnum);
+extern void seq_counts(struct seqtrack *st, struct seqcounts *c);
+
+#endif /* ndef __MODES_SEQTRACK_H__ */
@@ -0,0 +1,300 @@
+/*
+ * Shared memory frame ring; see shmring.h.  Nothing here logs: errors are
+ * left in errno for the caller, so a reader needs nothing else of ours.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shmring.h"
+
+#define SR_MAGIC "MODESSHM"
+#define SR_VERSION 1
+
+struct sr_header {
+	char magic[8];
+	unsigned int version;
+	unsigned int slotlen;
+	unsigned int nslots;
+	unsigned int closed; /* the writer's gone, for good; atomic */
+	char pad[64 - 24];
+	unsigned long long head; /* frames published; atomic */
+	char pad2[64 - 8];
+};
+
+struct sr_slot {
+	unsigned long long seq; /* frame number + 1, 0 while it's being written; atomic */
+	unsigned long long rxstart; /* usecs */
+	unsigned long long seqnum;
+	unsigned long long ticks;
+	unsigned long long mlat;
+	unsigned int rxmask;
+	unsigned char len, df, crc, pad;
+	unsigned char data[MODES_LONG_LEN];
+	unsigned char pad2[2];
+};
+
+struct shmring {
+	char *name;
+	size_t size;
+	struct sr_header *hdr;
+	struct sr_slot *slots;
+	unsigned long long mask;
+	unsigned long long next; /* frame to write, or to read */
+	unsigned long long lost; /* reader's */
+};
+
+static size_t
+sr_size(int nslots)
+{
+	return sizeof(struct sr_header) + (size_t)nslots * sizeof(struct sr_slot);
+}
+
+/* shm_open() wants "/name" */
+static struct shmring *
+sr_new(const char *name)
+{
+	struct shmring *sr;
+
+	if (!(sr = (struct shmring *)malloc(sizeof(struct shmring))))
+		return NULL;
+	memset(sr, 0, sizeof(struct shmring));
+	if (!(sr->name = (char *)malloc(strlen(name) + 2))) {
+		free(sr);
+		return NULL;
+	}
+	sprintf(sr->name, "%s%s", (name[0] == '/') ? "" : "/", name);
+	return sr;
+}
+
+/* keeping errno for the caller */
+static void
+sr_free(struct shmring *sr)
+{
+	int err = errno;
+
+	if (sr->hdr)
+		munmap(sr->hdr, sr->size);
+	free(sr->name);
+	free(sr);
+	errno = err;
+	return;
+}
+
+struct shmring *
+sr_create(const char *name, int nslots)
+{
+	struct shmring *sr;
+	int fd, err;
+
+	if ((nslots <= 0) || (nslots & (nslots - 1))) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if (!(sr = sr_new(name)))
+		return NULL;
+	sr->size = sr_size(nslots);
+	/* a fresh one, so readers still mapping an old one just see it close */
+	shm_unlink(sr->name);
+	if ((fd = shm_open(sr->name, O_RDWR | O_CREAT | O_EXCL, 0644)) == -1) {
+		sr_free(sr);
+		return NULL;
+	}
+	if (ftruncate(fd, sr->size) == -1)
+		goto fail;
+	if ((sr->hdr = mmap(NULL, sr->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		sr->hdr = NULL;
+		goto fail;
+	}
+	close(fd);
+	sr->slots = (struct sr_slot *)(sr->hdr + 1);
+	sr->mask = nslots - 1;
+	sr->hdr->version = SR_VERSION;
+	sr->hdr->slotlen = sizeof(struct sr_slot);
+	sr->hdr->nslots = nslots;
+	/* the magic last, so a reader that sees it sees the rest */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(sr->hdr->magic, SR_MAGIC, sizeof(sr->hdr->magic));
+	return sr;
+fail:
+	err = errno;
+	close(fd);
+	shm_unlink(sr->name);
+	errno = err;
+	sr_free(sr);
+	return NULL;
+}
+
+void
+sr_publish(struct shmring *sr, const struct frame *f, unsigned int rxmask)
+{
+	struct sr_slot *s = &sr->slots[sr->next & sr->mask];
+
+	__atomic_store_n(&s->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE); /* readers see it's changing before it does */
+	s->rxstart = f->rxstart.tv_sec * 1000000ULL + f->rxstart.tv_usec;
+	s->seqnum = f->seqnum;
+	s->ticks = f->ticks;
+	s->mlat = f->mlat;
+	s->rxmask = rxmask;
+	s->len = f->len;
+	s->df = f->df;
+	s->crc = f->crc;
+	memset(s->data, 0, sizeof(s->data));
+	memcpy(s->data, f->data, f->len);
+	sr->next++;
+	__atomic_store_n(&s->seq, sr->next, __ATOMIC_RELEASE);
+	__atomic_store_n(&sr->hdr->head, sr->next, __ATOMIC_RELEASE);
+	return;
+}
+
+/* from any thread */
+unsigned long long
+sr_published(struct shmring *sr)
+{
+	return __atomic_load_n(&sr->hdr->head, __ATOMIC_RELAXED);
+}
+
+void
+sr_destroy(struct shmring *sr)
+{
+	if (!sr)
+		return;
+	__atomic_store_n(&sr->hdr->closed, 1, __ATOMIC_RELEASE);
+	shm_unlink(sr->name);
+	sr_free(sr);
+	return;
+}
+
+/*
+ * Starting with the next frame published.  NULL with errno set if it
+ * can't: EPROTO if what's there isn't a ring this version can read.
+ */
+struct shmring *
+sr_attach(const char *name)
+{
+	struct shmring *sr;
+	struct sr_header hdr;
+	struct stat st;
+	int fd, err;
+
+	if (!(sr = sr_new(name)))
+		return NULL;
+	if ((fd = shm_open(sr->name, O_RDONLY, 0)) == -1) {
+		sr_free(sr);
+		return NULL;
+	}
+	if (fstat(fd, &st) == -1)
+		goto fail;
+	if ((st.st_size < sizeof(struct sr_header)) ||
+	    (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) ||
+	    (memcmp(hdr.magic, SR_MAGIC, sizeof(hdr.magic)) != 0) ||
+	    (hdr.version != SR_VERSION) || (hdr.slotlen != sizeof(struct sr_slot)) ||
+	    !hdr.nslots || (hdr.nslots & (hdr.nslots - 1)) || (st.st_size < sr_size(hdr.nslots))) {
+		errno = EPROTO;
+		goto fail;
+	}
+	sr->size = sr_size(hdr.nslots);
+	if ((sr->hdr = mmap(NULL, sr->size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		sr->hdr = NULL;
+		goto fail;
+	}
+	close(fd);
+	sr->slots = (struct sr_slot *)(sr->hdr + 1);
+	sr->mask = hdr.nslots - 1;
+	sr->next = __atomic_load_n(&sr->hdr->head, __ATOMIC_ACQUIRE);
+	return sr;
+fail:
+	err = errno;
+	close(fd);
+	errno = err;
+	sr_free(sr);
+	return NULL;
+}
+
+/* lapped: on to the oldest frame the writer won't be at again for a while */
+static void
+sr_skip(struct shmring *sr)
+{
+	unsigned long long head = __atomic_load_n(&sr->hdr->head, __ATOMIC_ACQUIRE);
+	unsigned long long next = head - (sr->mask + 1) + ((sr->mask + 1) / 8);
+
+	if (next > sr->next) {
+		sr->lost += next - sr->next;
+		sr->next = next;
+	}
+	return;
+}
+
+/* 1 with the next frame, 0 if there isn't one yet, -1 if there won't be */
+int
+sr_read(struct shmring *sr, struct frame *f, unsigned int *rxmask)
+{
+	for (;;) {
+		struct sr_slot *s = &sr->slots[sr->next & sr->mask], copy;
+		unsigned long long seq;
+		int closed = __atomic_load_n(&sr->hdr->closed, __ATOMIC_ACQUIRE);
+		unsigned long long head = __atomic_load_n(&sr->hdr->head, __ATOMIC_ACQUIRE);
+
+		if (sr->next == head)
+			return closed ? -1 : 0;
+		if (head - sr->next > sr->mask + 1) {
+			sr_skip(sr);
+			continue;
+		}
+		if ((seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE)) != sr->next + 1) {
+			sr_skip(sr);
+			continue;
+		}
+		memcpy(&copy, s, sizeof(copy));
+		/* and it wasn't being rewritten while we copied it */
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq) {
+			sr_skip(sr);
+			continue;
+		}
+		if ((copy.len != MODES_SHORT_LEN) && (copy.len != MODES_LONG_LEN)) {
+			/* can't be, but it's not ours to trust */
+			sr->next++;
+			sr->lost++;
+			continue;
+		}
+		memset(f, 0, sizeof(struct frame));
+		f->rxstart.tv_sec = copy.rxstart / 1000000;
+		f->rxstart.tv_usec = copy.rxstart % 1000000;
+		f->rxend = f->rxstart;
+		f->seqnum = copy.seqnum;
+		f->ticks = copy.ticks;
+		f->mlat = copy.mlat;
+		f->len = copy.len;
+		f->df = copy.df;
+		f->crc = copy.crc;
+		memcpy(f->data, copy.data, copy.len);
+		if (rxmask)
+			*rxmask = copy.rxmask;
+		sr->next++;
+		return 1;
+	}
+}
+
+/* frames the writer lapped us for */
+unsigned long long
+sr_lost(struct shmring *sr)
+{
+	return sr->lost;
+}
+
+void
+sr_detach(struct shmring *sr)
+{
+	if (!sr)
+		return;
+	sr_free(sr);
+	return;
+}
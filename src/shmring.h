@@ -0,0 +1,50 @@
+
+#ifndef __MODES_SHMRING_H__
+#define __MODES_SHMRING_H__
+
+/*
+ * Frames for other programs on the same host, through a POSIX shared
+ * memory ring rather than a socket each: modesd (-H) writes every frame it
+ * sends once, and any number of readers map the ring and copy out what
+ * they want, without modesd knowing or caring how many there are.
+ *
+ * There's one writer and no locks.  Frames are numbered from 0 as they're
+ * published; frame n goes in slot n % nslots, and the slot says which frame
+ * it holds (n + 1 once it's written, 0 while it's being written).  A reader
+ * keeps the number of the next frame it wants, copies the slot out and
+ * checks the slot still says n + 1 afterwards; if it doesn't, the writer
+ * has lapped it, and it skips ahead and counts the frames it lost.  The
+ * writer never waits for anybody, so a slow reader only costs itself.
+ *
+ * There's nothing to sleep on: readers poll, sr_read() being a couple of
+ * loads when there's nothing new.  Nothing here logs; sr_create() and
+ * sr_attach() return NULL with errno set, and reporting that is up to
+ * the caller, so a reader only needs shmring.o.
+ *
+ * Layout, in native byte order (it's only for this host):
+ *
+ *	header	"MODESSHM" version:32 slotlen:32 nslots:32 closed:32
+ *		head:64 (frames published), on its own cache line
+ *	slots	seq:64 rxstart:64 (usecs since the epoch) seqnum:64 ticks:64
+ *		mlat:64 rxmask:32 len:8 df:8 crc:8 0:8 data:112 0:16
+ */
+
+#include "frame.h"
+
+#define SR_SLOTS 65536 /* default; 64 bytes each */
+
+struct shmring;
+
+/* writer */
+extern struct shmring *sr_create(const char *name, int nslots);
+extern void sr_publish(struct shmring *sr, const struct frame *f, unsigned int rxmask);
+extern unsigned long long sr_published(struct shmring *sr);
+extern void sr_destroy(struct shmring *sr);
+
+/* readers */
+extern struct shmring *sr_attach(const char *name);
+extern int sr_read(struct shmring *sr, struct frame *f, unsigned int *rxmask);
+extern unsigned long long sr_lost(struct shmring *sr);
+extern void sr_detach(struct shmring *sr);
+
+#endif /* ndef __MODES_SHMRING_H__ */
@@ -0,0 +1,834 @@
+/*
+ * Summarize AVR logs, like perl/squitter-summarize.pl but fast enough for
+ * months of them.  Logs are mmap()ed and scanned in place; the aircraft
+ * database is only consulted for airframes that were actually heard.
+ *
+ * Output is meant to match the perl script line for line.  The one place it
+ * can't is the order of airframes with equal counts, which perl leaves to
+ * its hash order; here they're in ICAO order.
+ *
+ * Input is cut into chunks at line boundaries and handed out to a pool of
+ * worker threads, each with its own counters and ICAO table.  They're merged
+ * once everyone's done, so there's no locking on the hot path.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+#include "util.h"
+#include "frame.h"
+#include "crc.h"
+
+#define SUM_NOAA 0xffffff /* where perl counts squitters it couldn't decode */
+
+struct acent {
+	unsigned int aa; /* ICAO address | AC_USED */
+	unsigned int total;
+	unsigned int extended;
+	unsigned int adsb; /* DF17s */
+	struct dbrow *db;
+};
+#define AC_USED 0x80000000
+
+struct acmap {
+	struct acent *ents;
+	unsigned int size; /* power of 2 */
+	unsigned int n;
+};
+
+#define SUM_TIMELEN 64
+
+struct timerange {
+	double first, last;
+	char firststr[SUM_TIMELEN]; /* as it was in the log, trailing space and all */
+	char laststr[SUM_TIMELEN];
+};
+
+struct summary {
+	unsigned long total;
+	unsigned long ignored;
+	unsigned long standard;
+	unsigned long extended;
+	unsigned long df[33]; /* DF+1 */
+	struct timerange tr;
+	struct acmap ac;
+};
+
+/*
+ * A run of whole lines.  The time range is kept per chunk rather than per
+ * worker so that merging in chunk order settles ties the way a serial pass
+ * would.
+ */
+struct chunk {
+	const char *start;
+	const char *end;
+	struct timerange tr;
+};
+
+#define CHUNK_MIN (4 << 20)
+
+struct pool {
+	pthread_mutex_t lock;
+	struct chunk *chunks;
+	int nchunks;
+	int next; /* first chunk nobody's taken */
+};
+
+struct worker {
+	pthread_t tid;
+	struct pool *pool;
+	struct summary sum;
+};
+
+/* only the columns we print; NULL if the row didn't have that many fields */
+struct dbrow {
+	char *reg;
+	char *icaotype;
+	char *cyear;
+	char *registrant;
+	char *callsign; /* airlines */
+	char *key;
+	struct dbrow *next;
+};
+
+struct mapped {
+	const char *data;
+	size_t len;
+	int mmapped;
+};
+
+static const char *datadir = "../data";
+
+static void
+usage(const char *arg0)
+{
+	printf("\n");
+	printf("%s [-d datadir] [-j threads] [file ...]\n", arg0);
+	printf("\n");
+	printf("\t-d datadir\t\tdirectory with aircraft.txt and airlines.txt (default %s)\n", datadir);
+	printf("\t-j threads\t\tworker threads (default one per CPU)\n");
+	printf("\n");
+	exit(2);
+}
+
+static unsigned char uhexval[256]; /* 0x10 | value for [0-9A-F], perl's class */
+
+static void
+uhexinit(void)
+{
+	int i;
+
+	for (i = 0; i < 10; i++)
+		uhexval['0' + i] = 0x10 | i;
+	for (i = 0; i < 6; i++)
+		uhexval['A' + i] = 0x10 | (10 + i);
+	return;
+}
+
+/*
+ * ICAO address table
+ */
+
+static inline unsigned int
+achash(unsigned int aa, unsigned int size)
+{
+	return (aa * 2654435761U) >> 8 & (size - 1);
+}
+
+static int
+acgrow(struct acmap *m)
+{
+	struct acent *old = m->ents;
+	unsigned int oldsize = m->size, i;
+
+	m->size = oldsize ? (oldsize * 2) : 1024;
+	if (!(m->ents = calloc(m->size, sizeof(struct acent)))) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	for (i = 0; i < oldsize; i++) {
+		unsigned int h;
+
+		if (!(old[i].aa & AC_USED))
+			continue;
+		for (h = achash(old[i].aa & ~AC_USED, m->size); m->ents[h].aa & AC_USED;
+		    h = (h + 1) & (m->size - 1))
+			;
+		m->ents[h] = old[i];
+	}
+	free(old);
+	return 0;
+}
+
+static struct acent *
+acfind(struct acmap *m, unsigned int aa, int create)
+{
+	unsigned int h;
+
+	if (!m->size) {
+		if (!create)
+			return NULL;
+		acgrow(m);
+	}
+	for (h = achash(aa, m->size); m->ents[h].aa & AC_USED; h = (h + 1) & (m->size - 1)) {
+		if (m->ents[h].aa == (aa | AC_USED))
+			return &m->ents[h];
+	}
+	if (!create)
+		return NULL;
+	if ((m->n + 1) * 2 > m->size) {
+		acgrow(m);
+		return acfind(m, aa, create);
+	}
+	m->n++;
+	m->ents[h].aa = aa | AC_USED;
+	return &m->ents[h];
+}
+
+/*
+ * Log scanning
+ */
+
+static inline int
+isperlspace(unsigned char c)
+{
+	return (c == ' ') || (c == '\t') || (c == '\n') || (c == '\r') ||
+	    (c == '\f') || (c == '\v');
+}
+
+static void
+sumtime(struct timerange *tr, const char *t, int len)
+{
+	double v = strtod(t, NULL);
+
+	if (len >= SUM_TIMELEN)
+		len = SUM_TIMELEN - 1;
+	if (!tr->firststr[0] || (v < tr->first)) {
+		tr->first = v;
+		memcpy(tr->firststr, t, len);
+		tr->firststr[len] = '\0';
+	}
+	if (!tr->laststr[0] || (v > tr->last)) {
+		tr->last = v;
+		memcpy(tr->laststr, t, len);
+		tr->laststr[len] = '\0';
+	}
+	return;
+}
+
+/* one line, \r and \n already gone */
+static void
+sumline(struct summary *s, struct timerange *tr, const char *line, int len)
+{
+	const char *hex;
+	int hexlen, i = 0, df = -1;
+	unsigned char msg[MODES_LONG_LEN];
+	struct acent *ac;
+
+	/* ^(([0-9]+)(?:\.([0-9]+)|)\s+|)\*(.*)\;$ */
+	if ((len > 0) && (line[0] >= '0') && (line[0] <= '9')) {
+		while ((i < len) && (line[i] >= '0') && (line[i] <= '9'))
+			i++;
+		if ((i + 1 < len) && (line[i] == '.') && (line[i+1] >= '0') && (line[i+1] <= '9')) {
+			for (i++; (i < len) && (line[i] >= '0') && (line[i] <= '9'); i++)
+				;
+		}
+		if ((i < len) && isperlspace(line[i])) {
+			while ((i < len) && isperlspace(line[i]))
+				i++;
+		} else
+			i = -1;
+	}
+	if ((i >= 0) && (len - i >= 2) && (line[i] == '*') && (line[len-1] == ';')) {
+		if (i > 0)
+			sumtime(tr, line, i);
+		hex = line + i + 1;
+		hexlen = len - i - 2;
+	/* ^\@(.{12})(.{28}|.{56});$ */
+	} else if (((len == 42) || (len == 70)) && (line[0] == '@') && (line[len-1] == ';')) {
+		hex = line + 13;
+		hexlen = len - 14;
+	} else {
+		s->ignored++;
+		return;
+	}
+
+	s->total++;
+	if (hexlen == 2*MODES_SHORT_LEN)
+		s->standard++;
+	else
+		s->extended++;
+
+	if ((hexlen == 2*MODES_SHORT_LEN) || (hexlen == 2*MODES_LONG_LEN)) {
+		unsigned char bad = 0;
+
+		for (i = 0; i < hexlen; i += 2) {
+			unsigned char hi = uhexval[(unsigned char)hex[i]];
+			unsigned char lo = uhexval[(unsigned char)hex[i+1]];
+			bad |= ~(hi & lo);
+			msg[i/2] = (hi << 4) | (lo & 0xf);
+		}
+		if (!(bad & 0x10))
+			df = MODES_DF(msg[0]);
+	}
+	s->df[df + 1]++;
+
+	if (df == -1) {
+		ac = acfind(&s->ac, SUM_NOAA, 1);
+		ac->total++;
+		return;
+	}
+	if ((df == 11) || (df == 17) || (df == 18))
+		ac = acfind(&s->ac, (msg[1] << 16) | (msg[2] << 8) | msg[3], 1);
+	else
+		ac = acfind(&s->ac, modes_syndrome(msg, hexlen / 2), 1);
+	ac->total++;
+	if (hexlen != 2*MODES_SHORT_LEN)
+		ac->extended++;
+	if (df == 17)
+		ac->adsb++;
+	return;
+}
+
+static void
+summarize(struct summary *s, struct chunk *c)
+{
+	const char *p = c->start, *end = c->end;
+	char *line = NULL;
+	int linesize = 0;
+
+	while (p < end) {
+		const char *nl = memchr(p, '\n', end - p);
+		const char *eol = nl ? nl : end;
+		int len = eol - p;
+
+		if (memchr(p, '\r', len)) {
+			const char *q;
+			int n = 0;
+
+			if (len > linesize) {
+				linesize = len;
+				if (!(line = realloc(line, linesize))) {
+					fprintf(stderr, "out of memory\n");
+					exit(1);
+				}
+			}
+			for (q = p; q < eol; q++) {
+				if (*q != '\r')
+					line[n++] = *q;
+			}
+			sumline(s, &c->tr, line, n);
+		} else
+			sumline(s, &c->tr, p, len);
+		p = nl ? (nl + 1) : end;
+	}
+	free(line);
+	return;
+}
+
+/*
+ * Threading
+ */
+
+static void *
+worker(void *arg)
+{
+	struct worker *w = (struct worker *)arg;
+	struct pool *pool = w->pool;
+
+	for (;;) {
+		int i;
+
+		pthread_mutex_lock(&pool->lock);
+		i = pool->next < pool->nchunks ? pool->next++ : -1;
+		pthread_mutex_unlock(&pool->lock);
+		if (i == -1)
+			break;
+		summarize(&w->sum, &pool->chunks[i]);
+	}
+	return NULL;
+}
+
+static void
+addchunk(struct pool *pool, int *size, const char *start, const char *end)
+{
+	if (pool->nchunks == *size) {
+		*size = *size ? (*size * 2) : 64;
+		if (!(pool->chunks = realloc(pool->chunks, *size * sizeof(struct chunk)))) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+	}
+	memset(&pool->chunks[pool->nchunks], 0, sizeof(struct chunk));
+	pool->chunks[pool->nchunks].start = start;
+	pool->chunks[pool->nchunks].end = end;
+	pool->nchunks++;
+	return;
+}
+
+/* cut each buffer into pieces of about chunklen, ending on a newline */
+static void
+mkchunks(struct pool *pool, const struct mapped *files, int nfiles, size_t chunklen)
+{
+	int size = 0, i;
+
+	for (i = 0; i < nfiles; i++) {
+		const char *p = files[i].data, *end = p + files[i].len;
+
+		while (p < end) {
+			const char *q = p + chunklen, *nl;
+
+			if ((q >= end) || !(nl = memchr(q, '\n', end - q)))
+				q = end;
+			else
+				q = nl + 1;
+			addchunk(pool, &size, p, q);
+			p = q;
+		}
+	}
+	return;
+}
+
+static void
+mergetime(struct timerange *dst, const struct timerange *src)
+{
+	if (src->firststr[0] && (!dst->firststr[0] || (src->first < dst->first))) {
+		dst->first = src->first;
+		strcpy(dst->firststr, src->firststr);
+	}
+	if (src->laststr[0] && (!dst->laststr[0] || (src->last > dst->last))) {
+		dst->last = src->last;
+		strcpy(dst->laststr, src->laststr);
+	}
+	return;
+}
+
+static void
+merge(struct summary *dst, const struct summary *src)
+{
+	unsigned int i;
+
+	dst->total += src->total;
+	dst->ignored += src->ignored;
+	dst->standard += src->standard;
+	dst->extended += src->extended;
+	for (i = 0; i < 33; i++)
+		dst->df[i] += src->df[i];
+	for (i = 0; i < src->ac.size; i++) {
+		const struct acent *from = &src->ac.ents[i];
+		struct acent *to;
+
+		if (!(from->aa & AC_USED))
+			continue;
+		to = acfind(&dst->ac, from->aa & ~AC_USED, 1);
+		to->total += from->total;
+		to->extended += from->extended;
+		to->adsb += from->adsb;
+	}
+	return;
+}
+
+static int
+mapfile(const char *fn, struct mapped *m)
+{
+	int fd = 0;
+	struct stat st;
+
+	memset(m, 0, sizeof(*m));
+	if (fn && ((fd = open(fn, O_RDONLY)) == -1)) {
+		fprintf(stderr, "unable to open %s: %s\n", fn, strerror(errno));
+		return -1;
+	}
+	if ((fstat(fd, &st) == 0) && S_ISREG(st.st_mode)) {
+		m->len = st.st_size;
+		if (m->len && ((m->data = mmap(NULL, m->len, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)) {
+			fprintf(stderr, "unable to map %s: %s\n", fn ? fn : "stdin", strerror(errno));
+			if (fd) close(fd);
+			return -1;
+		}
+		if (m->len)
+			madvise((void *)m->data, m->len, MADV_SEQUENTIAL);
+		m->mmapped = 1;
+	} else {
+		/* pipe; read it all in */
+		size_t size = 0;
+		ssize_t n;
+		char *buf = NULL;
+
+		for (;;) {
+			if (m->len == size) {
+				size = size ? (size * 2) : (1 << 20);
+				if (!(buf = realloc(buf, size))) {
+					fprintf(stderr, "out of memory\n");
+					exit(1);
+				}
+			}
+			if ((n = read(fd, buf + m->len, size - m->len)) <= 0)
+				break;
+			m->len += n;
+		}
+		m->data = buf;
+	}
+	if (fd) close(fd);
+	return 0;
+}
+
+/*
+ * Aircraft and airline databases: tab separated, header line first, # for
+ * comments.  Split the way perl's split(/\t/) does, trailing empty fields
+ * and all, since that decides what counts as defined.
+ */
+
+#define DB_MAXCOLS 32
+
+static char *
+readfile(const char *fn)
+{
+	struct mapped m;
+	char *buf;
+
+	if (mapfile(fn, &m) == -1)
+		return NULL;
+	if (!(buf = malloc(m.len + 1))) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	memcpy(buf, m.data, m.len);
+	buf[m.len] = '\0';
+	if (m.mmapped) {
+		if (m.len) munmap((void *)m.data, m.len);
+	} else
+		free((void *)m.data);
+	return buf;
+}
+
+static int
+dbsplit(char *line, char **fields)
+{
+	int n = 0;
+	char *p = line, *tab;
+
+	if (!*line)
+		return 0;
+	for (;;) {
+		if (n == DB_MAXCOLS)
+			break;
+		fields[n++] = p;
+		if (!(tab = strchr(p, '\t')))
+			break;
+		*tab = '\0';
+		p = tab + 1;
+	}
+	while ((n > 0) && !*fields[n-1])
+		n--;
+	return n;
+}
+
+/*
+ * calls rowcb() for each data row with the fields of interest (NULL for any
+ * the row didn't have). the file's buffer is kept, rows point into it.
+ */
+static int
+dbload(const char *fn, const char **cols, int ncols,
+    void (*rowcb)(void *arg, char **vals), void *arg)
+{
+	char *buf, *line, *nl;
+	char *head[DB_MAXCOLS], *fields[DB_MAXCOLS], *vals[DB_MAXCOLS];
+	int colidx[DB_MAXCOLS];
+	int nhead = 0, n, i, j;
+
+	if (!(buf = readfile(fn)))
+		return -1;
+	for (line = buf; *line; line = nl + 1) {
+		char *p;
+
+		if ((nl = strchr(line, '\n')))
+			*nl = '\0';
+		for (p = line; isperlspace(*p); p++)
+			;
+		if (*p == '#')
+			goto next;
+
+		n = dbsplit(line, nhead ? fields : head);
+		if (!nhead) {
+			if ((nhead = n)) {
+				for (i = 0; i < ncols; i++) {
+					colidx[i] = -1;
+					for (j = 0; j < nhead; j++) {
+						if (strcmp(head[j], cols[i]) == 0)
+							colidx[i] = j;
+					}
+				}
+			}
+			goto next;
+		}
+		if (n > nhead)
+			n = nhead;
+		for (i = 0; i < ncols; i++)
+			vals[i] = ((colidx[i] >= 0) && (colidx[i] < n)) ? fields[colidx[i]] : NULL;
+		rowcb(arg, vals);
+next:
+		if (!nl)
+			break;
+	}
+	return 0;
+}
+
+static const char *aircraftcols[] = { "ICAO24", "Reg", "ICAOType", "CYear", "Registrant" };
+
+static void
+aircraftrow(void *arg, char **vals)
+{
+	struct summary *s = (struct summary *)arg;
+	struct acent *ac;
+	struct dbrow *row;
+	unsigned int aa = 0;
+	int i;
+
+	/* perl matches on the exact string, which is uppercase when it matters */
+	if (!vals[0] || (strlen(vals[0]) != 6))
+		return;
+	for (i = 0; i < 6; i++) {
+		unsigned char v = uhexval[(unsigned char)vals[0][i]];
+		if (!v)
+			return;
+		aa = (aa << 4) | (v & 0xf);
+	}
+	if (!(ac = acfind(&s->ac, aa, 0)))
+		return;
+	if (!ac->db && !(ac->db = malloc(sizeof(struct dbrow)))) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	row = ac->db;
+	memset(row, 0, sizeof(*row));
+	row->reg = vals[1];
+	row->icaotype = vals[2];
+	row->cyear = vals[3];
+	row->registrant = vals[4];
+	return;
+}
+
+static const char *airlinecols[] = { "ICAO", "Callsign" };
+
+static void
+airlinerow(void *arg, char **vals)
+{
+	struct dbrow **airlines = (struct dbrow **)arg;
+	struct dbrow *row;
+
+	if (!vals[0])
+		return;
+	if (!(row = malloc(sizeof(struct dbrow)))) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	memset(row, 0, sizeof(*row));
+	row->key = vals[0];
+	row->callsign = vals[1];
+	row->next = *airlines;
+	*airlines = row; /* newest first, so later duplicates win like perl's */
+	return;
+}
+
+static struct dbrow *
+findairline(struct dbrow *airlines, const char *registrant)
+{
+	int n;
+
+	/* s/^([A-Z]+)\s*.*?$/$1/ */
+	for (n = 0; (registrant[n] >= 'A') && (registrant[n] <= 'Z'); n++)
+		;
+	if (!n)
+		return NULL;
+	for (; airlines; airlines = airlines->next) {
+		if ((strncmp(airlines->key, registrant, n) == 0) && !airlines->key[n])
+			return airlines;
+	}
+	return NULL;
+}
+
+/*
+ * Output
+ */
+
+/* perl's $x || "" */
+static const char *
+pstr(const char *s)
+{
+	if (!s || !*s || (strcmp(s, "0") == 0))
+		return "";
+	return s;
+}
+
+static double
+pct(unsigned long n, unsigned long total)
+{
+	return total ? ((double)n / total * 100) : 0;
+}
+
+static int
+accmp(const void *a, const void *b)
+{
+	const struct acent *x = *(const struct acent **)a;
+	const struct acent *y = *(const struct acent **)b;
+
+	if (x->total != y->total)
+		return (x->total < y->total) ? 1 : -1;
+	return (x->aa < y->aa) ? -1 : (x->aa > y->aa);
+}
+
+static void
+report(struct summary *s, struct dbrow *airlines)
+{
+	unsigned long actotal = 0, acext = 0, acadsb = 0;
+	struct acent **acs;
+	unsigned int i, n = 0;
+
+	if (!(acs = malloc((s->ac.n + 1) * sizeof(struct acent *)))) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	for (i = 0; i < s->ac.size; i++) {
+		struct acent *ac = &s->ac.ents[i];
+
+		if (!(ac->aa & AC_USED))
+			continue;
+		acs[n++] = ac;
+		actotal++;
+		if (ac->extended)
+			acext++;
+		if (ac->adsb)
+			acadsb++;
+	}
+	qsort(acs, n, sizeof(struct acent *), accmp);
+
+	printf("\n");
+	printf("Squitter summary:\n");
+	if (s->ignored > 0)
+		printf("\tIgnored input lines: %lu\n", s->ignored);
+	printf("\tTotal: %lu\n", s->total);
+	printf("\tStandard: %lu (%2.02f%%)\n", s->standard, pct(s->standard, s->total));
+	printf("\tExtended: %lu (%2.02f%%)\n", s->extended, pct(s->extended, s->total));
+	if (s->tr.firststr[0] && s->tr.laststr[0])
+		printf("\tTime range: %s to %s\n", s->tr.firststr, s->tr.laststr);
+	printf("\tDF:\n");
+	for (i = 0; i < 33; i++) {
+		if (s->df[i])
+			printf("\t\t%d\t%lu (%2.02f%%)\n", (int)i - 1, s->df[i], pct(s->df[i], s->total));
+	}
+	printf("\n");
+
+	printf("Aircraft summary:\n");
+	printf("\tTotal: %lu\n", actotal);
+	printf("\tSupport 1090ES: %lu (%2.02f%%)\n", acext, pct(acext, actotal));
+	printf("\tSupport ADS-B: %lu (%2.02f%%)\n", acadsb, pct(acadsb, actotal));
+	printf("\n");
+
+	printf("Airframes:\n");
+	for (i = 0; i < n; i++) {
+		struct acent *ac = acs[i];
+		struct dbrow *db = ac->db, *al;
+
+		printf("\t%15u\t%06X", ac->total, ac->aa & ~AC_USED);
+		if (ac->adsb)
+			printf("\t ADS-B");
+		else if (ac->extended)
+			printf("\t1090ES");
+		else
+			printf("\tMode-S");
+		if (db) {
+			printf("\t%-10s\t%-5s\t%-4s\t%-3s", pstr(db->reg), pstr(db->icaotype),
+			    pstr(db->cyear), pstr(db->registrant));
+			if (db->registrant && (al = findairline(airlines, db->registrant)))
+				printf("\t%-20s", al->callsign ? al->callsign : "");
+		}
+		printf("\n");
+	}
+	free(acs);
+	return;
+}
+
+int
+main(int argc, char *argv[])
+{
+	setappname(argv[0]);
+	struct summary sum;
+	struct mapped *files;
+	struct dbrow *airlines = NULL;
+	struct pool pool;
+	struct worker *workers;
+	size_t bytes = 0, chunklen;
+	char fn[1024];
+	int nfiles, nthreads = 0, c, i;
+
+	while ((c = getopt(argc, argv, "d:j:")) != -1) {
+		switch (c) {
+			case 'd': datadir = optarg; break;
+			case 'j': nthreads = atoi(optarg); break;
+			default: usage(argv[0]);
+		}
+	}
+	if ((nthreads <= 0) && ((nthreads = sysconf(_SC_NPROCESSORS_ONLN)) <= 0))
+		nthreads = 1;
+	crc_init();
+	uhexinit();
+	memset(&sum, 0, sizeof(sum));
+
+	nfiles = (optind < argc) ? (argc - optind) : 1;
+	if (!(files = calloc(nfiles, sizeof(struct mapped)))) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	for (i = 0; i < nfiles; i++) {
+		if (mapfile((optind < argc) ? argv[optind + i] : NULL, &files[i]) == -1)
+			exit(1);
+		bytes += files[i].len;
+	}
+
+	/* a few chunks per thread, so one slow chunk doesn't hold everyone up */
+	memset(&pool, 0, sizeof(pool));
+	pthread_mutex_init(&pool.lock, NULL);
+	if ((chunklen = bytes / (nthreads * 4)) < CHUNK_MIN)
+		chunklen = CHUNK_MIN;
+	mkchunks(&pool, files, nfiles, chunklen);
+	if (nthreads > pool.nchunks)
+		nthreads = pool.nchunks ? pool.nchunks : 1;
+
+	if (!(workers = calloc(nthreads, sizeof(struct worker)))) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	for (i = 0; i < nthreads; i++) {
+		workers[i].pool = &pool;
+		if ((i > 0) && pthread_create(&workers[i].tid, NULL, worker, &workers[i])) {
+			fprintf(stderr, "unable to start thread: %s\n", strerror(errno));
+			exit(1);
+		}
+	}
+	worker(&workers[0]);
+	for (i = 0; i < nthreads; i++) {
+		if (i > 0)
+			pthread_join(workers[i].tid, NULL);
+		merge(&sum, &workers[i].sum);
+		free(workers[i].sum.ac.ents);
+	}
+	for (i = 0; i < pool.nchunks; i++)
+		mergetime(&sum.tr, &pool.chunks[i].tr);
+
+	snprintf(fn, sizeof(fn), "%s/aircraft.txt", datadir);
+	if (dbload(fn, aircraftcols, 5, aircraftrow, &sum) == -1)
+		exit(1);
+	snprintf(fn, sizeof(fn), "%s/airlines.txt", datadir);
+	if (dbload(fn, airlinecols, 2, airlinerow, &airlines) == -1)
+		exit(1);
+
+	report(&sum, airlines);
+	return 0;
+}
@@ -0,0 +1,434 @@
+/*
+ * TCP output server
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "util.h"
+#include "frame.h"
+#include "evloop.h"
+#include "tcp.h"
+#include "beast.h"
+#include "metrics.h"
+
+#define TCP_LINE_MAX 64 /* room for anything we format */
+#define TCP_IOV_MAX 64 /* slots per writev() */
+
+struct tcp_slot {
+	unsigned char len;
+	char data[TCP_LINE_MAX];
+};
+
+struct tcp_client {
+	int fd;
+	struct tcp_listener *l;
+	char addr[INET_ADDRSTRLEN + 6];
+	struct tcp_slot *slots;
+	unsigned int head, tail; /* free running; slots[x & tcp_qmask] */
+	int off; /* bytes of slots[tail] already written */
+	int wantwrite; /* EV_WRITE is on */
+
+	struct tcp_client *next;
+};
+
+struct tcp_listener {
+	int fd;
+	tcp_variant_t variant;
+	char *name;
+
+	struct tcp_listener *next;
+};
+
+static struct tcp_listener *tcp_listeners = NULL;
+static struct tcp_client *tcp_clients = NULL;
+static struct evloop *tcp_ev = NULL;
+static unsigned int tcp_qmask = 4096 - 1;
+static int tcp_policy = TCP_POLICY_DROP;
+static struct tcp_stats tcp_stats;
+
+/* -L [host:]port */
+static int
+tcp_addlistener(const char *host, unsigned short port, tcp_variant_t variant)
+{
+	struct tcp_listener *l;
+	struct sockaddr_in sin;
+	int on = 1;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	sin.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (host) {
+		struct hostent *hp;
+
+		if (!(hp = gethostbyname(host))) {
+			logmsg("unknown host '%s'\n", host);
+			return -1;
+		}
+		memcpy(&sin.sin_addr, hp->h_addr, hp->h_length);
+	}
+
+	if (!(l = (struct tcp_listener *)malloc(sizeof(struct tcp_listener))))
+		return -1;
+	memset(l, 0, sizeof(struct tcp_listener));
+	l->variant = variant;
+	if (!(l->name = malloc(strlen(host ? host : "*") + 7))) {
+		free(l);
+		return -1;
+	}
+	sprintf(l->name, "%s:%u", host ? host : "*", port);
+
+	if ((l->fd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+		logmsg("socket: %s\n", strerror(errno));
+		goto fail;
+	}
+	setsockopt(l->fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if (bind(l->fd, (struct sockaddr *)&sin, sizeof(sin)) == -1) {
+		logmsg("unable to bind %s: %s\n", l->name, strerror(errno));
+		goto fail;
+	}
+	if ((listen(l->fd, 16) == -1) || (fcntl(l->fd, F_SETFL, O_NONBLOCK) == -1)) {
+		logmsg("unable to listen on %s: %s\n", l->name, strerror(errno));
+		goto fail;
+	}
+	l->next = tcp_listeners;
+	tcp_listeners = l;
+	return 0;
+fail:
+	if (l->fd != -1)
+		close(l->fd);
+	free(l->name);
+	free(l);
+	return -1;
+}
+
+int
+tcp_parsearg(const char *optarg)
+{
+	/* -L [host:]port[:variant] */
+	char *buf, *fields[3];
+	tcp_variant_t variant = TCP_RAW;
+	int nfields = 0, port, err = 0;
+	char *cp;
+
+	if (!optarg || !*optarg || !(buf = strdup(optarg)))
+		return -1;
+	for (cp = buf; cp && (nfields < 3); nfields++) {
+		fields[nfields] = cp;
+		if ((cp = index(cp, ':')))
+			*cp++ = '\0';
+	}
+	/* two fields: port:protocol if the first is all digits, else host:port */
+	if ((nfields == 2) && (strspn(fields[0], "0123456789") == strlen(fields[0]))) {
+		fields[2] = fields[1];
+		fields[1] = fields[0];
+		fields[0] = NULL;
+		nfields = 3;
+	} else if (nfields == 1) {
+		fields[1] = fields[0];
+		fields[0] = fields[2] = NULL;
+	} else if (nfields == 2)
+		fields[2] = NULL;
+
+	if ((port = atoi(fields[1])) <= 0 || (port > 65535)) {
+		fprintf(stderr, "invalid TCP port '%s'\n", fields[1]);
+		err = -1; goto out;
+	}
+	if (fields[2]) {
+		if (strcmp(fields[2], "raw") == 0)
+			variant = TCP_RAW;
+		else if (strcmp(fields[2], "planeplotter") == 0)
+			variant = TCP_PLANEPLOTTER;
+		else if (strcmp(fields[2], "beast") == 0)
+			variant = TCP_BEAST;
+		else {
+			fprintf(stderr, "invalid protocol '%s' for TCP port %d\n", fields[2], port);
+			err = -1; goto out;
+		}
+	}
+	if (tcp_addlistener(fields[0], (unsigned short)port, variant) == -1) {
+		fprintf(stderr, "failed to listen on TCP port %d\n", port);
+		err = -1; goto out;
+	}
+out:
+	free(buf);
+	return err;
+}
+
+/* per-client queue length (rounded up to a power of 2), and what to do when it's full */
+void
+tcp_setqueue(int frames, int policy)
+{
+	unsigned int n;
+
+	for (n = 2; n < frames; n <<= 1)
+		;
+	tcp_qmask = n - 1;
+	tcp_policy = policy;
+	return;
+}
+
+/* from any thread */
+void
+tcp_getstats(struct tcp_stats *st)
+{
+	st->clients = MET_GET(tcp_stats.clients);
+	st->accepted = MET_GET(tcp_stats.accepted);
+	st->frames = MET_GET(tcp_stats.frames);
+	st->dropped = MET_GET(tcp_stats.dropped);
+	st->kicked = MET_GET(tcp_stats.kicked);
+	return;
+}
+
+static void
+tcp_close(struct tcp_client *c, const char *why)
+{
+	struct tcp_client **cp;
+
+	logmsg("%s: %s\n", c->addr, why);
+	for (cp = &tcp_clients; *cp; cp = &(*cp)->next) {
+		if (*cp == c) {
+			*cp = c->next;
+			break;
+		}
+	}
+	ev_delfd(tcp_ev, c->fd);
+	close(c->fd);
+	free(c->slots);
+	free(c);
+	MET_ADD(tcp_stats.clients, -1);
+	return;
+}
+
+/* write what the client will take. returns -1 if it's been closed */
+static int
+tcp_write(struct tcp_client *c)
+{
+	while (c->head != c->tail) {
+		struct iovec iov[TCP_IOV_MAX];
+		unsigned int i;
+		int n = 0;
+		ssize_t w;
+
+		for (i = c->tail; (i != c->head) && (n < TCP_IOV_MAX); i++, n++) {
+			struct tcp_slot *s = &c->slots[i & tcp_qmask];
+			int off = n ? 0 : c->off;
+
+			iov[n].iov_base = s->data + off;
+			iov[n].iov_len = s->len - off;
+		}
+		if ((w = writev(c->fd, iov, n)) == -1) {
+			if (errno == EINTR)
+				continue;
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				break;
+			tcp_close(c, strerror(errno));
+			return -1;
+		}
+		/* retire whole slots, remember where we are in a partial one */
+		for (i = 0; (i < n) && (w >= iov[i].iov_len); i++) {
+			w -= iov[i].iov_len;
+			c->tail++;
+			c->off = 0;
+		}
+		if (i < n) {
+			c->off += w;
+			break; /* short write, the socket's full */
+		}
+	}
+	if ((c->head != c->tail) != c->wantwrite) {
+		c->wantwrite = !c->wantwrite;
+		ev_modfd(tcp_ev, c->fd, EV_READ | (c->wantwrite ? EV_WRITE : 0));
+	}
+	return 0;
+}
+
+static void
+tcp_clientev(void *arg, int fd, int events)
+{
+	struct tcp_client *c = (struct tcp_client *)arg;
+
+	if (events & (EV_READ | EV_ERROR)) {
+		char buf[256];
+		ssize_t n;
+
+		/* nothing's expected from clients; just notice when they go */
+		while ((n = read(fd, buf, sizeof(buf))) > 0)
+			;
+		if (n == 0) {
+			tcp_close(c, "disconnected");
+			return;
+		}
+		if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+			tcp_close(c, strerror(errno));
+			return;
+		}
+	}
+	if (events & EV_WRITE)
+		tcp_write(c);
+	return;
+}
+
+static void
+tcp_accept(void *arg, int fd, int events)
+{
+	struct tcp_listener *l = (struct tcp_listener *)arg;
+
+	for (;;) {
+		struct sockaddr_in sin;
+		socklen_t sinlen = sizeof(sin);
+		struct tcp_client *c;
+		int cfd, on = 1;
+
+		if ((cfd = accept(fd, (struct sockaddr *)&sin, &sinlen)) == -1) {
+			if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+				logmsg("accept on %s: %s\n", l->name, strerror(errno));
+			return;
+		}
+		fcntl(cfd, F_SETFL, O_NONBLOCK);
+		setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+		if (!(c = (struct tcp_client *)malloc(sizeof(struct tcp_client)))) {
+			close(cfd);
+			continue;
+		}
+		memset(c, 0, sizeof(struct tcp_client));
+		c->fd = cfd;
+		c->l = l;
+		snprintf(c->addr, sizeof(c->addr), "%s:%u", inet_ntoa(sin.sin_addr),
+		    ntohs(sin.sin_port));
+		if (!(c->slots = malloc((tcp_qmask + 1) * sizeof(struct tcp_slot))) ||
+		    (ev_addfd(tcp_ev, cfd, EV_READ, tcp_clientev, c) == -1)) {
+			free(c->slots);
+			free(c);
+			close(cfd);
+			continue;
+		}
+		c->next = tcp_clients;
+		tcp_clients = c;
+		MET_ADD(tcp_stats.clients, 1);
+		MET_ADD(tcp_stats.accepted, 1);
+		logmsg("%s: connected to %s\n", c->addr, l->name);
+	}
+}
+
+int
+tcp_start(struct evloop *ev)
+{
+	struct tcp_listener *l;
+
+	tcp_ev = ev;
+	for (l = tcp_listeners; l; l = l->next) {
+		if (ev_addfd(ev, l->fd, EV_READ, tcp_accept, l) == -1)
+			return -1;
+	}
+	return 0;
+}
+
+void
+tcp_stop(void)
+{
+	while (tcp_clients) {
+		struct tcp_client *c = tcp_clients;
+
+		/* anything that'll go without waiting; it's gone already if that failed */
+		if (tcp_write(c) == 0)
+			tcp_close(c, "shutting down");
+	}
+	while (tcp_listeners) {
+		struct tcp_listener *l = tcp_listeners;
+
+		tcp_listeners = l->next;
+		if (tcp_ev)
+			ev_delfd(tcp_ev, l->fd);
+		close(l->fd);
+		free(l->name);
+		free(l);
+	}
+	return;
+}
+
+/* queue a frame for every client. doesn't write anything; see tcp_flush() */
+int
+tcp_send(const struct frame *f)
+{
+	struct tcp_client *c, *next;
+	char line[TCP_LINE_MAX];
+	unsigned char beast[BEAST_MAX];
+	int len, beastlen = 0;
+
+	if (!tcp_clients)
+		return 0;
+	if ((f->len != MODES_SHORT_LEN) && (f->len != MODES_LONG_LEN))
+		return -1;
+
+	/* only format it once; raw clients skip the AV */
+	memcpy(line, "AV*", 3);
+	len = 3 + hexencode(line + 3, f->data, f->len);
+	line[len++] = ';';
+	line[len++] = '\n';
+
+	for (c = tcp_clients; c; c = next) {
+		int skip = (c->l->variant == TCP_PLANEPLOTTER) ? 0 : 2;
+		struct tcp_slot *s;
+
+		/* likewise beast, the first time someone wants it */
+		if ((c->l->variant == TCP_BEAST) && !beastlen)
+			beastlen = beast_encode(beast, f);
+
+		next = c->next;
+		/* full, but maybe only because it hasn't been flushed lately */
+		if ((c->head - c->tail > tcp_qmask) && !c->wantwrite && (tcp_write(c) == -1))
+			continue;
+		if (c->head - c->tail > tcp_qmask) {
+			if (tcp_policy == TCP_POLICY_DISCONNECT) {
+				MET_ADD(tcp_stats.kicked, 1);
+				tcp_close(c, "too far behind, disconnecting");
+				continue;
+			}
+			/*
+			 * drop the oldest. if it's half written, it has to be
+			 * finished, so it takes the place of the next oldest.
+			 */
+			if (c->off)
+				c->slots[(c->tail + 1) & tcp_qmask] = c->slots[c->tail & tcp_qmask];
+			c->tail++;
+			MET_ADD(tcp_stats.dropped, 1);
+		}
+		s = &c->slots[c->head++ & tcp_qmask];
+		if (c->l->variant == TCP_BEAST) {
+			s->len = beastlen;
+			memcpy(s->data, beast, beastlen);
+		} else {
+			s->len = len - skip;
+			memcpy(s->data, line + skip, len - skip);
+		}
+		MET_ADD(tcp_stats.frames, 1);
+	}
+	return 0;
+}
+
+/* write out what's been queued, to everyone that isn't already waiting to be writable */
+void
+tcp_flush(void)
+{
+	struct tcp_client *c, *next;
+
+	for (c = tcp_clients; c; c = next) {
+		next = c->next;
+		if ((c->head != c->tail) && !c->wantwrite)
+			tcp_write(c);
+	}
+	return;
+}
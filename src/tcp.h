@@ -0,0 +1,41 @@
+#ifndef __MODES_TCP_H__
+#define __MODES_TCP_H__
+
+/*
+ * TCP fan-out.  Each client gets its own queue of formatted frames;
+ * tcp_send() only queues, tcp_flush() writes each client what it'll take
+ * without blocking, and the event loop finishes the job.  A client that
+ * lets its queue fill either loses its oldest frames or is disconnected,
+ * so a slow one only ever costs itself.
+ */
+
+#include "frame.h"
+#include "evloop.h"
+
+typedef enum tcp_variant {
+	TCP_RAW = 0,
+	TCP_PLANEPLOTTER = 1,
+	TCP_BEAST = 2,
+} tcp_variant_t;
+
+#define TCP_POLICY_DROP 0 /* drop the oldest queued frames */
+#define TCP_POLICY_DISCONNECT 1
+
+/* cumulative; written by the output thread only */
+struct tcp_stats {
+	int clients; /* connected now */
+	unsigned long accepted;
+	unsigned long frames; /* queued, summed over clients */
+	unsigned long dropped; /* frames lost to full queues */
+	unsigned long kicked; /* clients disconnected for falling behind */
+};
+
+int tcp_parsearg(const char *optarg);
+void tcp_setqueue(int frames, int policy);
+int tcp_start(struct evloop *ev);
+void tcp_stop(void);
+int tcp_send(const struct frame *f);
+void tcp_flush(void);
+void tcp_getstats(struct tcp_stats *st);
+
+#endif /* ndef __MODES_TCP_H__ */
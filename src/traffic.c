@@ -0,0 +1,427 @@
+/*
+ * Synthetic traffic generator; see traffic.h.
+ *
+ * Every aircraft has one pending event per kind of message, and they all
+ * live in one binary heap ordered by when they're due, so the next frame
+ * is always the top of the heap.  An aircraft's position is only brought
+ * up to date when it's about to say something.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/time.h>
+
+#include "util.h"
+#include "crc.h"
+#include "cpr.h"
+#include "traffic.h"
+
+/* usecs between squitters; each is jittered +/-20%, like the real thing */
+#define TR_POSPERIOD 500000
+#define TR_VELPERIOD 500000
+#define TR_IDENTPERIOD 5000000
+#define TR_ACQPERIOD 1000000
+
+#define TR_POS 0
+#define TR_VEL 1
+#define TR_IDENT 2
+#define TR_ACQ 3
+#define TR_REPLY 4
+#define TR_KINDS 5
+
+struct tr_ac {
+	unsigned int addr;
+	char ident[8]; /* space padded */
+	unsigned int squawk; /* octal digits as hex */
+	double lat, lon; /* degrees */
+	double alt; /* feet */
+	double gs; /* knots */
+	double track; /* degrees */
+	double vrate; /* ft/min */
+	unsigned long long moved; /* when the above were brought up to date */
+	int odd; /* the next position's CPR format */
+};
+
+struct tr_ev {
+	unsigned long long due; /* usecs of simulated time */
+	int ac;
+	int kind;
+};
+
+struct traffic {
+	struct tr_ac *acs;
+	int nac;
+	struct tr_ev *heap;
+	int nheap;
+	double clat, clon;
+	double replyperiod; /* usecs, per aircraft; 0 for none */
+	double biterrors; /* fraction of frames to damage */
+	unsigned long long now;
+	struct timeval start;
+	unsigned long long seqnum;
+	unsigned long long rng;
+};
+
+static const char identchars[64] =
+    "#ABCDEFGHIJKLMNOPQRSTUVWXYZ##### ###############0123456789######";
+static const char *airlines[] = {
+	"AAL", "UAL", "DAL", "SWA", "ASA", "JBU", "SKW", "FDX", "UPS", "BAW",
+	"DLH", "AFR", "KLM", "ACA", "QFA", "ANA", "JAL", "CPA", "UAE", "SIA",
+};
+
+/* xorshift64*; the C library's is locked, and not the same everywhere */
+static unsigned long long
+trrand(struct traffic *tr)
+{
+	tr->rng ^= tr->rng >> 12;
+	tr->rng ^= tr->rng << 25;
+	tr->rng ^= tr->rng >> 27;
+	return tr->rng * 2685821657736338717ULL;
+}
+
+/* [0, 1) */
+static double
+trunif(struct traffic *tr)
+{
+	return (trrand(tr) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void
+heapdown(struct traffic *tr, int i)
+{
+	struct tr_ev e = tr->heap[i];
+
+	for (;;) {
+		int c = 2*i + 1;
+
+		if (c >= tr->nheap)
+			break;
+		if ((c + 1 < tr->nheap) && (tr->heap[c + 1].due < tr->heap[c].due))
+			c++;
+		if (e.due <= tr->heap[c].due)
+			break;
+		tr->heap[i] = tr->heap[c];
+		i = c;
+	}
+	tr->heap[i] = e;
+	return;
+}
+
+static double
+period(struct traffic *tr, int kind)
+{
+	switch (kind) {
+	case TR_POS: return TR_POSPERIOD;
+	case TR_VEL: return TR_VELPERIOD;
+	case TR_IDENT: return TR_IDENTPERIOD;
+	case TR_ACQ: return TR_ACQPERIOD;
+	}
+	return tr->replyperiod;
+}
+
+static void
+newac(struct traffic *tr, int i)
+{
+	struct tr_ac *ac = &tr->acs[i];
+	double r = TR_RADIUS * sqrt(trunif(tr)), b = 2 * M_PI * trunif(tr);
+	int k, n;
+
+	/* spread over the whole address space, but never the same twice */
+	ac->addr = ((i + 1) * 0x9e3779U) & 0xffffff;
+	n = snprintf(ac->ident, sizeof(ac->ident), "%s%d",
+	    airlines[trrand(tr) % (sizeof(airlines) / sizeof(airlines[0]))],
+	    (int)(1 + trrand(tr) % 9999));
+	memset(ac->ident + n, ' ', sizeof(ac->ident) - n);
+	for (ac->squawk = 0, k = 0; k < 4; k++)
+		ac->squawk = (ac->squawk << 4) | (trrand(tr) % 8);
+
+	ac->lat = tr->clat + r * cos(b) / 60;
+	ac->lon = tr->clon + r * sin(b) / (60 * cos(tr->clat * M_PI / 180));
+	/* most at cruise, the rest on their way up or down */
+	if (trunif(tr) < 0.7) {
+		ac->alt = 28000 + 13000 * trunif(tr);
+		ac->vrate = 0;
+	} else {
+		ac->alt = 2000 + 26000 * trunif(tr);
+		ac->vrate = (500 + 2500 * trunif(tr)) * ((trunif(tr) < 0.5) ? -1 : 1);
+	}
+	ac->gs = 160 + ac->alt * 0.008 + 60 * trunif(tr);
+	ac->track = 360 * trunif(tr);
+	ac->odd = trrand(tr) & 1;
+	ac->moved = 0;
+	return;
+}
+
+struct traffic *
+tr_new(int naircraft, double lat, double lon, double replies, double biterrors,
+    unsigned int seed)
+{
+	struct traffic *tr;
+	int i, k;
+
+	if (naircraft <= 0)
+		return NULL;
+	if (!(tr = (struct traffic *)malloc(sizeof(struct traffic))))
+		return NULL;
+	memset(tr, 0, sizeof(struct traffic));
+	if (!(tr->acs = (struct tr_ac *)malloc(naircraft * sizeof(struct tr_ac))) ||
+	    !(tr->heap = (struct tr_ev *)malloc(naircraft * TR_KINDS * sizeof(struct tr_ev)))) {
+		tr_free(tr);
+		return NULL;
+	}
+	tr->nac = naircraft;
+	tr->clat = lat;
+	tr->clon = lon;
+	tr->replyperiod = (replies > 0) ? (1000000 / replies) : 0;
+	tr->biterrors = biterrors;
+	tr->rng = 0x853c49e6748fea9bULL ^ seed;
+	gettimeofday(&tr->start, NULL);
+
+	for (i = 0; i < naircraft; i++) {
+		newac(tr, i);
+		for (k = 0; k < TR_KINDS; k++) {
+			if (period(tr, k) == 0)
+				continue;
+			tr->heap[tr->nheap].due = period(tr, k) * trunif(tr);
+			tr->heap[tr->nheap].ac = i;
+			tr->heap[tr->nheap].kind = k;
+			tr->nheap++;
+		}
+	}
+	for (i = tr->nheap / 2 - 1; i >= 0; i--)
+		heapdown(tr, i);
+	return tr;
+}
+
+void
+tr_free(struct traffic *tr)
+{
+	if (!tr)
+		return;
+	free(tr->acs);
+	free(tr->heap);
+	free(tr);
+	return;
+}
+
+/* usecs of simulated time, as of the last frame */
+unsigned long long
+tr_now(const struct traffic *tr)
+{
+	return tr->now;
+}
+
+static void
+move(struct traffic *tr, struct tr_ac *ac)
+{
+	double dt = (tr->now - ac->moved) / 1e6;
+	double nm = ac->gs * dt / 3600, rad = ac->track * M_PI / 180;
+	double dn, de;
+
+	ac->moved = tr->now;
+	ac->lat += nm * cos(rad) / 60;
+	ac->lon += nm * sin(rad) / (60 * cos(ac->lat * M_PI / 180));
+	ac->alt += ac->vrate * dt / 60;
+	if ((ac->alt > 41000) || (ac->alt < 1000)) {
+		ac->alt = (ac->alt > 41000) ? 41000 : 1000;
+		ac->vrate = -ac->vrate;
+	}
+	/* turn back in, roughly, at the edge */
+	dn = (tr->clat - ac->lat) * 60;
+	de = (tr->clon - ac->lon) * 60 * cos(ac->lat * M_PI / 180);
+	if ((dn * dn + de * de) > (TR_RADIUS * TR_RADIUS)) {
+		ac->track = atan2(de, dn) * 180 / M_PI + 60 * (trunif(tr) - 0.5);
+		if (ac->track < 0)
+			ac->track += 360;
+	}
+	return;
+}
+
+/* 25ft steps, with the Q bit; 13 bits with the M bit in, 12 without */
+static unsigned int
+ac13(double alt)
+{
+	unsigned int n = (alt + 1000 + 12.5) / 25;
+
+	return ((n & 0x7e0) << 2) | ((n & 0x10) << 1) | 0x10 | (n & 0xf);
+}
+
+static unsigned int
+ac12(double alt)
+{
+	unsigned int n = (alt + 1000 + 12.5) / 25;
+
+	return ((n & 0x7f0) << 1) | 0x10 | (n & 0xf);
+}
+
+/* modes_id13() backwards */
+static unsigned int
+id13(unsigned int a)
+{
+	unsigned int id = 0;
+
+	if (a & 0x0010) id |= 0x1000; /* C1 */
+	if (a & 0x1000) id |= 0x0800; /* A1 */
+	if (a & 0x0020) id |= 0x0400; /* C2 */
+	if (a & 0x2000) id |= 0x0200; /* A2 */
+	if (a & 0x0040) id |= 0x0100; /* C4 */
+	if (a & 0x4000) id |= 0x0080; /* A4 */
+	if (a & 0x0100) id |= 0x0020; /* B1 */
+	if (a & 0x0001) id |= 0x0010; /* D1 */
+	if (a & 0x0200) id |= 0x0008; /* B2 */
+	if (a & 0x0002) id |= 0x0004; /* D2 */
+	if (a & 0x0400) id |= 0x0002; /* B4 */
+	if (a & 0x0004) id |= 0x0001; /* D4 */
+	return id;
+}
+
+/* 8 six bit characters into 6 bytes */
+static void
+packident(unsigned char *p, const char *ident)
+{
+	unsigned int c[8];
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		const char *cp = memchr(identchars + 1, ident[i], sizeof(identchars) - 1);
+		c[i] = cp ? (cp - identchars) : 32;
+	}
+	for (i = 0; i < 8; i += 4, p += 3) {
+		p[0] = (c[i] << 2) | (c[i + 1] >> 4);
+		p[1] = (c[i + 1] << 4) | (c[i + 2] >> 2);
+		p[2] = (c[i + 2] << 6) | c[i + 3];
+	}
+	return;
+}
+
+static void
+squitter(struct frame *f, const struct tr_ac *ac)
+{
+	f->data[0] = (17 << 3) | 5; /* CA 5: airborne */
+	f->data[1] = ac->addr >> 16;
+	f->data[2] = ac->addr >> 8;
+	f->data[3] = ac->addr;
+	return;
+}
+
+static void
+position(struct frame *f, struct tr_ac *ac)
+{
+	unsigned char *me = f->data + 4;
+	unsigned int alt = ac12(ac->alt), lat, lon;
+
+	squitter(f, ac);
+	cpr_encode(ac->lat, ac->lon, ac->odd, &lat, &lon);
+	me[0] = 11 << 3; /* TC 11: baro altitude, NUCp 7 */
+	me[1] = alt >> 4;
+	me[2] = ((alt & 0xf) << 4) | (ac->odd << 2) | (lat >> 15);
+	me[3] = lat >> 7;
+	me[4] = ((lat & 0x7f) << 1) | (lon >> 16);
+	me[5] = lon >> 8;
+	me[6] = lon;
+	ac->odd ^= 1;
+	return;
+}
+
+static void
+velocity(struct frame *f, const struct tr_ac *ac)
+{
+	unsigned char *me = f->data + 4;
+	double rad = ac->track * M_PI / 180;
+	int ew = (int)(ac->gs * sin(rad) + ((ac->gs * sin(rad) < 0) ? -0.5 : 0.5));
+	int ns = (int)(ac->gs * cos(rad) + ((ac->gs * cos(rad) < 0) ? -0.5 : 0.5));
+	int vr = (int)(fabs(ac->vrate) / 64 + 0.5) + 1;
+	int aew = abs(ew) + 1, ans = abs(ns) + 1;
+
+	aew = (aew > 1023) ? 1023 : aew;
+	ans = (ans > 1023) ? 1023 : ans;
+	vr = (vr > 511) ? 511 : vr;
+	squitter(f, ac);
+	me[0] = (19 << 3) | 1; /* subsonic ground speed */
+	me[1] = (1 << 3) | ((ew < 0) << 2) | (aew >> 8); /* NUCr 1 */
+	me[2] = aew;
+	me[3] = ((ns < 0) << 7) | (ans >> 3);
+	me[4] = ((ans & 0x7) << 5) | ((ac->vrate < 0) << 3) | (vr >> 6);
+	me[5] = (vr & 0x3f) << 2;
+	me[6] = 0;
+	return;
+}
+
+static void
+identification(struct frame *f, const struct tr_ac *ac)
+{
+	squitter(f, ac);
+	f->data[4] = (4 << 3) | 3; /* category A3, large */
+	packident(f->data + 5, ac->ident);
+	return;
+}
+
+static void
+reply(struct traffic *tr, struct frame *f, const struct tr_ac *ac)
+{
+	unsigned int r = trrand(tr) % 100;
+	int df = (r < 35) ? 4 : (r < 70) ? 5 : (r < 85) ? 20 : 21;
+	unsigned int code = ((df == 4) || (df == 20)) ? ac13(ac->alt) : id13(ac->squawk);
+
+	f->data[0] = df << 3; /* FS 0: airborne, no alert */
+	f->data[1] = 0;
+	f->data[2] = code >> 8;
+	f->data[3] = code;
+	if (df >= 20) {
+		f->data[4] = 0x20; /* BDS 2,0: aircraft identification */
+		packident(f->data + 5, ac->ident);
+	}
+	return;
+}
+
+/* the next frame, in simulated time order */
+void
+tr_next(struct traffic *tr, struct frame *f)
+{
+	struct tr_ev *e = &tr->heap[0];
+	struct tr_ac *ac = &tr->acs[e->ac];
+	unsigned int crc;
+	unsigned long long usec;
+
+	memset(f, '\0', sizeof(struct frame));
+	tr->now = e->due;
+	move(tr, ac);
+	switch (e->kind) {
+	case TR_POS: position(f, ac); break;
+	case TR_VEL: velocity(f, ac); break;
+	case TR_IDENT: identification(f, ac); break;
+	case TR_ACQ:
+		f->data[0] = (11 << 3) | 5;
+		f->data[1] = ac->addr >> 16;
+		f->data[2] = ac->addr >> 8;
+		f->data[3] = ac->addr;
+		break;
+	default: reply(tr, f, ac); break;
+	}
+	f->df = MODES_DF(f->data[0]);
+	f->len = MODES_DFLEN(f->df);
+
+	/* PI for squitters (interrogator 0), AP for replies */
+	crc = modes_crc(f->data, f->len - 3);
+	if ((f->df != 11) && (f->df != 17))
+		crc ^= ac->addr;
+	f->data[f->len - 3] = crc >> 16;
+	f->data[f->len - 2] = crc >> 8;
+	f->data[f->len - 1] = crc;
+	if ((tr->biterrors > 0) && (trunif(tr) < tr->biterrors))
+		f->data[trrand(tr) % f->len] ^= 1 << (trrand(tr) % 8);
+
+	usec = tr->start.tv_usec + tr->now;
+	f->rxstart.tv_sec = tr->start.tv_sec + usec / 1000000;
+	f->rxstart.tv_usec = usec % 1000000;
+	f->rxend = f->rxstart;
+	f->ticks = (tr->now * 12) & 0xffffffffffffULL;
+	f->mlat = f->ticks;
+	f->seqnum = tr->seqnum++;
+
+	e->due += period(tr, e->kind) * (0.8 + 0.4 * trunif(tr));
+	heapdown(tr, 0);
+	return;
+}
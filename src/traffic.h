@@ -0,0 +1,34 @@
+
+#ifndef __MODES_TRAFFIC_H__
+#define __MODES_TRAFFIC_H__
+
+/*
+ * Synthetic Mode-S traffic, for load testing.  Some number of aircraft fly
+ * around a centre point at plausible altitudes, speeds and climb rates,
+ * each sending about what a real transponder would:
+ *
+ *	DF17 airborne position		2/sec, alternating even and odd CPR
+ *	DF17 airborne velocity		2/sec
+ *	DF17 identification		1/5sec
+ *	DF11 acquisition squitter	1/sec
+ *	DF4/5/20/21 replies		as many a second as asked for
+ *
+ * all with good parity (and a given fraction with a bit flipped on the
+ * way).  Frames come out in time order, stamped with simulated time from
+ * when tr_new() was called, with 12MHz ticks and a frame counter, so the
+ * caller decides how fast to actually send them.
+ */
+
+#include "frame.h"
+
+#define TR_RADIUS 200.0 /* NM they stay within */
+
+struct traffic;
+
+extern struct traffic *tr_new(int naircraft, double lat, double lon, double replies,
+    double biterrors, unsigned int seed);
+extern void tr_free(struct traffic *tr);
+extern void tr_next(struct traffic *tr, struct frame *f);
+extern unsigned long long tr_now(const struct traffic *tr);
+
+#endif /* ndef __MODES_TRAFFIC_H__ */
@@ -1,14 +1,20 @@
 
+#define _GNU_SOURCE /* sendmmsg() */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/uio.h>
+#include <sys/time.h>
 #include <netdb.h>
 #include <errno.h>
 
 #include "util.h"
+#include "frame.h"
 #include "udp.h"
+#include "beast.h"
+#include "metrics.h"
 
 struct udp_target {
 	char *host;
@@ -16,11 +22,38 @@ struct udp_target {
 	udp_variant_t variant;
 	struct sockaddr_in sin;
 	int fd;
+	struct udp_tstats st;
 
 	struct udp_target *next;
 };
 static struct udp_target *udp_targets = NULL;
 
+#ifdef __linux__
+#define HAVE_SENDMMSG
+#endif
+
+/*
+ * Frames are queued (already formatted, once, for all targets) and each
+ * target gets the whole queue in one sendmmsg() when it's flushed.
+ */
+#define UDP_QUEUE_MAX 256
+#define UDP_LINE_MAX (2 + 1 + 2*MODES_LONG_LEN + 1)
+#define UDP_PACK_LINES 32 /* 32 long squitters still fit in one ethernet frame */
+struct udp_queued {
+	char line[UDP_LINE_MAX + 1]; /* "AV*<hex>;\n"; raw targets skip the AV */
+	int len; /* not counting the \n */
+	unsigned char beast[BEAST_MAX]; /* only if there are beast targets */
+	int beastlen;
+	struct timeval enq;
+};
+static struct udp_queued udp_queue[UDP_QUEUE_MAX];
+static int udp_qlen = 0;
+static int udp_batch = 1; /* flush when this many are queued... */
+static int udp_window = 0; /* ...or the oldest is this many msecs old */
+static int udp_pack = 0; /* newline-separate several lines per datagram */
+static int udp_beast = 0; /* targets wanting beast */
+static struct udp_stats udp_stats;
+
 static struct udp_target *
 udp_target_alloc(const char *host, unsigned short port, udp_variant_t variant)
 {
@@ -91,6 +124,8 @@ udp_addport(const char *host, unsigned short port, udp_variant_t variant)
 
 	ut->next = udp_targets;
 	udp_targets = ut;
+	if (variant == UDP_BEAST)
+		udp_beast++;
 
 	return 0;
 }
@@ -104,54 +139,203 @@ udp_clearports(void)
 		udp_target_free(ut);
 		ut = nut;
 	}
+	/* udp_send() and udp_flush() go by this; leave nothing freed on it */
+	udp_targets = NULL;
+	udp_beast = 0;
 	return;
 }
 
-int
-udp_send(char *raw)
+void
+udp_setbatch(int frames, int msecs, int pack)
+{
+	if ((frames <= 0) || (frames > UDP_QUEUE_MAX))
+		frames = UDP_QUEUE_MAX;
+	udp_batch = frames;
+	udp_window = (msecs > 0) ? msecs : 0;
+	udp_pack = pack;
+	return;
+}
+
+void
+udp_getstats(struct udp_stats *st, int reset)
+{
+	*st = udp_stats;
+	if (reset)
+		memset(&udp_stats, 0, sizeof(udp_stats));
+	return;
+}
+
+/* for metrics; the target list doesn't change once we're running */
+void
+udp_foreach(void (*cb)(void *arg, const char *host, unsigned short port,
+    const struct udp_tstats *ts), void *arg)
 {
 	struct udp_target *ut;
-	int err = 0;
 
-	/* sanity */
-	if (NULL == raw) {
-		logmsg("udp_send(): null packet\n");
-		return -1;
-	}
-	int rLen = strlen(raw);
-	if (14 != rLen && 28 != rLen) {
-		logmsg("udp_send(%s): len=%d not 14 or 28\n", raw, rLen);
-		return -1;
+	for (ut = udp_targets; ut; ut = ut->next) {
+		struct udp_tstats ts;
+
+		ts.datagrams = MET_GET(ut->st.datagrams);
+		ts.frames = MET_GET(ut->st.frames);
+		ts.bytes = MET_GET(ut->st.bytes);
+		ts.errors = MET_GET(ut->st.errors);
+		ts.partial = MET_GET(ut->st.partial);
+		cb(arg, ut->host, ut->port, &ts);
 	}
+	return;
+}
 
-	for (ut = udp_targets; ut; ut = ut->next) {
-		struct iovec iov[4];
-		int n = 0;
-		int want = rLen + 2;
+static long
+udp_age(const struct timeval *now, const struct timeval *then)
+{
+	return (now->tv_sec - then->tv_sec) * 1000000L +
+	    (now->tv_usec - then->tv_usec);
+}
 
-		if (UDP_PLANEPLOTTER == ut->variant) {
-			iov[n].iov_base = "AV"; iov[n++].iov_len = 2;
-			want += 2;
+static int
+udp_flushtarget(struct udp_target *ut)
+{
+#ifdef HAVE_SENDMMSG
+	struct mmsghdr msgs[UDP_QUEUE_MAX];
+#else
+	struct msghdr msgs[UDP_QUEUE_MAX];
+#endif
+	struct iovec iov[UDP_QUEUE_MAX];
+	int skip = (UDP_PLANEPLOTTER == ut->variant) ? 0 : 2;
+	int nmsgs = 0, sent = 0, i;
+
+	for (i = 0; i < udp_qlen; i++) {
+		if (UDP_BEAST == ut->variant) {
+			/* self-delimiting, so packing needs no separator */
+			iov[i].iov_base = udp_queue[i].beast;
+			iov[i].iov_len = udp_queue[i].beastlen;
+		} else {
+			/* the \n only between lines, not after a datagram's last */
+			iov[i].iov_base = udp_queue[i].line + skip;
+			iov[i].iov_len = udp_queue[i].len - skip +
+			    ((udp_pack && (i + 1 < udp_qlen) && ((i + 1) % UDP_PACK_LINES)) ? 1 : 0);
 		}
-		iov[n].iov_base = "*"; iov[n++].iov_len = 1;
-		iov[n].iov_base = raw; iov[n++].iov_len = rLen;
-		iov[n].iov_base = ";"; iov[n++].iov_len = 1;
+		if (!udp_pack || ((i % UDP_PACK_LINES) == 0)) {
+			memset(&msgs[nmsgs], 0, sizeof(msgs[0]));
+#ifdef HAVE_SENDMMSG
+			msgs[nmsgs].msg_hdr.msg_iov = &iov[i];
+#else
+			msgs[nmsgs].msg_iov = &iov[i];
+#endif
+			nmsgs++;
+		}
+#ifdef HAVE_SENDMMSG
+		msgs[nmsgs - 1].msg_hdr.msg_iovlen++;
+#else
+		msgs[nmsgs - 1].msg_iovlen++;
+#endif
+	}
 
-		int w = writev(ut->fd, iov, n);
-		err++; /* presume the worst */
-		if (-1 == w)
-			logmsg("writev(%s:%d): %s\n", ut->host, ut->port,
+	while (sent < nmsgs) {
+#ifdef HAVE_SENDMMSG
+		int n = sendmmsg(ut->fd, msgs + sent, nmsgs - sent, 0);
+#else
+		int n = (sendmsg(ut->fd, msgs + sent, 0) == -1) ? -1 : 1;
+#endif
+		udp_stats.syscalls++;
+		if (-1 == n) {
+			if (EINTR == errno)
+				continue;
+			logmsg("send(%s:%d): %s\n", ut->host, ut->port,
 			    strerror(errno));
-		else if (w != want)
-			logmsg("writev(%s:%d)=%d wanted=%d\n",
-			    ut->host, ut->port, w, want);
-		else
-			err--; /* false alarm */
+			udp_stats.errors++;
+			MET_ADD(ut->st.errors, 1);
+			return -1;
+		}
+		if (sent + n < nmsgs)
+			MET_ADD(ut->st.partial, 1);
+		sent += n;
+	}
+	MET_ADD(ut->st.datagrams, nmsgs);
+	MET_ADD(ut->st.frames, udp_qlen);
+	for (i = 0; i < udp_qlen; i++)
+		MET_ADD(ut->st.bytes, iov[i].iov_len);
+	return 0;
+}
+
+/* send everything queued to every target. returns -(targets with errors) */
+int
+udp_flush(void)
+{
+	struct udp_target *ut;
+	struct timeval now;
+	int err = 0;
+
+	if (0 == udp_qlen)
+		return 0;
+
+	for (ut = udp_targets; ut; ut = ut->next) {
+		if (udp_flushtarget(ut) < 0)
+			err++;
 	}
 
+	gettimeofday(&now, NULL);
+	long lat = udp_age(&now, &udp_queue[0].enq);
+	udp_stats.batches++;
+	udp_stats.frames += udp_qlen;
+	udp_stats.latsum += lat;
+	if (lat > udp_stats.latmax)
+		udp_stats.latmax = lat;
+	udp_qlen = 0;
+
 	return -err;
 }
 
+/*
+ * msecs until the queue has to be flushed, or -1 if there's nothing queued
+ * (or no window set, in which case only a full batch flushes it)
+ */
+int
+udp_flushwait(void)
+{
+	struct timeval now;
+	long left;
+
+	if ((0 == udp_qlen) || (0 == udp_window))
+		return -1;
+	gettimeofday(&now, NULL);
+	left = udp_window - (udp_age(&now, &udp_queue[0].enq) / 1000);
+	return (left > 0) ? (int)left : 0;
+}
+
+int
+udp_send(const struct frame *f)
+{
+	struct udp_queued *q;
+
+	/* sanity */
+	if (NULL == f) {
+		logmsg("udp_send(): null packet\n");
+		return -1;
+	}
+	if (MODES_SHORT_LEN != f->len && MODES_LONG_LEN != f->len) {
+		logmsg("udp_send(): len=%d not %d or %d\n", f->len,
+		    MODES_SHORT_LEN, MODES_LONG_LEN);
+		return -1;
+	}
+	if (NULL == udp_targets)
+		return 0;
+
+	/* only format the hex once, for all targets */
+	q = &udp_queue[udp_qlen++];
+	memcpy(q->line, "AV*", 3);
+	q->len = 3 + hexencode(q->line + 3, f->data, f->len);
+	q->line[q->len++] = ';';
+	q->line[q->len] = '\n';
+	if (udp_beast)
+		q->beastlen = beast_encode(q->beast, f);
+	gettimeofday(&q->enq, NULL);
+
+	if ((udp_qlen >= udp_batch) || (udp_flushwait() == 0))
+		return udp_flush();
+	return 0;
+}
+
 int
 udp_send2(char *raw)
 {
@@ -223,6 +407,8 @@ udp_parsearg(const char *optarg)
 			variant = UDP_RAW;
 		else if (strcmp(vstr, "planeplotter") == 0)
 			variant = UDP_PLANEPLOTTER;
+		else if (strcmp(vstr, "beast") == 0)
+			variant = UDP_BEAST;
 		else {
 			fprintf(stderr, "invalid protocol '%s' for %s:%d\n", vstr, hstr, port);
 			err = -1; goto out;
@@ -1,14 +1,41 @@
 #ifndef __MODES_UDP_H__
 #define __MODES_UDP_H__
 
+#include "frame.h"
+
 typedef enum udp_variant {
 	UDP_RAW = 0,
 	UDP_PLANEPLOTTER = 1,
+	UDP_BEAST = 2,
 } udp_variant_t;
 
+struct udp_stats {
+	unsigned long batches; /* queue flushes */
+	unsigned long frames; /* frames flushed */
+	unsigned long syscalls; /* sendmmsg()s, across all targets */
+	unsigned long errors;
+	double latsum; /* usecs the oldest frame in each batch waited, summed */
+	double latmax;
+};
+
+/* per target, cumulative; written by the sending thread only */
+struct udp_tstats {
+	unsigned long datagrams;
+	unsigned long frames;
+	unsigned long bytes;
+	unsigned long errors;
+	unsigned long partial; /* sends that took only part of a batch */
+};
+
 int udp_addport(const char *host, unsigned short port, udp_variant_t variant);
 void udp_clearports(void);
-int udp_send(char *avrraw);
+int udp_send(const struct frame *f);
+void udp_setbatch(int frames, int msecs, int pack);
+int udp_flush(void);
+int udp_flushwait(void);
+void udp_getstats(struct udp_stats *st, int reset);
+void udp_foreach(void (*cb)(void *arg, const char *host, unsigned short port,
+    const struct udp_tstats *ts), void *arg);
 int udp_send2(char *avrraw);
 int udp_parsearg(const char *optarg);
 
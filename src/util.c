@@ -7,6 +7,9 @@
 #include <stdarg.h>
 #include <time.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <pthread.h>
 
 #include "util.h"
 
@@ -21,52 +24,254 @@ setappname(char* name) {
 		_appname = name;
 }
 
-void
-logmsg(const char *format, ...)
+#define LOG_RECMAX 512
+#define LOG_QUEUE 256 /* records; power of 2 */
+#define LOG_BATCH 64 /* records per writev() */
+
+/*
+ * Bounded multi-producer queue: a producer claims a slot by moving head
+ * on, and publishes it by setting the slot's seq to one past its position.
+ * The writer thread is the only consumer.
+ */
+struct logslot {
+	unsigned long seq;
+	int len;
+	char buf[LOG_RECMAX];
+};
+static struct logslot *logq = NULL;
+static unsigned long loghead = 0; /* producers', atomic */
+static unsigned long logtail = 0; /* writer's */
+static unsigned long logdropped = 0; /* atomic */
+static int logsleeping = 0; /* atomic */
+static int logquit = 0;
+static int logwake[2] = { -1, -1 };
+static pthread_t logthread;
+
+/* "YYYY-MM-DD HH:MM:SS.uuuuuu app: ", with the slow part redone once a second */
+static int
+log_prefix(char *buf, int len)
 {
+	static __thread time_t cachesec = -1;
+	static __thread char cache[64];
 	struct timeval tv;
+
 	gettimeofday(&tv, NULL);
-	time_t now = (time_t)tv.tv_sec;
-	struct tm *tm = localtime(&now);
-	char buf[128];
-	strftime(buf, sizeof(buf), "%F %T", tm);
-	fprintf(stderr, "%s.%06d %s: ", buf, tv.tv_usec, _appname);
+	if (tv.tv_sec != cachesec) {
+		time_t now = (time_t)tv.tv_sec;
+		struct tm tm;
+
+		localtime_r(&now, &tm);
+		strftime(cache, sizeof(cache), "%F %T", &tm);
+		cachesec = tv.tv_sec;
+	}
+	return snprintf(buf, len, "%s.%06d %s: ", cache, (int)tv.tv_usec, _appname);
+}
+
+/* queue a record, or write it now if there's no writer. drops it if the queue's full */
+static void
+log_put(const char *rec, int len)
+{
+	unsigned long pos;
+	struct logslot *s;
+
+	struct logslot *q = __atomic_load_n(&logq, __ATOMIC_ACQUIRE);
+
+	if (!q) {
+		write(2, rec, len);
+		return;
+	}
+	pos = __atomic_load_n(&loghead, __ATOMIC_RELAXED);
+	for (;;) {
+		long diff;
 
+		s = &q[pos & (LOG_QUEUE - 1)];
+		diff = (long)(__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) - pos);
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&loghead, &pos, pos + 1, 1,
+			    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			__atomic_fetch_add(&logdropped, 1, __ATOMIC_RELAXED);
+			return;
+		} else
+			pos = __atomic_load_n(&loghead, __ATOMIC_RELAXED);
+	}
+	memcpy(s->buf, rec, len);
+	s->len = len;
+	/* publish, then check for a sleeping writer; it does the opposite */
+	__atomic_store_n(&s->seq, pos + 1, __ATOMIC_SEQ_CST);
+	if (__atomic_exchange_n(&logsleeping, 0, __ATOMIC_SEQ_CST))
+		write(logwake[1], "", 1);
+	return;
+}
+
+void
+logmsg_site(struct logsite *ls, const char *format, ...)
+{
+	char rec[LOG_RECMAX];
+	struct timeval tv;
 	va_list ap;
+	int n, suppressed = 0;
+
+	/* racy between threads sharing a call site, but only ever by a message or two */
+	gettimeofday(&tv, NULL);
+	if (!ls)
+		; /* not limited */
+	else if (__atomic_load_n(&ls->sec, __ATOMIC_RELAXED) != tv.tv_sec) {
+		__atomic_store_n(&ls->sec, tv.tv_sec, __ATOMIC_RELAXED);
+		__atomic_store_n(&ls->count, 0, __ATOMIC_RELAXED);
+		suppressed = __atomic_exchange_n(&ls->suppressed, 0, __ATOMIC_RELAXED);
+	}
+	if (ls && (__atomic_fetch_add(&ls->count, 1, __ATOMIC_RELAXED) >= LOG_SITEMAX)) {
+		__atomic_fetch_add(&ls->suppressed, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	if (suppressed) {
+		n = log_prefix(rec, sizeof(rec));
+		n += snprintf(rec + n, sizeof(rec) - n, "(%d more like this suppressed) ", suppressed);
+	} else
+		n = log_prefix(rec, sizeof(rec));
+
 	va_start(ap, format);
-	vfprintf(stderr, format, ap);
+	n += vsnprintf(rec + n, sizeof(rec) - n, format, ap);
 	va_end(ap);
+	if (n >= sizeof(rec)) {
+		n = sizeof(rec);
+		rec[n - 1] = '\n';
+	}
+	log_put(rec, n);
 	return;
 }
 
-/* serial devices are not quite entirely unlike files. */
-int
-readn(int fd, unsigned char *buf, int i)
+static void *
+log_writer(void *arg)
 {
-	int c = i;
-	while (i > 0) {
-		int n = read(fd, buf, i);
-		if (n <= 0)
-			return n;
-		i -= n, buf += n;
+	struct logslot *logq = (struct logslot *)arg; /* the global goes away first at log_stop() */
+
+	for (;;) {
+		struct iovec iov[LOG_BATCH];
+		unsigned long dropped;
+		int n = 0, i;
+
+		while (n < LOG_BATCH) {
+			struct logslot *s = &logq[(logtail + n) & (LOG_QUEUE - 1)];
+
+			if (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) != logtail + n + 1)
+				break;
+			iov[n].iov_base = s->buf;
+			iov[n].iov_len = s->len;
+			n++;
+		}
+		if (n) {
+			writev(2, iov, n);
+			for (i = 0; i < n; i++, logtail++)
+				__atomic_store_n(&logq[logtail & (LOG_QUEUE - 1)].seq,
+				    logtail + LOG_QUEUE, __ATOMIC_RELEASE);
+			continue;
+		}
+		if ((dropped = __atomic_exchange_n(&logdropped, 0, __ATOMIC_RELAXED))) {
+			char rec[128];
+			int len = log_prefix(rec, sizeof(rec));
+
+			len += snprintf(rec + len, sizeof(rec) - len,
+			    "%lu log messages dropped, queue full\n", dropped);
+			write(2, rec, len);
+		}
+		if (__atomic_load_n(&logquit, __ATOMIC_ACQUIRE))
+			break;
+
+		/* say we're going to sleep, then look once more before we do */
+		__atomic_store_n(&logsleeping, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&logq[logtail & (LOG_QUEUE - 1)].seq, __ATOMIC_SEQ_CST) ==
+		    logtail + 1) {
+			__atomic_store_n(&logsleeping, 0, __ATOMIC_RELAXED);
+			continue;
+		}
+		{
+			char c;
+			while ((read(logwake[0], &c, 1) == -1) && (errno == EINTR))
+				;
+		}
 	}
-	return c;
+	return NULL;
 }
 
+/* hand records to a writer thread from now on */
 int
-readln(int fd, char *buf, int buflen)
+log_start(void)
 {
-	int i = 0;
-
-	while (i < (buflen -  1)) {
-		if (read(fd, buf, 1) != 1)
-			return -1;
-		if (*buf == '\r') continue;
-		if (*buf == '\n') break;
-		buf++, i++;
+	unsigned long i;
+
+	if (logq)
+		return 0;
+	if (!(logq = calloc(LOG_QUEUE, sizeof(struct logslot))))
+		return -1;
+	for (i = 0; i < LOG_QUEUE; i++)
+		logq[i].seq = i;
+	if (pipe(logwake) == -1)
+		goto fail;
+	if (pthread_create(&logthread, NULL, log_writer, logq)) {
+		close(logwake[0]);
+		close(logwake[1]);
+		goto fail;
 	}
-	*buf = '\0';
+	atexit(log_stop);
+	return 0;
+fail:
+	free(logq);
+	logq = NULL;
+	return -1;
+}
+
+/*
+ * write out what's queued and go back to writing directly. the queue
+ * isn't freed: at exit() another thread could still be putting to it.
+ */
+void
+log_stop(void)
+{
+	if (!__atomic_exchange_n(&logq, NULL, __ATOMIC_SEQ_CST))
+		return;
+	__atomic_store_n(&logquit, 1, __ATOMIC_RELEASE);
+	write(logwake[1], "", 1);
+	pthread_join(logthread, NULL);
+	return;
+}
+
+/* hex digit value, or -1 */
+static const signed char hexval[256] = {
+	[0 ... 255] = -1,
+	['0'] = 0, ['1'] = 1, ['2'] = 2, ['3'] = 3, ['4'] = 4,
+	['5'] = 5, ['6'] = 6, ['7'] = 7, ['8'] = 8, ['9'] = 9,
+	['A'] = 10, ['B'] = 11, ['C'] = 12, ['D'] = 13, ['E'] = 14, ['F'] = 15,
+	['a'] = 10, ['b'] = 11, ['c'] = 12, ['d'] = 13, ['e'] = 14, ['f'] = 15,
+};
+
+/* decode len bytes from 2*len hex digits. returns len, or -1 on a non-hex digit */
+int
+hexdecode(unsigned char *dst, const char *src, int len)
+{
+	int i, bad = 0;
 
-	return i;
+	for (i = 0; i < len; i++) {
+		int hi = hexval[(unsigned char)src[2*i]];
+		int lo = hexval[(unsigned char)src[2*i + 1]];
+		bad |= hi | lo;
+		dst[i] = (hi << 4) | lo;
+	}
+	return (bad < 0) ? -1 : len;
 }
 
+/* uppercase hex, not NUL terminated. returns 2*len */
+int
+hexencode(char *dst, const unsigned char *src, int len)
+{
+	static const char digits[] = "0123456789ABCDEF";
+	int i;
+
+	for (i = 0; i < len; i++) {
+		*dst++ = digits[src[i] >> 4];
+		*dst++ = digits[src[i] & 0xf];
+	}
+	return 2*len;
+}
@@ -7,9 +7,36 @@
 #include <string.h>
 
 extern void setappname(char* name);
-extern void logmsg(const char *format, ...);
 
-extern int readn(int fd, unsigned char *buf, int i);
-extern int readln(int fd, char *buf, int buflen);
+/*
+ * logmsg() is cheap enough to leave in hot paths: the time prefix is only
+ * reformatted once a second, each call site gets LOG_SITEMAX messages a
+ * second before the rest are counted and dropped, and once log_start()'s
+ * been called, formatted records go through a lock-free queue to a writer
+ * thread instead of to stderr directly.
+ */
+#define LOG_SITEMAX 10
+
+struct logsite {
+	long sec; /* the second count is for */
+	int count;
+	int suppressed; /* past LOG_SITEMAX in a previous second, not yet said */
+};
+
+#define logmsg(...) do { \
+	static struct logsite logsite_; \
+	logmsg_site(&logsite_, __VA_ARGS__); \
+} while (0)
+
+/* for a site that says one thing per device, say, that all need saying */
+#define logmsg_always(...) logmsg_site(NULL, __VA_ARGS__)
+
+extern void logmsg_site(struct logsite *ls, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+extern int log_start(void);
+extern void log_stop(void);
+
+extern int hexdecode(unsigned char *dst, const char *src, int len);
+extern int hexencode(char *dst, const unsigned char *src, int len);
 
 #endif /* ndef __MODES_UTIL_H__ */